@@ -0,0 +1,1402 @@
+/*
+ * bench.c
+ *
+ * Microbenchmarks for net367 building blocks.  Built with
+ * "make bench" and run as ./bench367.  "./bench367 sim [side]"
+ * instead measures how the simulator scales with threads, and
+ * "./bench367 config [links]" how fast topologies load, and
+ * "./bench367 fork [nodes]" what starting a process per node costs,
+ * and "./bench367 capture" what packet capture adds to a packet.
+ * "./bench367 micro [file.csv]" times the primitives hosts run on
+ * for every packet, and writes the results as CSV if asked.
+ * "./bench367 dircache" compares opening a file by its path with
+ * the hosts' directory index, and "./bench367 delta" how fast
+ * delta transfer signs, encodes and rebuilds a lightly edited file.
+ * "./bench367 sched" shows how the uploads' scheduler shares a link
+ * between a large upload and small ones, and what it costs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <dirent.h>
+
+#include "main.h"
+#include "packet.h"
+#include "crc32c.h"
+#include "lz.h"
+#include "net.h"
+#include "sim.h"
+#include "uring.h"
+#include "emu.h"
+#include "config.h"
+#include "capture.h"
+#include "host.h"
+#include "dircache.h"
+#include "delta.h"
+#include "sched.h"
+
+#define BENCH_BYTES (256*1024*1024)	/* Bytes checksummed per run */
+#define BENCH_PACKETS 20000
+#define BENCH_LZ_BYTES (4*1024*1024)	/* Size of generated inputs */
+
+#define BENCH_SIM_DIR "/tmp/bench367"
+#define BENCH_SIM_SIDE 100		/* Grid of 100 x 100 hosts */
+#define BENCH_SIM_FILE 50000		/* Bytes each sender uploads */
+#define BENCH_SIM_US 3000000		/* Simulated time per run */
+#define BENCH_CONFIG_LINKS 1000000	/* Links in the generated topology */
+#define BENCH_FORK_NODES 1000		/* Hosts in the ring started */
+#define BENCH_MICRO_RUNS 5		/* Runs of each, the fastest kept */
+#define BENCH_MICRO_OPS 200000		/* Operations timed per run */
+#define BENCH_MICRO_BUFS 64		/* File buffers filled in turn */
+#define BENCH_DIR_FILES 1000		/* Files in the indexed directory */
+#define BENCH_DIR_OPENS 200000		/* Files opened per run */
+#define BENCH_DIR_HOT 16		/* Files opened again and again */
+#define BENCH_DELTA_BYTES (32*1024*1024)	/* Size of the file */
+#define BENCH_DELTA_EDITS 16		/* Edits between the copies */
+#define BENCH_SCHED_LARGE 1000		/* Segments of the large upload */
+#define BENCH_SCHED_SMALL 20		/* Small uploads behind it */
+#define BENCH_SCHED_SEGS 5		/*    of this many segments */
+#define BENCH_SCHED_OPS 4000000		/* Segments through the scheduler */
+
+static double bench_now()
+{
+struct timespec t;
+
+clock_gettime(CLOCK_MONOTONIC, &t);
+return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* Checksum throughput of one implementation at one buffer size */
+static void bench_crc(char *name,
+		unsigned int (*f)(unsigned int, const void *, int),
+		char *buf, int size)
+{
+double t0, t1;
+long iters;
+long i;
+unsigned int crc = 0;
+
+iters = BENCH_BYTES / size;
+t0 = bench_now();
+for (i=0; i<iters; i++) {
+	crc = f(crc, buf, size);
+}
+t1 = bench_now();
+printf("crc32c %-4s size %6d: %8.1f MB/s  %7.1f ns/op  (%08x)\n",
+	name, size, iters * (double) size / (t1 - t0) / 1e6,
+	(t1 - t0) * 1e9 / iters, crc);
+}
+
+/*
+ * Send and receive full-size packets through a pipe, with
+ * read() and write() or, if 'ring' is set, through io_uring.
+ * Packets go 'batch' at a time, as a host sends them in a pass
+ * of its loop.
+ */
+static void bench_pipe(int mtu, int crc, struct uring *ring, int batch)
+{
+static struct packet p;
+static struct packet q;
+struct net_port port;
+int fd[2];
+double t0, t1;
+int i, b;
+
+pipe(fd);
+fcntl(fd[0], F_SETFL, fcntl(fd[0], F_GETFL) | O_NONBLOCK);
+fcntl(fd[1], F_SETFL, fcntl(fd[1], F_GETFL) | O_NONBLOCK);
+memset(&port, 0, sizeof(port));
+port.type = PIPE;
+port.pipe_peer_id = mtu;	/* Names its capture file, if any */
+port.pipe_send_fd = fd[1];
+port.pipe_recv_fd = fd[0];
+port.mtu = mtu;
+port.crc = crc;
+if (ring != NULL) {
+	port.urx = uring_chan_create(ring, fd[0], 0);
+	port.utx = uring_chan_create(ring, fd[1], 1);
+	uring_submit(ring);
+}
+
+p.src = 0;
+p.dst = 1;
+p.type = PKT_FILE_UPLOAD_DATA;
+p.length = mtu;
+for (i=0; i<mtu; i++) p.payload[i] = (char) i;
+
+t0 = bench_now();
+for (i=0; i<BENCH_PACKETS; i+=batch) {
+	for (b=0; b<batch; b++) packet_send(&port, &p);
+	if (ring != NULL) uring_submit(ring);
+	for (b=0; b<batch; b++) {
+		while (packet_recv(&port, &q) <= 0) {	/* Jumbo frames */
+			packet_flush(&port);		/*    take a few */
+			if (ring != NULL) uring_submit(ring);
+		}
+	}
+}
+t1 = bench_now();
+if (ring != NULL && (port.urx->failed || port.utx->failed)) {
+	printf("packet send+recv, mtu %5d: io_uring fell back to "
+		"read() and write()\n", mtu);
+}
+printf("packet send+recv, mtu %5d, crc %s, %s, batch %d: "
+	"%8.1f ns/packet, %7.1f MB/s, crc errors %ld\n",
+	mtu, crc ? "on " : "off", ring != NULL ? "io_uring" : "syscalls",
+	batch,
+	(t1 - t0) * 1e9 / BENCH_PACKETS,
+	(double) mtu * BENCH_PACKETS / (t1 - t0) / 1e6,
+	port.crc_errors);
+close(fd[0]);
+close(fd[1]);
+free(port.rx_buf);
+free(port.tx_buf);
+}
+
+/*
+ * Compression ratio and speed of the chunked stream on one input,
+ * and what that buys on a link of 'link_mbs' MB/s: the link
+ * carries compressed bytes, so the file moves 'ratio' times faster
+ * unless the codec itself is slower than that.
+ */
+static void bench_lz(char *name, char *data, int n)
+{
+static struct lz_stream z;
+static char chunk[LZ_CHUNK];
+static double link_mbs[] = {1, 10, 100};
+char *enc;
+double t0, t1, t2;
+double ratio, comp_mbs, decomp_mbs, eff;
+long raw;
+int wire;
+int rounds;
+int r, i, k;
+
+rounds = BENCH_LZ_BYTES / n;
+if (rounds < 1) rounds = 1;
+enc = (char *) malloc(n + (n / LZ_CHUNK + 1) * LZ_REC_HDR);
+
+/* Compress the whole input 'rounds' times, keeping the stream */
+t0 = bench_now();
+for (r=0; r<rounds; r++) {
+	lz_stream_init(&z);
+	wire = 0;
+	for (i=0; i<n; i+=LZ_CHUNK) {
+		k = n - i < LZ_CHUNK ? n - i : LZ_CHUNK;
+		lz_stream_put_chunk(&z, data+i, k, 1);
+		wire += lz_stream_get(&z, enc+wire, z.len);
+	}
+}
+t1 = bench_now();
+
+/* Feed the stream to a receiver in 1000-byte pieces */
+for (r=0; r<rounds; r++) {
+	lz_stream_init(&z);
+	for (i=0; i<wire; i+=k) {
+		k = wire - i < 1000 ? wire - i : 1000;
+		lz_stream_append(&z, enc+i, k);
+		while (lz_stream_next_chunk(&z, chunk) > 0);
+	}
+}
+t2 = bench_now();
+free(enc);
+
+raw = (long) n * rounds;
+ratio = (double) n / wire;
+comp_mbs = raw / (t1 - t0) / 1e6;
+decomp_mbs = raw / (t2 - t1) / 1e6;
+printf("lz %-18s %8d bytes: ratio %5.2f, compress %7.1f MB/s, "
+	"decompress %7.1f MB/s\n", name, n, ratio, comp_mbs, decomp_mbs);
+for (i=0; i<3; i++) {
+	eff = link_mbs[i] * ratio;
+	if (eff > comp_mbs) eff = comp_mbs;
+	if (eff > decomp_mbs) eff = decomp_mbs;
+	printf("   on a %5.0f MB/s link: %8.1f MB/s of file, gain x%.2f\n",
+		link_mbs[i], eff, eff / link_mbs[i]);
+}
+}
+
+/* Compress a file from the test directories */
+static void bench_lz_file(char *fname)
+{
+char *data;
+FILE *fp;
+int n;
+
+fp = fopen(fname, "r");
+if (fp == NULL) return;
+data = (char *) malloc(BENCH_LZ_BYTES);
+n = fread(data, 1, BENCH_LZ_BYTES, fp);
+fclose(fp);
+if (n > 0) bench_lz(fname, data, n);
+free(data);
+}
+
+/*
+ * A side x side grid of hosts with 1 ms links, and a file to
+ * upload, in BENCH_SIM_DIR
+ */
+static void bench_sim_setup(int side)
+{
+FILE *fp;
+int r, c, i;
+
+mkdir(BENCH_SIM_DIR, 0755);
+mkdir(BENCH_SIM_DIR "/src", 0755);
+mkdir(BENCH_SIM_DIR "/dst", 0755);
+fp = fopen(BENCH_SIM_DIR "/data", "w");
+for (i=0; i<BENCH_SIM_FILE; i++) fputc('a' + (i * 7 + i / 100) % 26, fp);
+fclose(fp);
+rename(BENCH_SIM_DIR "/data", BENCH_SIM_DIR "/src/data");
+
+fp = fopen(BENCH_SIM_DIR "/grid.config", "w");
+fprintf(fp, "%d\n", side * side);
+for (i=0; i<side*side; i++) fprintf(fp, "H %d\n", i);
+fprintf(fp, "%d\n", 2 * side * (side - 1));
+for (r=0; r<side; r++) {
+	for (c=0; c<side; c++) {
+		i = r * side + c;
+		if (c + 1 < side) fprintf(fp, "P %d %d delay=1ms\n", i, i+1);
+		if (r + 1 < side) {
+			fprintf(fp, "P %d %d delay=1ms\n", i, i+side);
+		}
+	}
+}
+fclose(fp);
+}
+
+/*
+ * One run of the simulator with 'threads' threads, in a child
+ * process since the simulator cannot be set up twice.  Every
+ * eighth column of hosts uploads the file to its neighbour on the
+ * right.  Returns the wall time, or -1.
+ */
+static double bench_sim_run(int side, int threads)
+{
+char msg[100];
+double t0, t1;
+int fd[2];
+int out, null;
+int r, c;
+pid_t pid;
+
+pipe(fd);
+fflush(stdout);
+pid = fork();
+if (pid == 0) {
+	close(fd[0]);
+	out = dup(1);
+	null = open("/dev/null", O_WRONLY);
+	dup2(null, 1);		/* The network listing is long */
+	net_use_sim_links();
+	if (net_init_file(BENCH_SIM_DIR "/grid.config") == 0) exit(1);
+	fflush(stdout);
+	dup2(out, 1);
+	sim_init(net_get_node_list(), threads);
+	fflush(stdout);
+	dup2(null, 1);		/* So are the hosts' messages */
+
+	chdir(BENCH_SIM_DIR);	/* Hosts' directories are relative */
+	for (r=0; r<side; r++) {
+		for (c=0; c<side; c++) {
+			sprintf(msg, "%s", c % 8 == 0 ? "src" : "dst");
+			sim_command(r * side + c, 'm', msg);
+			if (c % 8 == 0 && c + 1 < side) {
+				sprintf(msg, "%d data", r * side + c + 1);
+				sim_command(r * side + c, 'u', msg);
+			}
+		}
+	}
+	t0 = bench_now();
+	sim_run(BENCH_SIM_US);
+	t1 = bench_now();
+
+	fflush(stdout);
+	dup2(out, 1);
+	printf("   ");
+	sim_report();
+	fflush(stdout);
+	t1 -= t0;
+	write(fd[1], &t1, sizeof(t1));
+	exit(0);
+}
+close(fd[1]);
+if (read(fd[0], &t1, sizeof(t1)) != sizeof(t1)) t1 = -1;
+close(fd[0]);
+waitpid(pid, NULL, 0);
+return t1;
+}
+
+/*
+ * Wall time of the same simulation with 1, 2, 4, ... threads, up
+ * to twice the number of cores or 16, whichever is more
+ */
+static void bench_sim(int side)
+{
+double t, t1 = -1;
+int cores;
+int max;
+int p;
+
+cores = sysconf(_SC_NPROCESSORS_ONLN);
+max = 2 * cores > 16 ? 2 * cores : 16;
+printf("Simulator scaling: %d hosts in a %d x %d grid, %d cores, "
+	"%.1f s simulated\n", side * side, side, side, cores,
+	BENCH_SIM_US / 1e6);
+bench_sim_setup(side);
+for (p=1; p<=max; p*=2) {
+	t = bench_sim_run(side, p);
+	if (t < 0) {
+		printf("threads %2d: failed\n", p);
+		continue;
+	}
+	if (p == 1) t1 = t;
+	printf("threads %2d: %8.3f s wall, speedup x%.2f\n", p, t,
+		t1 > 0 ? t1 / t : 0);
+}
+}
+
+/*
+ * A text configuration read with fscanf(), as net.c once did, for
+ * comparison
+ */
+static int bench_config_fscanf(char *fname, struct net_config *c)
+{
+char options[STRING_MAX];
+struct net_link *l;
+char type;
+char *opt;
+int id;
+int i;
+FILE *fp;
+
+fp = fopen(fname, "r");
+if (fp == NULL) return 0;
+fscanf(fp, "%d", &c->node_num);
+c->node = (struct net_node *) malloc(c->node_num * sizeof(struct net_node));
+for (i=0; i<c->node_num; i++) {
+	fscanf(fp, " %c %d", &type, &id);
+	c->node[i].type = HOST;
+	c->node[i].id = id;
+}
+fscanf(fp, " %d", &c->link_num);
+c->link = (struct net_link *) malloc(c->link_num * sizeof(struct net_link));
+for (i=0; i<c->link_num; i++) {
+	l = &c->link[i];
+	fscanf(fp, " %c %d %d", &type, &l->pipe_node0, &l->pipe_node1);
+	l->type = PIPE;
+	l->crc = 0;
+	l->mtu = MTU_DEFAULT;
+	emu_init(&l->emu, 0);
+	fgets(options, STRING_MAX, fp);
+	for (opt = strtok(options, " \t\r\n"); opt != NULL;
+			opt = strtok(NULL, " \t\r\n")) {
+		if (strcmp(opt, "crc") == 0) l->crc = 1;
+		else emu_parse_option(&l->emu, opt);
+	}
+}
+fclose(fp);
+return 1;
+}
+
+/*
+ * Load time of a topology with 'links' links, a ring of hosts each
+ * linked to its neighbours 1, 2 and 7 places on, some with options,
+ * as text and converted to binary
+ */
+static void bench_config(int links)
+{
+struct net_config c;
+char text[] = BENCH_SIM_DIR "/topo.config";
+char bin[] = BENCH_SIM_DIR "/topo.bin";
+double t;
+int nodes;
+int i, k;
+FILE *fp;
+
+static int step[] = {1, 2, 7};
+
+nodes = (links + 2) / 3;
+mkdir(BENCH_SIM_DIR, 0755);
+fp = fopen(text, "w");
+fprintf(fp, "%d\n", nodes);
+for (i=0; i<nodes; i++) fprintf(fp, "H %d\n", i);
+fprintf(fp, "%d\n", links);
+for (k=0; k<links; k++) {
+	i = k / 3;
+	fprintf(fp, "P %d %d%s\n", i, (i + step[k % 3]) % nodes,
+		k % 10 == 0 ? " crc delay=2ms loss=0.1%" : "");
+}
+fclose(fp);
+printf("Config loading: %d nodes, %d links\n", nodes, links);
+
+t = bench_now();
+if (!bench_config_fscanf(text, &c)) return;
+printf("   fscanf   %8.1f ms\n", (bench_now() - t) * 1e3);
+config_free(&c);
+
+t = bench_now();
+if (!config_load(text, &c)) return;
+printf("   text     %8.1f ms\n", (bench_now() - t) * 1e3);
+config_save_binary(bin, &c);
+config_free(&c);
+
+t = bench_now();
+if (!config_load(bin, &c)) return;
+printf("   binary   %8.1f ms\n", (bench_now() - t) * 1e3);
+config_free(&c);
+unlink(text);
+unlink(bin);
+}
+
+/* The open files of this process */
+static int bench_fds()
+{
+DIR *dir;
+int n = 0;
+
+dir = opendir("/proc/self/fd");
+if (dir == NULL) return -1;
+while (readdir(dir) != NULL) n++;
+closedir(dir);
+return n - 3;		/* ".", ".." and dir itself */
+}
+
+/* This process's resident memory in kB */
+static long bench_rss()
+{
+char line[200];
+long kb = -1;
+FILE *fp;
+
+fp = fopen("/proc/self/status", "r");
+if (fp == NULL) return -1;
+while (fgets(line, sizeof(line), fp) != NULL) {
+	if (sscanf(line, "VmRSS: %ld", &kb) == 1) break;
+}
+fclose(fp);
+return kb;
+}
+
+/*
+ * Start a process per node of a ring of 'nodes' hosts as main.c
+ * does, with or without closing the pipe ends each does not use,
+ * and report the time to fork and each node's files and memory.
+ * In a child process, since the network is set up only once.
+ */
+static void bench_fork_run(int nodes, int close_fds)
+{
+struct net_node *p;
+struct rlimit lim;
+double t, fork_t;
+long stat[2], fds, rss;
+int go[2], res[2];
+int out, null;
+int n;
+pid_t pid;
+
+fflush(stdout);
+if (fork() != 0) {
+	wait(NULL);
+	return;
+}
+getrlimit(RLIMIT_NOFILE, &lim);
+lim.rlim_cur = lim.rlim_max;
+setrlimit(RLIMIT_NOFILE, &lim);
+out = dup(1);
+null = open("/dev/null", O_WRONLY);
+dup2(null, 1);
+if (net_init_file(BENCH_SIM_DIR "/ring.config") == 0) _exit(1);
+fflush(stdout);
+dup2(out, 1);
+close(null);
+close(out);
+
+pipe(go);
+pipe(res);
+fork_t = 0;
+n = 0;
+for (p = net_get_node_list(); p != NULL; p = p->next) {
+	t = bench_now();
+	pid = fork();
+	fork_t += bench_now() - t;
+	if (pid < 0) break;
+	if (pid == 0) {
+		close(go[1]);
+		if (close_fds) net_close_ports_except(p->id);
+		stat[0] = bench_fds();
+		stat[1] = bench_rss();
+		write(res[1], stat, sizeof(stat));
+		read(go[0], stat, 1);	/* Stay until all are measured */
+		_exit(0);
+	}
+	if (close_fds) net_close_node_ports(p->id);
+	n++;
+}
+fds = rss = 0;
+for (p = net_get_node_list(); p != NULL && n > 0; p = p->next, n--) {
+	if (read(res[0], stat, sizeof(stat)) != sizeof(stat)) break;
+	fds += stat[0];
+	rss += stat[1];
+}
+printf("   %-16s fork %7.1f ms, %6.1f us per node; per node %7.1f fds,"
+	" %6ld kB RSS; manager %d fds\n",
+	close_fds ? "closing unused" : "inheriting all", fork_t * 1e3,
+	fork_t * 1e6 / nodes, (double) fds / nodes, rss / nodes,
+	bench_fds());
+fflush(stdout);
+close(go[1]);
+while (wait(NULL) > 0);
+_exit(0);
+}
+
+static void bench_fork(int nodes)
+{
+FILE *fp;
+int i;
+
+mkdir(BENCH_SIM_DIR, 0755);
+fp = fopen(BENCH_SIM_DIR "/ring.config", "w");
+fprintf(fp, "%d\n", nodes);
+for (i=0; i<nodes; i++) fprintf(fp, "H %d\n", i);
+fprintf(fp, "%d\n", nodes);
+for (i=0; i<nodes; i++) fprintf(fp, "P %d %d\n", i, (i + 1) % nodes);
+fclose(fp);
+printf("Process per node startup: %d hosts in a ring\n", nodes);
+bench_fork_run(nodes, 0);
+bench_fork_run(nodes, 1);
+}
+
+/* Packets through a pipe without capture, then with it */
+static void bench_capture(int *mtus, int num)
+{
+int i;
+
+mkdir(BENCH_SIM_DIR, 0755);
+for (i=0; i<num; i++) bench_pipe(mtus[i], 0, NULL, 1);
+printf("With capture to " BENCH_SIM_DIR "/0-<mtu>.pcap, "
+	"%d bytes of each frame\n", CAPTURE_SNAP_DEFAULT);
+capture_enable(BENCH_SIM_DIR, CAPTURE_SNAP_DEFAULT);
+for (i=0; i<num; i++) bench_pipe(mtus[i], 0, NULL, 1);
+}
+
+/*
+ * Opening files of a directory the way uploads used to, by path
+ * with fopen(), and through the directory index, which dup()s a
+ * handle it keeps; and the index lookup alone.  A few files opened
+ * again and again have their handles kept; of all the files in
+ * the directory most do not.
+ */
+static void bench_dircache()
+{
+struct dir_cache *d;
+char dir[NAME_LENGTH];
+char name[NAME_LENGTH];
+char path[2*NAME_LENGTH];
+double t0, t1;
+FILE *fp;
+int files;
+int i, k, fd;
+
+sprintf(dir, "%s/dircache", BENCH_SIM_DIR);
+mkdir(BENCH_SIM_DIR, 0755);
+mkdir(dir, 0755);
+for (i=0; i<BENCH_DIR_FILES; i++) {
+	sprintf(path, "%s/file%d.txt", dir, i);
+	fp = fopen(path, "w");
+	fprintf(fp, "%d\n", i);
+	fclose(fp);
+}
+
+d = dir_cache_open(dir);
+for (k=0; k<2; k++) {
+	files = k == 0 ? BENCH_DIR_HOT : BENCH_DIR_FILES;
+	t0 = bench_now();
+	for (i=0; i<BENCH_DIR_OPENS; i++) {
+		sprintf(path, "%s/file%d.txt", dir, i % files);
+		fp = fopen(path, "r");
+		fclose(fp);
+	}
+	t1 = bench_now();
+	printf("dircache, %4d files: path and fopen() %8.1f ns/open\n",
+		files, (t1 - t0) * 1e9 / BENCH_DIR_OPENS);
+
+	t0 = bench_now();
+	for (i=0; i<BENCH_DIR_OPENS; i++) {
+		sprintf(name, "file%d.txt", i % files);
+		fd = dir_cache_read_fd(d, name);
+		close(fd);
+	}
+	t1 = bench_now();
+	printf("dircache, %4d files: index and dup()  %8.1f ns/open\n",
+		files, (t1 - t0) * 1e9 / BENCH_DIR_OPENS);
+
+	t0 = bench_now();
+	for (i=0; i<BENCH_DIR_OPENS; i++) {
+		sprintf(name, "file%d.txt", i % files);
+		if (dir_cache_find(d, name) == NULL) {
+			printf("missing %s\n", name);
+		}
+	}
+	t1 = bench_now();
+	printf("dircache, %4d files: index lookup     %8.1f ns/lookup\n",
+		files, (t1 - t0) * 1e9 / BENCH_DIR_OPENS);
+}
+printf("dircache: %d of %d files kept open\n", d->fds, d->num);
+
+/* A change seen through inotify */
+sprintf(path, "%s/file0.txt", dir);
+fp = fopen(path, "a");
+fprintf(fp, "more\n");
+fclose(fp);
+dir_cache_refresh(d);
+printf("dircache: after append, file0.txt is %lld bytes (%ld events)\n",
+	dir_cache_find(d, "file0.txt")->size, d->events);
+dir_cache_close(d);
+}
+
+/* Write n bytes to a new file and open it for reading */
+static int bench_delta_file(char *name, char *data, int n)
+{
+FILE *fp;
+
+fp = fopen(name, "w");
+fwrite(data, 1, n, fp);
+fclose(fp);
+return open(name, O_RDONLY);
+}
+
+/*
+ * Rebuild a file of n random bytes, of which the receiver's copy
+ * differs in 'edits' places, and set *chunks to the chunks of ops
+ * it took; returns 1 if it checks out
+ */
+static int bench_delta_round(int n, int edits, int *chunks)
+{
+struct delta_sigs *sigs;
+struct delta_enc *e;
+struct delta_dec *d;
+static char chunk[LZ_CHUNK];
+char *data;
+char *sig_buf;
+char old_name[NAME_LENGTH], new_name[NAME_LENGTH], out_name[NAME_LENGTH];
+FILE *out;
+int old_fd, new_fd;
+int sig_len;
+int ok = 1;
+int i, k;
+
+data = (char *) malloc(n);
+srand(n + edits);
+for (i=0; i<n; i++) data[i] = (char) rand();
+mkdir(BENCH_SIM_DIR, 0755);
+sprintf(old_name, "%s/round.old", BENCH_SIM_DIR);
+sprintf(new_name, "%s/round.new", BENCH_SIM_DIR);
+sprintf(out_name, "%s/round.out", BENCH_SIM_DIR);
+new_fd = bench_delta_file(new_name, data, n);
+for (k=0; k<edits; k++) {
+	i = (int) ((long long) (n - 4) * (2*k + 1) / (2*edits));
+	memset(data + i, 'x', 4);
+}
+old_fd = bench_delta_file(old_name, data, n);
+
+sig_len = delta_sign(old_fd, &sig_buf);
+sigs = delta_sigs_create(0, "round");
+delta_sigs_append(sigs, sig_buf, sig_len);
+delta_sigs_parse(sigs);
+out = fopen(out_name, "w");
+d = delta_dec_create(old_fd, out, out_name);
+e = delta_enc_create(sigs, new_fd);
+*chunks = 0;
+while (!delta_enc_done(e)) {
+	k = delta_enc_next(e, chunk);
+	(*chunks)++;
+	if (delta_dec_chunk(d, chunk, k) < 0) ok = 0;
+}
+fclose(out);
+ok = ok && delta_dec_ok(d);
+delta_enc_free(e);
+delta_dec_free(d);
+free(sig_buf);
+free(data);
+close(new_fd);
+unlink(old_name);
+unlink(new_name);
+unlink(out_name);
+return ok;
+}
+
+/*
+ * Delta transfer of a file of random bytes to a receiver whose copy
+ * differs by a few small edits: signing the copy, encoding the new
+ * file against the signatures, and rebuilding it from the copy
+ */
+static void bench_delta()
+{
+static int round_bytes[] = {100000, 361356, 361356, 1048653, 1048653};
+static int round_edits[] = {1, 1, 64, 1, 256};
+struct delta_sigs *sigs;
+struct delta_enc *e;
+struct delta_dec *d;
+static char chunk[LZ_CHUNK];
+char *data;
+char *sig_buf;
+char old_name[NAME_LENGTH], new_name[NAME_LENGTH], out_name[NAME_LENGTH];
+double t0, t1, t2, t3;
+long long ops = 0;
+long long matched;
+FILE *out;
+int old_fd, new_fd;
+int sig_len;
+int i, k, n;
+
+data = (char *) malloc(BENCH_DELTA_BYTES);
+srand(1);
+for (i=0; i<BENCH_DELTA_BYTES; i++) data[i] = (char) rand();
+mkdir(BENCH_SIM_DIR, 0755);
+sprintf(old_name, "%s/delta.old", BENCH_SIM_DIR);
+sprintf(new_name, "%s/delta.new", BENCH_SIM_DIR);
+sprintf(out_name, "%s/delta.out", BENCH_SIM_DIR);
+new_fd = bench_delta_file(new_name, data, BENCH_DELTA_BYTES);
+for (k=0; k<BENCH_DELTA_EDITS; k++) {	/* Small edits, spread out */
+	i = (int) ((long long) BENCH_DELTA_BYTES * k / BENCH_DELTA_EDITS);
+	memset(data + i + 1234, 'x', 10);
+}
+old_fd = bench_delta_file(old_name, data, BENCH_DELTA_BYTES);
+
+t0 = bench_now();
+sig_len = delta_sign(old_fd, &sig_buf);
+sigs = delta_sigs_create(0, "delta");
+delta_sigs_append(sigs, sig_buf, sig_len);
+delta_sigs_parse(sigs);
+t1 = bench_now();
+
+out = fopen(out_name, "w");
+d = delta_dec_create(old_fd, out, out_name);
+e = delta_enc_create(sigs, new_fd);
+t2 = 0;
+while (!delta_enc_done(e)) {
+	n = delta_enc_next(e, chunk);
+	ops += n;
+	t3 = bench_now();
+	if (delta_dec_chunk(d, chunk, n) < 0) printf("delta: corrupt\n");
+	t2 += bench_now() - t3;
+}
+t3 = bench_now();
+fclose(out);
+matched = delta_enc_matched(e);
+
+printf("delta: %d MB, %d edits, %d byte blocks\n",
+	BENCH_DELTA_BYTES >> 20, BENCH_DELTA_EDITS, sigs->block);
+printf("delta: sign %7.1f MB/s, %d bytes of signatures\n",
+	BENCH_DELTA_BYTES / (t1 - t0) / 1e6, sig_len);
+printf("delta: encode %5.1f MB/s, %lld bytes of ops, "
+	"%lld bytes matched\n",
+	BENCH_DELTA_BYTES / (t3 - t1 - t2) / 1e6, ops, matched);
+printf("delta: rebuild %4.1f MB/s, %s\n",
+	BENCH_DELTA_BYTES / t2 / 1e6,
+	delta_dec_ok(d) ? "checks out" : "DOES NOT CHECK OUT");
+printf("delta: %.1f times fewer bytes than the file\n",
+	(double) BENCH_DELTA_BYTES / (ops + sig_len));
+delta_enc_free(e);
+delta_dec_free(d);
+free(sig_buf);
+free(data);
+close(new_fd);
+unlink(old_name);
+unlink(new_name);
+unlink(out_name);
+
+/* Files that end in part of a block, with ops over many chunks */
+for (i=0; i<sizeof(round_bytes)/sizeof(int); i++) {
+	k = bench_delta_round(round_bytes[i], round_edits[i], &n);
+	printf("delta: round trip of %7d bytes, %3d edits, %3d chunks: %s\n",
+		round_bytes[i], round_edits[i], n,
+		k ? "checks out" : "DOES NOT CHECK OUT");
+}
+}
+
+/*
+ * Run what is queued through the scheduler, as a link would, and
+ * note when each flow's last segment goes out, in bytes sent since
+ * the start.  The port of each segment is the index of its flow.
+ */
+static long long bench_sched_drain(struct sched *s, long long done[])
+{
+struct packet *p;
+long long sent = 0;
+int i;
+
+while ((p = sched_remove(s, &i)) != NULL) {
+	sent += PKT_HDR_LEN + p->length;
+	done[i] = sent;
+	free(p);
+}
+return sent;
+}
+
+static void bench_sched_queue(struct sched *s, struct sched_flow *f,
+		int i, int segs)
+{
+struct packet *p;
+int k;
+
+for (k=0; k<segs; k++) {
+	p = (struct packet *) malloc(sizeof(struct packet));
+	p->length = 1400;
+	sched_add(s, f, p, i);
+}
+}
+
+/*
+ * Deficit round-robin on a mixed workload: a large upload whose
+ * segments are all queued first, and small ones queued behind it.
+ * Time on the link is counted in bytes.  When the small uploads
+ * finish is compared with a single FIFO queue, which is how the
+ * segments went out before, and two large uploads with weights
+ * 1 and 3 show the shares.  Then the scheduler is timed with
+ * 1 to 256 flows taking turns.
+ */
+static void bench_sched()
+{
+static struct sched_flow f[1 + BENCH_SCHED_SMALL];
+static int flows[] = {1, 16, 256};
+long long done[1 + BENCH_SCHED_SMALL];
+struct sched_flow *g;
+struct packet *p;
+struct sched s;
+long long cost, fifo, drr, sent;
+double t0, t1;
+int i, j, k, n;
+
+cost = PKT_HDR_LEN + 1400;
+sched_init(&s);
+sched_flow_init(&f[0], 1);
+bench_sched_queue(&s, &f[0], 0, BENCH_SCHED_LARGE);
+for (i=1; i<=BENCH_SCHED_SMALL; i++) {
+	sched_flow_init(&f[i], 1);
+	bench_sched_queue(&s, &f[i], i, BENCH_SCHED_SEGS);
+}
+bench_sched_drain(&s, done);
+fifo = 0;
+drr = 0;
+for (i=1; i<=BENCH_SCHED_SMALL; i++) {
+	fifo += (BENCH_SCHED_LARGE + (long long) i * BENCH_SCHED_SEGS) * cost;
+	drr += done[i];
+}
+printf("sched: %d small uploads of %d segments behind one of %d\n",
+	BENCH_SCHED_SMALL, BENCH_SCHED_SEGS, BENCH_SCHED_LARGE);
+printf("sched: small ones done after %.0f segments on average, "
+	"%.0f with FIFO\n",
+	(double) drr / BENCH_SCHED_SMALL / cost,
+	(double) fifo / BENCH_SCHED_SMALL / cost);
+printf("sched: large one done after %.0f segments, %d with FIFO\n",
+	(double) done[0] / cost, BENCH_SCHED_LARGE);
+
+/* Weights 1 and 3, until the heavier one is done */
+sched_flow_init(&f[0], 1);
+sched_flow_init(&f[1], 3);
+bench_sched_queue(&s, &f[0], 0, BENCH_SCHED_LARGE);
+bench_sched_queue(&s, &f[1], 1, BENCH_SCHED_LARGE);
+sent = 0;
+while (f[1].num > 0) {
+	p = sched_remove(&s, &i);
+	sent += PKT_HDR_LEN + p->length;
+	free(p);
+}
+printf("sched: weights 1 and 3 got %.1f%% and %.1f%% of the link\n",
+	100.0 * f[0].bytes / sent, 100.0 * f[1].bytes / sent);
+sched_flow_drop(&s, &f[0]);
+
+/* Each flow keeps a few segments queued, as an upload's window */
+for (j=0; j<3; j++) {
+	n = flows[j];
+	g = (struct sched_flow *) malloc(n * sizeof(struct sched_flow));
+	for (i=0; i<n; i++) {
+		sched_flow_init(&g[i], 1 + i % 3);
+		bench_sched_queue(&s, &g[i], i, 4);
+	}
+	t0 = bench_now();
+	for (k=0; k<BENCH_SCHED_OPS; k++) {
+		p = sched_remove(&s, &i);
+		sched_add(&s, &g[i], p, i);
+	}
+	t1 = bench_now();
+	printf("sched: %3d flows %6.1f ns per segment\n",
+		n, (t1 - t0) / BENCH_SCHED_OPS * 1e9);
+	for (i=0; i<n; i++) sched_flow_drop(&s, &g[i]);
+	free(g);
+}
+}
+
+/*
+ * Microbenchmarks of the primitives.  bench367 is linked with
+ * malloc() and friends wrapped (see the makefile), so each can
+ * count the allocations it makes.  A benchmark times only its own
+ * operations, not their setup, and fills in a bench_result.
+ */
+struct bench_result {
+	double secs;
+	long ops;
+	long allocs;
+};
+
+static long g_bench_allocs = 0;
+
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t k, size_t n);
+void *__real_realloc(void *p, size_t n);
+
+void *__wrap_malloc(size_t n)
+{
+g_bench_allocs++;
+return __real_malloc(n);
+}
+
+void *__wrap_calloc(size_t k, size_t n)
+{
+g_bench_allocs++;
+return __real_calloc(k, n);
+}
+
+void *__wrap_realloc(void *p, size_t n)
+{
+g_bench_allocs++;
+return __real_realloc(p, n);
+}
+
+/* A pipe port to itself, as in bench_pipe() */
+static void bench_micro_port(struct net_port *port, int fd[2], int mtu)
+{
+pipe(fd);
+fcntl(fd[0], F_SETFL, fcntl(fd[0], F_GETFL) | O_NONBLOCK);
+fcntl(fd[1], F_SETFL, fcntl(fd[1], F_GETFL) | O_NONBLOCK);
+memset(port, 0, sizeof(struct net_port));
+port->type = PIPE;
+port->pipe_send_fd = fd[1];
+port->pipe_recv_fd = fd[0];
+port->mtu = mtu;
+}
+
+/*
+ * packet_send() or packet_recv() of packets with 'size' bytes of
+ * payload, in batches that the pipe and the tx buffer hold
+ */
+static void bench_micro_packet(int size, int recv, struct bench_result *r)
+{
+static struct packet p;
+static struct packet q;
+struct net_port port;
+int fd[2];
+double t0;
+long allocs;
+int batch, i, b;
+
+bench_micro_port(&port, fd, size > MTU_DEFAULT ? size : MTU_DEFAULT);
+p.src = 0;
+p.dst = 1;
+p.type = PKT_FILE_UPLOAD_DATA;
+p.length = size;
+memset(p.payload, 'x', size);
+batch = 32768 / (PKT_HDR_LEN + size);
+if (batch < 1) batch = 1;
+if (batch > 64) batch = 64;
+
+packet_send(&port, &p);		/* Buffers are allocated on first use */
+packet_recv(&port, &q);
+r->secs = 0;
+r->ops = 0;
+r->allocs = 0;
+for (i=0; i<BENCH_MICRO_OPS; i+=batch) {
+	t0 = bench_now();
+	allocs = g_bench_allocs;
+	if (!recv) {
+		for (b=0; b<batch; b++) packet_send(&port, &p);
+		r->secs += bench_now() - t0;
+		r->allocs += g_bench_allocs - allocs;
+	}
+	else {
+		for (b=0; b<batch; b++) packet_send(&port, &p);
+	}
+	t0 = bench_now();
+	allocs = g_bench_allocs;
+	for (b=0; b<batch; ) {
+		if (packet_recv(&port, &q) > 0) b++;
+		else packet_flush(&port);
+	}
+	if (recv) {
+		r->secs += bench_now() - t0;
+		r->allocs += g_bench_allocs - allocs;
+	}
+	r->ops += batch;
+}
+if (port.tx_drops > 0) printf("packet bench: %ld drops\n", port.tx_drops);
+close(fd[0]);
+close(fd[1]);
+free(port.rx_buf);
+free(port.tx_buf);
+}
+
+static void bench_micro_send(int size, struct bench_result *r)
+{
+bench_micro_packet(size, 0, r);
+}
+
+static void bench_micro_recv(int size, struct bench_result *r)
+{
+bench_micro_packet(size, 1, r);
+}
+
+/*
+ * A switch passing packets from one port to another: copied out
+ * with packet_recv() and encoded again by packet_send(), as it used
+ * to, or as a packet_view handed to packet_forward().  Filling the
+ * first pipe and draining the second are not timed.
+ */
+static void bench_micro_fwd(int size, int view, struct bench_result *r)
+{
+static struct packet p;
+static struct packet q;
+struct packet_view v;
+struct net_port in, out;
+int fd_in[2], fd_out[2];
+double t0;
+long allocs;
+int batch, i, b;
+
+bench_micro_port(&in, fd_in, size > MTU_DEFAULT ? size : MTU_DEFAULT);
+bench_micro_port(&out, fd_out, in.mtu);
+p.src = 0;
+p.dst = 1;
+p.type = PKT_FILE_UPLOAD_DATA;
+p.length = size;
+memset(p.payload, 'x', size);
+batch = 32768 / (PKT_HDR_LEN + size);
+if (batch < 1) batch = 1;
+if (batch > 64) batch = 64;
+
+packet_send(&out, &p);		/* Buffers are allocated on first use */
+packet_recv(&out, &q);
+r->secs = 0;
+r->ops = 0;
+r->allocs = 0;
+for (i=0; i<BENCH_MICRO_OPS; i+=batch) {
+	for (b=0; b<batch; b++) packet_send(&in, &p);
+	t0 = bench_now();
+	allocs = g_bench_allocs;
+	for (b=0; b<batch; ) {
+		if (view && packet_recv_view(&in, &v) > 0) {
+			packet_forward(&out, &v);
+			b++;
+		}
+		else if (!view && packet_recv(&in, &q) > 0) {
+			packet_send(&out, &q);
+			b++;
+		}
+		else {
+			packet_flush(&in);
+		}
+	}
+	packet_flush(&out);
+	r->secs += bench_now() - t0;
+	r->allocs += g_bench_allocs - allocs;
+	for (b=0; b<batch; ) {
+		if (packet_recv_view(&out, &v) > 0) b++;
+		else packet_flush(&out);
+	}
+	r->ops += batch;
+}
+if (out.tx_drops > 0) printf("forward bench: %ld drops\n", out.tx_drops);
+close(fd_in[0]);
+close(fd_in[1]);
+close(fd_out[0]);
+close(fd_out[1]);
+free(in.rx_buf);
+free(in.tx_buf);
+free(out.rx_buf);
+free(out.tx_buf);
+}
+
+static void bench_micro_fwd_copy(int size, struct bench_result *r)
+{
+bench_micro_fwd(size, 0, r);
+}
+
+static void bench_micro_fwd_view(int size, struct bench_result *r)
+{
+bench_micro_fwd(size, 1, r);
+}
+
+/*
+ * file_buf_add() or file_buf_remove() of 'size' bytes a call.
+ * Buffers are filled and then emptied in turn, so each phase is
+ * timed over many calls.
+ */
+static void bench_micro_file_buf(int size, int remove, struct bench_result *r)
+{
+static struct file_buf f[BENCH_MICRO_BUFS];
+static char data[MAX_FILE_BUFFER];
+double t0;
+long allocs;
+int i, k, n;
+
+memset(data, 'x', sizeof(data));
+for (k=0; k<BENCH_MICRO_BUFS; k++) file_buf_init(&f[k]);
+r->secs = 0;
+r->ops = 0;
+r->allocs = 0;
+while (r->ops < BENCH_MICRO_OPS) {
+	t0 = bench_now();
+	allocs = g_bench_allocs;
+	n = 0;
+	for (k=0; k<BENCH_MICRO_BUFS; k++) {
+		for (i=0; i + size <= MAX_FILE_BUFFER; i+=size) {
+			file_buf_add(&f[k], data, size);
+			n++;
+		}
+	}
+	if (!remove) {
+		r->secs += bench_now() - t0;
+		r->allocs += g_bench_allocs - allocs;
+	}
+	t0 = bench_now();
+	allocs = g_bench_allocs;
+	for (k=0; k<BENCH_MICRO_BUFS; k++) {
+		while (file_buf_remove(&f[k], data, size) > 0);
+	}
+	if (remove) {
+		r->secs += bench_now() - t0;
+		r->allocs += g_bench_allocs - allocs;
+	}
+	r->ops += n;
+}
+}
+
+static void bench_micro_buf_add(int size, struct bench_result *r)
+{
+bench_micro_file_buf(size, 0, r);
+}
+
+static void bench_micro_buf_remove(int size, struct bench_result *r)
+{
+bench_micro_file_buf(size, 1, r);
+}
+
+/*
+ * job_q_add() and job_q_remove() of a queue holding 'depth' jobs:
+ * each operation adds a job at the tail and removes one from the
+ * head.  With 'alloc' set the job is allocated and freed as well,
+ * as the hosts do.
+ */
+static void bench_micro_job_q(int depth, int alloc, struct bench_result *r)
+{
+struct job_queue q;
+struct host_job *jobs;
+struct host_job *j;
+double t0;
+long allocs;
+int i;
+
+jobs = (struct host_job *) malloc(depth * sizeof(struct host_job));
+job_q_init(&q);
+for (i=0; i<depth; i++) job_q_add(&q, &jobs[i]);
+
+t0 = bench_now();
+allocs = g_bench_allocs;
+for (i=0; i<BENCH_MICRO_OPS; i++) {
+	if (alloc) {
+		j = (struct host_job *) malloc(sizeof(struct host_job));
+		j->type = JOB_SEND_PKT_ALL_PORTS;
+		job_q_add(&q, j);
+		j = job_q_remove(&q);
+		if (j < jobs || j >= jobs + depth) free(j);
+	}
+	else {
+		job_q_add(&q, job_q_remove(&q));
+	}
+}
+r->secs = bench_now() - t0;
+r->allocs = g_bench_allocs - allocs;
+r->ops = BENCH_MICRO_OPS;
+while ((j = job_q_remove(&q)) != NULL) {
+	if (j < jobs || j >= jobs + depth) free(j);
+}
+free(jobs);
+}
+
+static void bench_micro_queue(int depth, struct bench_result *r)
+{
+bench_micro_job_q(depth, 0, r);
+}
+
+static void bench_micro_queue_alloc(int depth, struct bench_result *r)
+{
+bench_micro_job_q(depth, 1, r);
+}
+
+/* Run a benchmark BENCH_MICRO_RUNS times and report the fastest */
+static void bench_micro_one(FILE *csv, char *name, char *param_name,
+		int param, void (*f)(int, struct bench_result *))
+{
+struct bench_result r;
+double best = -1;
+double allocs = 0;
+double ns;
+int i;
+
+for (i=0; i<BENCH_MICRO_RUNS; i++) {
+	f(param, &r);
+	ns = r.secs * 1e9 / r.ops;
+	if (best < 0 || ns < best) {
+		best = ns;
+		allocs = (double) r.allocs / r.ops;
+	}
+}
+printf("%-22s %-6s %6d: %9.1f ns/op %13.0f ops/s %6.2f allocs/op\n",
+	name, param_name, param, best, 1e9 / best, allocs);
+if (csv != NULL) {
+	fprintf(csv, "%s,%s,%d,%.2f,%.0f,%.4f\n",
+		name, param_name, param, best, 1e9 / best, allocs);
+}
+}
+
+static void bench_micro(char *csv_name)
+{
+static int sizes[] = {0, 64, 1500, 9000};
+static int chunks[] = {1, 16, 100, 1000};
+static int depths[] = {1, 16, 256, 4096};
+FILE *csv = NULL;
+int i;
+
+if (csv_name != NULL) {
+	csv = fopen(csv_name, "w");
+	if (csv == NULL) perror(csv_name);
+	else fprintf(csv, "benchmark,param,value,ns_per_op,ops_per_sec,"
+		"allocs_per_op\n");
+}
+for (i=0; i<4; i++) {
+	bench_micro_one(csv, "packet_send", "bytes", sizes[i],
+		bench_micro_send);
+}
+for (i=0; i<4; i++) {
+	bench_micro_one(csv, "packet_recv", "bytes", sizes[i],
+		bench_micro_recv);
+}
+for (i=0; i<4; i++) {
+	bench_micro_one(csv, "forward_copy", "bytes", sizes[i],
+		bench_micro_fwd_copy);
+}
+for (i=0; i<4; i++) {
+	bench_micro_one(csv, "forward_view", "bytes", sizes[i],
+		bench_micro_fwd_view);
+}
+for (i=0; i<4; i++) {
+	bench_micro_one(csv, "file_buf_add", "bytes", chunks[i],
+		bench_micro_buf_add);
+}
+for (i=0; i<4; i++) {
+	bench_micro_one(csv, "file_buf_remove", "bytes", chunks[i],
+		bench_micro_buf_remove);
+}
+for (i=0; i<4; i++) {
+	bench_micro_one(csv, "job_q_add+remove", "depth", depths[i],
+		bench_micro_queue);
+}
+for (i=0; i<4; i++) {
+	bench_micro_one(csv, "job_q_add+remove+alloc", "depth", depths[i],
+		bench_micro_queue_alloc);
+}
+if (csv != NULL) fclose(csv);
+}
+
+int main(int argc, char *argv[])
+{
+static int sizes[] = {64, 128, 1500, 65536};
+static int mtus[] = {100, MTU_DEFAULT, 9000, MTU_MAX};
+struct uring *ring;
+char *buf;
+char *buf2;
+int i, n;
+
+if (argc > 1 && strcmp(argv[1], "sim") == 0) {
+	bench_sim(argc > 2 ? atoi(argv[2]) : BENCH_SIM_SIDE);
+	return 0;
+}
+if (argc > 1 && strcmp(argv[1], "fork") == 0) {
+	bench_fork(argc > 2 ? atoi(argv[2]) : BENCH_FORK_NODES);
+	return 0;
+}
+if (argc > 1 && strcmp(argv[1], "capture") == 0) {
+	bench_capture(mtus, 4);
+	return 0;
+}
+if (argc > 1 && strcmp(argv[1], "delta") == 0) {
+	bench_delta();
+	return 0;
+}
+if (argc > 1 && strcmp(argv[1], "sched") == 0) {
+	bench_sched();
+	return 0;
+}
+if (argc > 1 && strcmp(argv[1], "dircache") == 0) {
+	bench_dircache();
+	return 0;
+}
+if (argc > 1 && strcmp(argv[1], "micro") == 0) {
+	bench_micro(argc > 2 ? argv[2] : NULL);
+	return 0;
+}
+if (argc > 1 && strcmp(argv[1], "config") == 0) {
+	bench_config(argc > 2 ? atoi(argv[2]) : BENCH_CONFIG_LINKS);
+	return 0;
+}
+
+buf = (char *) malloc(65536);
+for (i=0; i<65536; i++) buf[i] = (char) (i * 131 + 7);
+
+printf("crc32c hardware path %s\n",
+	crc32c_hw_available() ? "available" : "not available");
+for (i=0; i<4; i++) {
+	bench_crc("sw", crc32c_sw, buf, sizes[i]);
+	if (crc32c_hw_available()) {
+		bench_crc("hw", crc32c_hw, buf, sizes[i]);
+	}
+}
+
+ring = uring_create();
+for (i=0; i<4; i++) {
+	bench_pipe(mtus[i], 0, NULL, 1);
+	bench_pipe(mtus[i], 1, NULL, 1);
+}
+for (i=0; i<3; i++) {
+	bench_pipe(mtus[i], 0, NULL, 8);
+	if (ring != NULL) bench_pipe(mtus[i], 0, ring, 1);
+	if (ring != NULL) bench_pipe(mtus[i], 0, ring, 8);
+}
+
+/* Generated log text, and random bytes that do not compress */
+buf2 = (char *) malloc(BENCH_LZ_BYTES);
+for (i=0, n=0; n < BENCH_LZ_BYTES - 100; i++) {
+	n += sprintf(buf2+n, "2017-02-24 10:%02d:%02d host %d: "
+		"upload %s chunk %d ok\n", (i/60)%60, i%60, i%7,
+		i%3 ? "testmsg0" : "testmsg1B", i);
+}
+bench_lz("log", buf2, n);
+srand(1);
+for (i=0; i<BENCH_LZ_BYTES; i++) buf2[i] = (char) rand();
+bench_lz("random", buf2, BENCH_LZ_BYTES);
+free(buf2);
+bench_lz_file("TestDir0/testmsg00");
+bench_lz_file("TestDir1/testmsg1B");
+bench_lz_file("host.c");
+
+free(buf);
+return 0;
+}
@@ -0,0 +1,236 @@
+/*
+ * capture.c
+ *
+ * Packet capture to pcap files; see capture.h.  A port's records
+ * go through a memq: the port's node is the one writer and the
+ * capture thread the one reader.  The thread drains every queue
+ * into its file and flushes the file, since a node run as a
+ * process is killed rather than left to exit.  It sleeps while
+ * the queues are empty, and a port that fills half its queue
+ * wakes it early.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "main.h"
+#include "capture.h"
+#include "memq.h"
+#include "timer.h"
+
+#define CAPTURE_NAME_MAX 256
+#define CAPTURE_QUEUE (256 * 1024)	/* Bytes of records per port */
+#define CAPTURE_IDLE_US 5000	/* Sleep of the thread when idle */
+#define CAPTURE_REPORT_US 1000000	/* Drops reported at most this often */
+
+#define PCAP_MAGIC 0xa1b2c3d4	/* Microsecond timestamps */
+#define PCAP_LINKTYPE_USER0 147
+#define CAPTURE_PSEUDO_LEN 4	/* Direction, then 3 bytes of padding */
+
+struct pcap_file_hdr {
+	unsigned int magic;
+	unsigned short version_major;
+	unsigned short version_minor;
+	int thiszone;
+	unsigned int sigfigs;
+	unsigned int snaplen;
+	unsigned int linktype;
+};
+
+struct pcap_rec_hdr {
+	unsigned int ts_sec;
+	unsigned int ts_usec;
+	unsigned int incl_len;
+	unsigned int orig_len;
+};
+
+struct capture {
+	char name[CAPTURE_NAME_MAX];
+	FILE *fp;
+	struct memq *q;
+	int wait;		/* Wait for room instead of dropping */
+	long long epoch_us;	/* Wall clock less timer_now_us(), at open */
+	_Atomic int kicked;	/* Has woken the thread since its pass */
+	_Atomic long drops;	/* Records that did not fit */
+	long drops_reported;
+	struct capture *next;
+};
+
+static char *g_capture_dir = NULL;
+static int g_capture_snap;
+
+static pthread_mutex_t g_capture_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct capture *g_capture_list = NULL;
+static int g_capture_started = 0;
+static pthread_cond_t g_capture_wake = PTHREAD_COND_INITIALIZER;
+
+void capture_enable(char dir[], int snap)
+{
+g_capture_dir = dir;
+g_capture_snap = snap;
+}
+
+/* Write what the queue holds to the file; returns how many bytes */
+static int capture_drain(struct capture *c, char *buf, int size)
+{
+int total = 0;
+int n;
+
+c->kicked = 0;
+while ((n = memq_read(c->q, buf, size)) > 0) {
+	fwrite(buf, 1, n, c->fp);
+	total += n;
+}
+if (total > 0) fflush(c->fp);
+return total;
+}
+
+/* Report the records dropped since the last report */
+static void capture_report()
+{
+struct capture *c;
+long drops;
+
+for (c = g_capture_list; c != NULL; c = c->next) {
+	drops = c->drops;
+	if (drops == c->drops_reported) continue;
+	fprintf(stderr, "capture %s: %ld records dropped\n", c->name, drops);
+	c->drops_reported = drops;
+}
+}
+
+/* Write out what is still queued when the process exits */
+static void capture_flush()
+{
+struct capture *c;
+char *buf;
+
+buf = (char *) malloc(CAPTURE_QUEUE);
+pthread_mutex_lock(&g_capture_lock);
+for (c = g_capture_list; c != NULL; c = c->next) {
+	capture_drain(c, buf, CAPTURE_QUEUE);
+}
+capture_report();
+pthread_mutex_unlock(&g_capture_lock);
+free(buf);
+}
+
+static void *capture_thread(void *arg)
+{
+struct capture *c;
+struct timespec ts;
+char *buf;
+long long last_report = 0;
+long long now;
+int busy;
+
+buf = (char *) malloc(CAPTURE_QUEUE);
+while (1) {
+	busy = 0;
+	pthread_mutex_lock(&g_capture_lock);
+	for (c = g_capture_list; c != NULL; c = c->next) {
+		if (capture_drain(c, buf, CAPTURE_QUEUE) > 0) busy = 1;
+	}
+	now = timer_now_us();
+	if (now - last_report >= CAPTURE_REPORT_US) {
+		last_report = now;
+		capture_report();
+	}
+	if (!busy) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += CAPTURE_IDLE_US * 1000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&g_capture_wake, &g_capture_lock, &ts);
+	}
+	pthread_mutex_unlock(&g_capture_lock);
+}
+return NULL;
+}
+
+struct capture *capture_open(struct net_port *port)
+{
+struct capture *c;
+struct pcap_file_hdr h;
+struct timespec ts;
+pthread_t thread;
+int peer;
+
+if (g_capture_dir == NULL) return NULL;
+
+c = (struct capture *) calloc(1, sizeof(struct capture));
+peer = port->peer != NULL ? port->peer->pipe_host_id : port->pipe_peer_id;
+snprintf(c->name, CAPTURE_NAME_MAX, "%s/%d-%d.pcap",
+	g_capture_dir, port->pipe_host_id, peer);
+c->fp = fopen(c->name, "w");
+if (c->fp == NULL) {
+	perror(c->name);
+	free(c);
+	return NULL;
+}
+h.magic = PCAP_MAGIC;
+h.version_major = 2;
+h.version_minor = 4;
+h.thiszone = 0;
+h.sigfigs = 0;
+h.snaplen = CAPTURE_PSEUDO_LEN + g_capture_snap;
+h.linktype = PCAP_LINKTYPE_USER0;
+fwrite(&h, sizeof(h), 1, c->fp);
+fflush(c->fp);
+c->q = memq_create(CAPTURE_QUEUE);
+/* Simulated time stands still while a node waits */
+c->wait = port->type == SIM;
+/* Records are stamped in epoch time, as pcap tools expect */
+clock_gettime(CLOCK_REALTIME, &ts);
+c->epoch_us = (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000
+	- timer_now_us();
+
+pthread_mutex_lock(&g_capture_lock);
+c->next = g_capture_list;
+g_capture_list = c;
+if (!g_capture_started) {
+	g_capture_started = 1;
+	atexit(capture_flush);
+	pthread_create(&thread, NULL, capture_thread, NULL);
+	pthread_detach(thread);
+}
+pthread_mutex_unlock(&g_capture_lock);
+return c;
+}
+
+void capture_frame(struct capture *c, char *frame, int n, int dir)
+{
+struct pcap_rec_hdr r;
+char pseudo[CAPTURE_PSEUDO_LEN];
+long long t;
+int incl;
+
+incl = n < g_capture_snap ? n : g_capture_snap;
+while (memq_room(c->q) < (int) sizeof(r) + CAPTURE_PSEUDO_LEN + incl) {
+	if (!c->wait) {
+		c->drops++;
+		return;
+	}
+	sched_yield();
+}
+t = timer_now_us() + c->epoch_us;
+r.ts_sec = (unsigned int) (t / 1000000);
+r.ts_usec = (unsigned int) (t % 1000000);
+r.incl_len = CAPTURE_PSEUDO_LEN + incl;
+r.orig_len = CAPTURE_PSEUDO_LEN + n;
+memset(pseudo, 0, sizeof(pseudo));
+pseudo[0] = (char) dir;
+memq_write(c->q, (char *) &r, sizeof(r));
+memq_write(c->q, pseudo, sizeof(pseudo));
+memq_write(c->q, frame, incl);
+if (memq_room(c->q) < CAPTURE_QUEUE / 2 && !c->kicked) {
+	c->kicked = 1;
+	pthread_cond_signal(&g_capture_wake);
+}
+}
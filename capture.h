@@ -0,0 +1,37 @@
+/*
+ * capture.h
+ *
+ * Packet capture (net367 -w dir).  Each port writes the frames it
+ * sends and receives to its own pcap file, dir/N-M.pcap for the
+ * port of node N on its link to node M, which tcpdump, tshark and
+ * the like can read.
+ *
+ * The link-layer type is LINKTYPE_USER0 (147).  Each packet is a
+ * 4-byte pseudo-header, whose first byte is CAPTURE_OUT for a sent
+ * frame or CAPTURE_IN for a received one, then the frame as it
+ * goes on the link (see packet.c), cut at the snap length but with
+ * its whole length recorded.  Timestamps are the nodes' clock
+ * (timer.h), so simulated time under -s, moved to epoch time by an
+ * offset taken when the port is opened.  A sent frame is captured
+ * when it is handed to the link, before any link emulation.
+ *
+ * Capture stays off the fast path: a port copies each record into
+ * a queue in memory (memq.h), and a thread of the process writes
+ * the queues to the files.  A record that does not fit is counted
+ * and dropped rather than waited for.
+ */
+
+#define CAPTURE_OUT 0
+#define CAPTURE_IN 1
+#define CAPTURE_SNAP_DEFAULT 128	/* Headers and some payload */
+
+struct capture;
+
+/* Capture every port to files in 'dir', 'snap' bytes of each frame */
+void capture_enable(char dir[], int snap);
+
+/* Start capturing the port, if capture is on; NULL if not */
+struct capture *capture_open(struct net_port *port);
+
+/* Record frame[] of n bytes, sent or received (CAPTURE_OUT, _IN) */
+void capture_frame(struct capture *c, char *frame, int n, int dir);
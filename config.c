@@ -0,0 +1,435 @@
+/*
+ * config.c
+ *
+ * Loading and saving network configuration files.
+ *
+ * The file is memory-mapped.  Text is parsed in place by the
+ * functions below, which step through it a character at a time,
+ * rather than by fscanf(); a link line with no options costs a few
+ * dozen instructions.  A binary file is checked and its records
+ * copied out.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "main.h"
+#include "emu.h"
+#include "packet.h"
+#include "config.h"
+
+/*
+ * Binary format, in the byte order of the machine that wrote it:
+ * a header, a byte per node with its type ('H' or 'S'), padded to
+ * a multiple of 8 bytes, then a record per link.
+ */
+#define CONFIG_MAGIC "net367tp"
+#define CONFIG_VERSION 1
+#define CONFIG_LINK_CRC 0x01
+
+struct config_bin_header {
+	char magic[8];
+	uint32_t version;	/* Also tells the byte order */
+	uint32_t node_num;
+	uint32_t link_num;
+	uint32_t link_size;	/* sizeof(struct config_bin_link) */
+};
+
+struct config_bin_link {
+	uint32_t node0;
+	uint32_t node1;
+	uint32_t mtu;
+	uint32_t flags;
+	int64_t bandwidth;
+	int64_t delay_us;
+	int64_t jitter_us;
+	double loss;
+	double reorder;
+	int32_t burst;
+	uint32_t queue;		/* 0 for the default */
+};
+
+#define CONFIG_PAD8(n) (((n) + 7) & ~7)
+
+/* Where the text parser is */
+struct config_text {
+	char *p;
+	char *end;
+	int line;
+};
+
+/* Skip blanks and newlines */
+static void config_skip(struct config_text *t)
+{
+while (t->p < t->end && (*t->p == ' ' || *t->p == '\t' || *t->p == '\r'
+		|| *t->p == '\n')) {
+	if (*t->p == '\n') t->line++;
+	t->p++;
+}
+}
+
+static int config_int(struct config_text *t, int *v)
+{
+int neg = 0;
+long n = 0;
+
+config_skip(t);
+if (t->p < t->end && *t->p == '-') {
+	neg = 1;
+	t->p++;
+}
+if (t->p >= t->end || *t->p < '0' || *t->p > '9') return 0;
+while (t->p < t->end && *t->p >= '0' && *t->p <= '9') {
+	n = n * 10 + (*t->p++ - '0');
+	if (n > 0x7fffffff) return 0;
+}
+*v = neg ? (int) -n : (int) n;
+return 1;
+}
+
+static int config_char(struct config_text *t, char *c)
+{
+config_skip(t);
+if (t->p >= t->end) return 0;
+*c = *t->p++;
+return 1;
+}
+
+/*
+ * The options on the rest of the line, e.g. "crc mtu=9000"; returns
+ * 0 if any is unknown or bad, which rejects the file
+ */
+static int config_options(struct config_text *t, struct net_link *l)
+{
+char options[STRING_MAX];
+char *opt;
+int n, k;
+
+while (t->p < t->end && (*t->p == ' ' || *t->p == '\t' || *t->p == '\r')) {
+	t->p++;
+}
+for (n=0; t->p + n < t->end && t->p[n] != '\n'; n++);
+if (n == 0) return 1;		/* Most links have none */
+if (n >= STRING_MAX) {
+	printf("config.c: line %d: Options too long\n", t->line);
+	return 0;
+}
+memcpy(options, t->p, n);
+options[n] = '\0';
+t->p += n;
+
+for (opt = strtok(options, " \t\r"); opt != NULL;
+		opt = strtok(NULL, " \t\r")) {
+	if (strcmp(opt, "crc") == 0) {
+		l->crc = 1;
+	}
+	else if (sscanf(opt, "mtu=%d", &l->mtu) == 1) {
+		if (l->mtu < MTU_MIN || l->mtu > MTU_MAX) {
+			printf("config.c: line %d: MTU %d is not "
+				"within %d-%d\n",
+				t->line, l->mtu, MTU_MIN, MTU_MAX);
+			return 0;
+		}
+	}
+	else if ((k = emu_parse_option(&l->emu, opt)) != 0) {
+		if (k < 0) {
+			printf("config.c: line %d: Bad link option %s\n",
+				t->line, opt);
+			return 0;
+		}
+	}
+	else {
+		printf("config.c: line %d: Unknown link option %s\n",
+			t->line, opt);
+		return 0;
+	}
+}
+return 1;
+}
+
+/* Two frames, the default token bucket depth */
+static int config_default_burst(struct net_link *l)
+{
+return 2 * (PKT_HDR_LEN + l->mtu + PKT_CRC_LEN);
+}
+
+static int config_parse_text(char *data, long size, struct net_config *c)
+{
+struct config_text t;
+struct net_link *l;
+char type;
+int i, id;
+
+t.p = data;
+t.end = data + size;
+t.line = 1;
+
+if (!config_int(&t, &c->node_num) || c->node_num < 1) {
+	printf("config.c: No nodes\n");
+	return 0;
+}
+c->node = (struct net_node *) malloc(c->node_num * sizeof(struct net_node));
+for (i=0; i<c->node_num; i++) {
+	if (!config_char(&t, &type) || !config_int(&t, &id)) {
+		printf("config.c: line %d: Expected a node\n", t.line);
+		return 0;
+	}
+	if (type == 'H') c->node[i].type = HOST;
+	else if (type == 'S') c->node[i].type = SWITCH;
+	else {
+		printf("config.c: line %d: Unidentified node type %c\n",
+			t.line, type);
+		return 0;
+	}
+	if (id != i) {
+		printf("config.c: line %d: Incorrect node id\n", t.line);
+		return 0;
+	}
+	c->node[i].id = id;
+	c->node[i].next = NULL;
+}
+
+if (!config_int(&t, &c->link_num) || c->link_num < 1) {
+	printf("config.c: No links\n");
+	return 0;
+}
+c->link = (struct net_link *) malloc(c->link_num * sizeof(struct net_link));
+for (i=0; i<c->link_num; i++) {
+	l = &c->link[i];
+	if (!config_char(&t, &type)) {
+		printf("config.c: line %d: Expected a link\n", t.line);
+		return 0;
+	}
+	if (type != 'P') {
+		printf("config.c: line %d: Unidentified link type %c\n",
+			t.line, type);
+		return 0;
+	}
+	l->type = PIPE;
+	if (!config_int(&t, &l->pipe_node0)
+		|| !config_int(&t, &l->pipe_node1)
+		|| l->pipe_node0 < 0 || l->pipe_node0 >= c->node_num
+		|| l->pipe_node1 < 0 || l->pipe_node1 >= c->node_num) {
+		printf("config.c: line %d: Bad node ids\n", t.line);
+		return 0;
+	}
+	l->crc = 0;
+	l->mtu = MTU_DEFAULT;
+	emu_init(&l->emu, 0);
+	if (!config_options(&t, l)) return 0;
+	if (l->emu.burst == 0) l->emu.burst = config_default_burst(l);
+}
+return 1;
+}
+
+static int config_parse_binary(char *data, long size, struct net_config *c)
+{
+struct config_bin_header *h;
+struct config_bin_link *b;
+struct net_link *l;
+char *types;
+long need;
+int i;
+
+h = (struct config_bin_header *) data;
+if (size < (long) sizeof(*h) || h->version != CONFIG_VERSION
+	|| h->link_size != sizeof(struct config_bin_link)) {
+	printf("config.c: Binary file of another version or byte order\n");
+	return 0;
+}
+need = sizeof(*h) + CONFIG_PAD8((long) h->node_num)
+	+ (long) h->link_num * sizeof(struct config_bin_link);
+if (size < need || h->node_num < 1 || h->link_num < 1
+	|| h->node_num > 0x7fffffff || h->link_num > 0x7fffffff) {
+	printf("config.c: Binary file is cut short or bad\n");
+	return 0;
+}
+
+c->node_num = h->node_num;
+c->link_num = h->link_num;
+types = data + sizeof(*h);
+b = (struct config_bin_link *) (types + CONFIG_PAD8((long) c->node_num));
+c->node = (struct net_node *) malloc(c->node_num * sizeof(struct net_node));
+c->link = (struct net_link *) malloc(c->link_num * sizeof(struct net_link));
+for (i=0; i<c->node_num; i++) {
+	if (types[i] != 'H' && types[i] != 'S') {
+		printf("config.c: Unidentified type of node %d\n", i);
+		return 0;
+	}
+	c->node[i].type = types[i] == 'H' ? HOST : SWITCH;
+	c->node[i].id = i;
+	c->node[i].next = NULL;
+}
+for (i=0; i<c->link_num; i++, b++) {
+	l = &c->link[i];
+	if (b->node0 >= (uint32_t) c->node_num
+		|| b->node1 >= (uint32_t) c->node_num
+		|| b->mtu < MTU_MIN || b->mtu > MTU_MAX) {
+		printf("config.c: Bad link %d\n", i);
+		return 0;
+	}
+	l->type = PIPE;
+	l->pipe_node0 = b->node0;
+	l->pipe_node1 = b->node1;
+	l->mtu = b->mtu;
+	l->crc = (b->flags & CONFIG_LINK_CRC) != 0;
+	emu_init(&l->emu, 0);
+	l->emu.bandwidth = b->bandwidth;
+	l->emu.burst = b->burst;
+	if (b->queue != 0) l->emu.queue = b->queue;
+	l->emu.delay_us = b->delay_us;
+	l->emu.jitter_us = b->jitter_us;
+	l->emu.loss = b->loss;
+	l->emu.reorder = b->reorder;
+	if (l->emu.burst == 0) l->emu.burst = config_default_burst(l);
+	if (!emu_valid(&l->emu)) {
+		printf("config.c: Bad link options of link %d\n", i);
+		return 0;
+	}
+}
+c->binary = 1;
+return 1;
+}
+
+int config_load(char fname[], struct net_config *c)
+{
+struct stat st;
+char *data;
+int fd;
+int ok;
+
+memset(c, 0, sizeof(struct net_config));
+fd = open(fname, O_RDONLY);
+if (fd < 0 || fstat(fd, &st) < 0) {
+	printf("config.c: File did not open\n");
+	if (fd >= 0) close(fd);
+	return 0;
+}
+if (st.st_size == 0) {
+	printf("config.c: No nodes\n");
+	close(fd);
+	return 0;
+}
+data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+close(fd);
+if (data == MAP_FAILED) {
+	printf("config.c: File did not map\n");
+	return 0;
+}
+if (st.st_size >= 8 && memcmp(data, CONFIG_MAGIC, 8) == 0) {
+	ok = config_parse_binary(data, st.st_size, c);
+}
+else {
+	ok = config_parse_text(data, st.st_size, c);
+}
+munmap(data, st.st_size);
+if (!ok) config_free(c);
+return ok;
+}
+
+int config_save_text(char fname[], struct net_config *c)
+{
+struct net_link *l;
+FILE *fp;
+int i;
+
+fp = fopen(fname, "w");
+if (fp == NULL) return 0;
+fprintf(fp, "%d\n", c->node_num);
+for (i=0; i<c->node_num; i++) {
+	fprintf(fp, "%c %d\n", c->node[i].type == HOST ? 'H' : 'S', i);
+}
+fprintf(fp, "%d\n", c->link_num);
+for (i=0; i<c->link_num; i++) {
+	l = &c->link[i];
+	fprintf(fp, "P %d %d", l->pipe_node0, l->pipe_node1);
+	if (l->crc) fprintf(fp, " crc");
+	if (l->mtu != MTU_DEFAULT) fprintf(fp, " mtu=%d", l->mtu);
+	if (l->emu.bandwidth > 0) fprintf(fp, " bw=%lld", l->emu.bandwidth);
+	if (l->emu.burst != config_default_burst(l)) {
+		fprintf(fp, " burst=%d", l->emu.burst);
+	}
+	if (l->emu.queue != EMU_QUEUE_DEFAULT) {
+		fprintf(fp, " queue=%d", l->emu.queue);
+	}
+	if (l->emu.delay_us > 0) fprintf(fp, " delay=%lldus", l->emu.delay_us);
+	if (l->emu.jitter_us > 0) {
+		fprintf(fp, " jitter=%lldus", l->emu.jitter_us);
+	}
+	if (l->emu.loss > 0) fprintf(fp, " loss=%.15g", l->emu.loss);
+	if (l->emu.reorder > 0) fprintf(fp, " reorder=%.15g", l->emu.reorder);
+	fprintf(fp, "\n");
+}
+return fclose(fp) == 0;
+}
+
+int config_save_binary(char fname[], struct net_config *c)
+{
+struct config_bin_header h;
+struct config_bin_link b;
+struct net_link *l;
+char zero[8] = {0};
+FILE *fp;
+char type;
+int i;
+
+fp = fopen(fname, "w");
+if (fp == NULL) return 0;
+memset(&h, 0, sizeof(h));
+memcpy(h.magic, CONFIG_MAGIC, 8);
+h.version = CONFIG_VERSION;
+h.node_num = c->node_num;
+h.link_num = c->link_num;
+h.link_size = sizeof(struct config_bin_link);
+fwrite(&h, sizeof(h), 1, fp);
+for (i=0; i<c->node_num; i++) {
+	type = c->node[i].type == HOST ? 'H' : 'S';
+	fputc(type, fp);
+}
+fwrite(zero, 1, CONFIG_PAD8(c->node_num) - c->node_num, fp);
+for (i=0; i<c->link_num; i++) {
+	l = &c->link[i];
+	memset(&b, 0, sizeof(b));
+	b.node0 = l->pipe_node0;
+	b.node1 = l->pipe_node1;
+	b.mtu = l->mtu;
+	b.flags = l->crc ? CONFIG_LINK_CRC : 0;
+	b.bandwidth = l->emu.bandwidth;
+	b.burst = l->emu.burst;
+	b.queue = l->emu.queue;
+	b.delay_us = l->emu.delay_us;
+	b.jitter_us = l->emu.jitter_us;
+	b.loss = l->emu.loss;
+	b.reorder = l->emu.reorder;
+	fwrite(&b, sizeof(b), 1, fp);
+}
+return fclose(fp) == 0;
+}
+
+int config_convert(char in[], char out[])
+{
+struct net_config c;
+int ok;
+
+if (!config_load(in, &c)) return 0;
+if (c.binary) ok = config_save_text(out, &c);
+else ok = config_save_binary(out, &c);
+printf("%s: %d nodes, %d links, written to %s as %s\n", in,
+	c.node_num, c.link_num, out, c.binary ? "text" : "binary");
+config_free(&c);
+return ok;
+}
+
+void config_free(struct net_config *c)
+{
+free(c->node);
+free(c->link);
+c->node = NULL;
+c->link = NULL;
+}
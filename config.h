@@ -0,0 +1,54 @@
+/*
+ * config.h
+ *
+ * Network configuration files.  Needs main.h and emu.h.
+ *
+ * The text format is the one written by hand:
+ *
+ *    2            number of nodes
+ *    H 0          one line per node: H for a host, S for a switch,
+ *    H 1             and ids 0, 1, 2, ... in order
+ *    1            number of links
+ *    P 0 1 crc    one line per link: P for a pipe, the two node
+ *                    ids, and options (see config.c and emu.h)
+ *
+ * The binary format holds the same in fixed-size records, so a file
+ * can be memory-mapped and used without parsing.  net367 -c converts
+ * a file of either format to the other.
+ */
+
+/*
+ * Struct used to store a link. It is used when the
+ * network configuration file is loaded.
+ */
+struct net_link {
+	enum NetLinkType type;
+	int pipe_node0;
+	int pipe_node1;
+	int crc;	/* Frames carry a CRC32C trailer */
+	int mtu;	/* Largest payload in one frame */
+	struct link_emu emu;	/* Bandwidth, delay, loss, ... */
+};
+
+struct net_config {
+	int node_num;
+	struct net_node *node;	/* node[i] has id i */
+	int link_num;
+	struct net_link *link;
+	int binary;	/* Loaded from the binary format */
+};
+
+/*
+ * Load file 'fname', in either format, into c.  Returns 1, or
+ * prints what is wrong and returns 0.
+ */
+int config_load(char fname[], struct net_config *c);
+
+/* Write c to file 'fname' in the text or binary format; 1 if done */
+int config_save_text(char fname[], struct net_config *c);
+int config_save_binary(char fname[], struct net_config *c);
+
+/* Convert file 'in' to the other format in file 'out' */
+int config_convert(char in[], char out[]);
+
+void config_free(struct net_config *c);
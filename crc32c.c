@@ -0,0 +1,166 @@
+/*
+ * crc32c.c
+ *
+ * CRC32C (polynomial 0x82F63B78, reflected) with a hardware path
+ * using the SSE4.2 crc32 instruction and a portable slicing-by-8
+ * fallback.  The choice is made once, on the first call.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_X86
+#endif
+
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82F63B78
+
+static uint32_t crc_table[8][256];
+static int crc_table_ready = 0;
+
+/*
+ * 0 = not decided yet, 1 = slicing-by-8, 2 = SSE4.2.
+ * Both implementations give the same result, so it is safe for
+ * several threads to race on this.
+ */
+static int crc_impl = 0;
+
+static void crc32c_init_table()
+{
+uint32_t c;
+int i, j;
+
+for (i=0; i<256; i++) {
+	c = i;
+	for (j=0; j<8; j++) {
+		c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+	}
+	crc_table[0][i] = c;
+}
+for (i=0; i<256; i++) {
+	c = crc_table[0][i];
+	for (j=1; j<8; j++) {
+		c = crc_table[0][c & 0xff] ^ (c >> 8);
+		crc_table[j][i] = c;
+	}
+}
+crc_table_ready = 1;
+}
+
+/* Slicing-by-8: eight table lookups per 8 bytes of input */
+unsigned int crc32c_sw(unsigned int crc, const void *buf, int length)
+{
+const unsigned char *p = buf;
+uint32_t c = ~crc;
+uint32_t lo, hi;
+
+if (!crc_table_ready) crc32c_init_table();
+
+/* Bytes up to an 8-byte boundary */
+while (length > 0 && ((uintptr_t) p & 7) != 0) {
+	c = crc_table[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+	length--;
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+while (length >= 8) {
+	memcpy(&lo, p, 4);
+	memcpy(&hi, p+4, 4);
+	lo ^= c;
+	c = crc_table[7][lo & 0xff]
+		^ crc_table[6][(lo >> 8) & 0xff]
+		^ crc_table[5][(lo >> 16) & 0xff]
+		^ crc_table[4][lo >> 24]
+		^ crc_table[3][hi & 0xff]
+		^ crc_table[2][(hi >> 8) & 0xff]
+		^ crc_table[1][(hi >> 16) & 0xff]
+		^ crc_table[0][hi >> 24];
+	p += 8;
+	length -= 8;
+}
+#endif
+
+while (length > 0) {
+	c = crc_table[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+	length--;
+}
+return ~c;
+}
+
+#ifdef CRC32C_X86
+
+__attribute__((target("sse4.2")))
+unsigned int crc32c_hw(unsigned int crc, const void *buf, int length)
+{
+const unsigned char *p = buf;
+uint32_t c = ~crc;
+#ifdef __x86_64__
+uint64_t c64;
+uint64_t v;
+#else
+uint32_t v;
+#endif
+
+while (length > 0 && ((uintptr_t) p & 7) != 0) {
+	c = _mm_crc32_u8(c, *p++);
+	length--;
+}
+
+#ifdef __x86_64__
+c64 = c;
+while (length >= 8) {
+	memcpy(&v, p, 8);
+	c64 = _mm_crc32_u64(c64, v);
+	p += 8;
+	length -= 8;
+}
+c = (uint32_t) c64;
+#else
+while (length >= 4) {
+	memcpy(&v, p, 4);
+	c = _mm_crc32_u32(c, v);
+	p += 4;
+	length -= 4;
+}
+#endif
+
+while (length > 0) {
+	c = _mm_crc32_u8(c, *p++);
+	length--;
+}
+return ~c;
+}
+
+int crc32c_hw_available()
+{
+__builtin_cpu_init();
+return __builtin_cpu_supports("sse4.2");
+}
+
+#else
+
+unsigned int crc32c_hw(unsigned int crc, const void *buf, int length)
+{
+return crc32c_sw(crc, buf, length);
+}
+
+int crc32c_hw_available()
+{
+return 0;
+}
+
+#endif
+
+unsigned int crc32c(unsigned int crc, const void *buf, int length)
+{
+if (crc_impl == 0) {
+	crc_impl = crc32c_hw_available() ? 2 : 1;
+}
+if (crc_impl == 2) {
+	return crc32c_hw(crc, buf, length);
+}
+return crc32c_sw(crc, buf, length);
+}
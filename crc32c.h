@@ -0,0 +1,20 @@
+/*
+ * crc32c.h
+ *
+ * CRC32C (Castagnoli) checksum used for the frame trailer.
+ * crc32c() uses the SSE4.2 crc32 instruction when the CPU has it,
+ * and a slicing-by-8 table lookup otherwise.
+ */
+
+/*
+ * Checksum 'length' bytes at buf.  Pass 0 as crc to start,
+ * or a previous result to continue a checksum.
+ */
+unsigned int crc32c(unsigned int crc, const void *buf, int length);
+
+/* The two implementations, for testing and benchmarking */
+unsigned int crc32c_sw(unsigned int crc, const void *buf, int length);
+unsigned int crc32c_hw(unsigned int crc, const void *buf, int length);
+
+/* Returns 1 if crc32c() is using the hardware instruction */
+int crc32c_hw_available();
@@ -0,0 +1,508 @@
+/*
+ * delta.c
+ *
+ * Delta transfer; see delta.h.  The weak checksum is rsync's:
+ * with x[0..B-1] the bytes of a block, a = sum x[i] and
+ * b = sum (B-i) x[i], both mod 2^16, so that sliding the window a
+ * byte along updates them in a few operations.  The strong hash is
+ * a CRC32C and an FNV-1a of the block side by side, 64 bits.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "main.h"
+#include "lz.h"
+#include "crc32c.h"
+#include "delta.h"
+
+#define DELTA_LIT_MAX (LZ_CHUNK - 3)	/* An 'L' op fits in a chunk */
+#define DELTA_RUN_MAX 65535		/* Blocks in a 'C' op */
+#define DELTA_READ 65536		/* Bytes of the file read at a time */
+
+static void put32(char *b, unsigned int v)
+{
+b[0] = (char) (v >> 24);
+b[1] = (char) (v >> 16);
+b[2] = (char) (v >> 8);
+b[3] = (char) v;
+}
+
+static unsigned int get32(char *b)
+{
+return ((unsigned int) (unsigned char) b[0] << 24)
+	| ((unsigned int) (unsigned char) b[1] << 16)
+	| ((unsigned int) (unsigned char) b[2] << 8)
+	| (unsigned int) (unsigned char) b[3];
+}
+
+static void put16(char *b, unsigned int v)
+{
+b[0] = (char) (v >> 8);
+b[1] = (char) v;
+}
+
+static unsigned int get16(char *b)
+{
+return ((unsigned int) (unsigned char) b[0] << 8)
+	| (unsigned int) (unsigned char) b[1];
+}
+
+static void delta_weak(char *p, int n, unsigned int *a, unsigned int *b)
+{
+unsigned int s = 0, t = 0;
+int i;
+
+for (i=0; i<n; i++) {
+	s += (unsigned char) p[i];
+	t += (unsigned int) (n - i) * (unsigned char) p[i];
+}
+*a = s;
+*b = t;
+}
+
+#define WEAK(a, b) (((a) & 0xffff) | ((b) << 16))
+
+static unsigned long long delta_strong(char *p, int n)
+{
+unsigned int h = 2166136261u;
+int i;
+
+for (i=0; i<n; i++) {
+	h ^= (unsigned char) p[i];
+	h *= 16777619u;
+}
+return ((unsigned long long) crc32c(0, p, n) << 32) | h;
+}
+
+/* About the square root of the file size, as rsync does */
+static int delta_block_size(long long size)
+{
+int b = DELTA_BLOCK_MIN;
+
+while (b < DELTA_BLOCK_MAX && (long long) b * b < size) b *= 2;
+return b;
+}
+
+int delta_sign(int fd, char **sigs)
+{
+struct stat st;
+unsigned int a, b;
+unsigned long long strong;
+char *blk;
+char *s;
+int block, num, i;
+
+if (fstat(fd, &st) < 0) st.st_size = 0;
+block = delta_block_size((long long) st.st_size);
+num = (int) (st.st_size / block);
+s = (char *) malloc(8 + (long long) num * DELTA_SIG_LEN);
+blk = (char *) malloc(block);
+for (i=0; i<num; i++) {
+	if (pread(fd, blk, block, (off_t) i * block) != block) break;
+	delta_weak(blk, block, &a, &b);
+	strong = delta_strong(blk, block);
+	put32(s + 8 + i*DELTA_SIG_LEN, WEAK(a, b));
+	put32(s + 12 + i*DELTA_SIG_LEN, (unsigned int) (strong >> 32));
+	put32(s + 16 + i*DELTA_SIG_LEN, (unsigned int) strong);
+}
+put32(s, block);
+put32(s+4, i);		/* The file may have shrunk */
+free(blk);
+*sigs = s;
+return 8 + i*DELTA_SIG_LEN;
+}
+
+struct delta_sigs *delta_sigs_create(int peer, char name[])
+{
+struct delta_sigs *s;
+
+s = (struct delta_sigs *) calloc(1, sizeof(struct delta_sigs));
+s->peer = peer;
+strncpy(s->name, name, DELTA_NAME_MAX-1);
+return s;
+}
+
+void delta_sigs_append(struct delta_sigs *s, char data[], int n)
+{
+if (s->raw_len + n > s->raw_cap) {
+	s->raw_cap = 2 * (s->raw_len + n);
+	s->raw = (char *) realloc(s->raw, s->raw_cap);
+}
+memcpy(s->raw + s->raw_len, data, n);
+s->raw_len += n;
+}
+
+int delta_sigs_parse(struct delta_sigs *s)
+{
+char *p;
+int i;
+
+if (s->raw_len < 8) return 0;
+s->block = (int) get32(s->raw);
+s->num = (int) get32(s->raw+4);
+if (s->block < DELTA_BLOCK_MIN || s->block > DELTA_BLOCK_MAX
+		|| s->num < 0
+		|| 8 + (long long) s->num * DELTA_SIG_LEN != s->raw_len) {
+	s->num = 0;
+	return 0;
+}
+s->weak = (unsigned int *) malloc(s->num * sizeof(unsigned int));
+s->strong = (unsigned long long *)
+	malloc(s->num * sizeof(unsigned long long));
+for (i=0; i<s->num; i++) {
+	p = s->raw + 8 + i*DELTA_SIG_LEN;
+	s->weak[i] = get32(p);
+	s->strong[i] = ((unsigned long long) get32(p+4) << 32) | get32(p+8);
+}
+free(s->raw);
+s->raw = NULL;
+s->raw_len = s->raw_cap = 0;
+return 1;
+}
+
+void delta_sigs_free(struct delta_sigs *s)
+{
+free(s->raw);
+free(s->weak);
+free(s->strong);
+free(s);
+}
+
+/*
+ * The encoder keeps the window and the literal bytes before it in
+ * buf[]: buf[lit..pos) are bytes no block matched, not sent yet,
+ * and buf[pos..pos+block) is the window.  Blocks that match one
+ * after another are sent as one 'C' op, the run.
+ */
+struct delta_enc {
+	struct delta_sigs *s;
+	int fd;
+	long long read_off;	/* Bytes of the file read */
+	int eof;
+	char *buf;
+	int cap;
+	int len;
+	int pos;
+	int lit;
+	unsigned int a, b;	/* Weak checksum of the window */
+	int weak_ok;
+	int *head;		/* Blocks by weak checksum */
+	int *chain;
+	unsigned int mask;
+	int run_start;		/* Matched blocks not sent yet */
+	int run_len;
+	int started;		/* 'H' put out */
+	int done;		/* 'E' put out */
+	unsigned int crc;
+	long long matched;
+};
+
+struct delta_enc *delta_enc_create(struct delta_sigs *s, int fd)
+{
+struct delta_enc *e;
+unsigned int size;
+unsigned int h;
+int i;
+
+e = (struct delta_enc *) calloc(1, sizeof(struct delta_enc));
+e->s = s;
+e->fd = fd;
+e->cap = DELTA_LIT_MAX + 2 * s->block + DELTA_READ;
+e->buf = (char *) malloc(e->cap);
+
+for (size = 64; size < 2 * (unsigned int) s->num; size *= 2);
+e->mask = size - 1;
+e->head = (int *) malloc(size * sizeof(int));
+e->chain = (int *) malloc((s->num + 1) * sizeof(int));
+for (i=0; i<(int) size; i++) e->head[i] = -1;
+for (i=s->num-1; i>=0; i--) {	/* The first of equal blocks wins */
+	h = s->weak[i] & e->mask;
+	e->chain[i] = e->head[h];
+	e->head[h] = i;
+}
+return e;
+}
+
+/* Read on in the file, keeping only the bytes still needed */
+static void delta_enc_fill(struct delta_enc *e)
+{
+int n;
+
+if (e->lit > 0) {
+	memmove(e->buf, e->buf + e->lit, e->len - e->lit);
+	e->len -= e->lit;
+	e->pos -= e->lit;
+	e->lit = 0;
+}
+n = pread(e->fd, e->buf + e->len, e->cap - e->len, e->read_off);
+if (n <= 0) {
+	e->eof = 1;
+	return;
+}
+e->crc = crc32c(e->crc, e->buf + e->len, n);
+e->len += n;
+e->read_off += n;
+}
+
+/* The block the window matches, or -1 */
+static int delta_enc_match(struct delta_enc *e)
+{
+struct delta_sigs *s = e->s;
+unsigned long long strong = 0;
+unsigned int weak;
+int have_strong = 0;
+int i;
+
+weak = WEAK(e->a, e->b);
+i = e->run_start + e->run_len;		/* Try the next block of a run */
+if (e->run_len == 0 || i >= s->num || s->weak[i] != weak) {
+	i = e->head[weak & e->mask];
+}
+for (; i >= 0; i = e->chain[i]) {
+	if (s->weak[i] != weak) continue;
+	if (!have_strong) {
+		strong = delta_strong(e->buf + e->pos, s->block);
+		have_strong = 1;
+	}
+	if (s->strong[i] == strong) return i;
+}
+return -1;
+}
+
+/* Put out the run, if there is one and room for it */
+static int delta_enc_run(struct delta_enc *e, char chunk[], int *o)
+{
+if (e->run_len == 0) return 1;
+if (*o + 7 > LZ_CHUNK) return 0;
+chunk[*o] = 'C';
+put32(chunk + *o + 1, e->run_start);
+put16(chunk + *o + 5, e->run_len);
+*o += 7;
+e->run_len = 0;
+return 1;
+}
+
+/*
+ * Put out the literal bytes, after the run they follow, if there is
+ * room.  With none the run is left to grow.
+ */
+static int delta_enc_lit(struct delta_enc *e, char chunk[], int *o)
+{
+int n = e->pos - e->lit;
+
+if (n == 0) return 1;
+if (!delta_enc_run(e, chunk, o)) return 0;
+if (*o + 3 + n > LZ_CHUNK) return 0;
+chunk[*o] = 'L';
+put16(chunk + *o + 1, n);
+memcpy(chunk + *o + 3, e->buf + e->lit, n);
+*o += 3 + n;
+e->lit = e->pos;
+return 1;
+}
+
+int delta_enc_next(struct delta_enc *e, char chunk[])
+{
+int block = e->s->block;
+unsigned int out, in;
+int i;
+int o = 0;
+
+if (!e->started) {
+	chunk[o] = 'H';
+	put32(chunk+1, block);
+	o += 5;
+	e->started = 1;
+}
+while (!e->done) {
+	if (e->len - e->pos < block && !e->eof) {
+		delta_enc_fill(e);
+		continue;
+	}
+	if (e->len - e->pos >= block && e->s->num > 0) {
+		if (!e->weak_ok) {
+			delta_weak(e->buf + e->pos, block, &e->a, &e->b);
+			e->weak_ok = 1;
+		}
+		i = delta_enc_match(e);
+		if (i >= 0) {
+			if (!delta_enc_lit(e, chunk, &o)) return o;
+			if (e->run_len > 0 && i == e->run_start + e->run_len
+					&& e->run_len < DELTA_RUN_MAX) {
+				e->run_len++;
+			}
+			else {
+				if (!delta_enc_run(e, chunk, &o)) return o;
+				e->run_start = i;
+				e->run_len = 1;
+			}
+			e->matched += block;
+			e->pos += block;
+			e->lit = e->pos;
+			e->weak_ok = 0;
+			continue;
+		}
+		if (e->pos - e->lit >= DELTA_LIT_MAX
+				&& !delta_enc_lit(e, chunk, &o)) {
+			return o;
+		}
+		/* Slide the window a byte along */
+		out = (unsigned char) e->buf[e->pos];
+		if (e->pos + block < e->len) {
+			in = (unsigned char) e->buf[e->pos + block];
+			e->a = e->a - out + in;
+			e->b = e->b - block * out + e->a;
+		}
+		else {
+			e->weak_ok = 0;
+		}
+		e->pos++;
+		continue;
+	}
+	/* Less than a block left, or nothing to match: literal bytes */
+	if (e->pos < e->len) {
+		i = e->pos;	/* Where to take up again, if no room */
+		e->pos = e->len - e->lit < DELTA_LIT_MAX
+			? e->len : e->lit + DELTA_LIT_MAX;
+		if (!delta_enc_lit(e, chunk, &o)) {
+			e->pos = i;
+			return o;
+		}
+		e->weak_ok = 0;
+		continue;
+	}
+	if (!delta_enc_run(e, chunk, &o) || o + 13 > LZ_CHUNK) return o;
+	chunk[o] = 'E';
+	put32(chunk+o+1, e->crc);
+	put32(chunk+o+5, (unsigned int) (e->read_off >> 32));
+	put32(chunk+o+9, (unsigned int) e->read_off);
+	o += 13;
+	e->done = 1;
+}
+return o;
+}
+
+int delta_enc_done(struct delta_enc *e)
+{
+return e->done;
+}
+
+long long delta_enc_bytes(struct delta_enc *e)
+{
+return e->read_off;
+}
+
+long long delta_enc_matched(struct delta_enc *e)
+{
+return e->matched;
+}
+
+void delta_enc_free(struct delta_enc *e)
+{
+delta_sigs_free(e->s);
+free(e->buf);
+free(e->head);
+free(e->chain);
+free(e);
+}
+
+struct delta_dec {
+	char name[DELTA_NAME_MAX];
+	int basis;
+	FILE *out;
+	int block;
+	char *buf;		/* A block of the basis */
+	unsigned int crc;	/* Of what has been written */
+	long long bytes;
+	int ok;
+};
+
+struct delta_dec *delta_dec_create(int basis_fd, FILE *out, char name[])
+{
+struct delta_dec *d;
+
+d = (struct delta_dec *) calloc(1, sizeof(struct delta_dec));
+strncpy(d->name, name, DELTA_NAME_MAX-1);
+d->basis = basis_fd;
+d->out = out;
+return d;
+}
+
+static void delta_dec_write(struct delta_dec *d, char *p, int n)
+{
+if (d->out != NULL) fwrite(p, 1, n, d->out);
+d->crc = crc32c(d->crc, p, n);
+d->bytes += n;
+}
+
+int delta_dec_chunk(struct delta_dec *d, char chunk[], int n)
+{
+long long off;
+unsigned int idx;
+int i = 0;
+int k, m;
+
+while (i < n) {
+	switch (chunk[i]) {
+	case 'H':
+		if (i + 5 > n || d->buf != NULL) return -1;
+		d->block = (int) get32(chunk+i+1);
+		if (d->block < DELTA_BLOCK_MIN || d->block > DELTA_BLOCK_MAX) {
+			return -1;
+		}
+		d->buf = (char *) malloc(d->block);
+		i += 5;
+		break;
+	case 'C':
+		if (i + 7 > n || d->buf == NULL) return -1;
+		idx = get32(chunk+i+1);
+		m = (int) get16(chunk+i+5);
+		for (k=0; k<m; k++) {
+			off = ((long long) idx + k) * d->block;
+			if (pread(d->basis, d->buf, d->block, off) != d->block) {
+				return -1;
+			}
+			delta_dec_write(d, d->buf, d->block);
+		}
+		i += 7;
+		break;
+	case 'L':
+		if (i + 3 > n) return -1;
+		m = (int) get16(chunk+i+1);
+		if (i + 3 + m > n) return -1;
+		delta_dec_write(d, chunk+i+3, m);
+		i += 3 + m;
+		break;
+	case 'E':
+		if (i + 13 > n) return -1;
+		off = ((long long) get32(chunk+i+5) << 32) | get32(chunk+i+9);
+		d->ok = get32(chunk+i+1) == d->crc && off == d->bytes;
+		i += 13;
+		break;
+	default:
+		return -1;
+	}
+}
+return 0;
+}
+
+char *delta_dec_name(struct delta_dec *d)
+{
+return d->name;
+}
+
+int delta_dec_ok(struct delta_dec *d)
+{
+return d->ok;
+}
+
+void delta_dec_free(struct delta_dec *d)
+{
+if (d->basis >= 0) close(d->basis);
+free(d->buf);
+free(d);
+}
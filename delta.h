@@ -0,0 +1,113 @@
+/*
+ * delta.h
+ *
+ * Delta transfer of a file the receiver already has a copy of, in
+ * the manner of rsync.  The receiver cuts its copy, the basis, into
+ * blocks and sends the sender a weak rolling checksum and a strong
+ * hash of each.  The sender slides a window over the new file and,
+ * where the window's checksums match a block, sends a reference to
+ * the block instead of its bytes.  The receiver rebuilds the file
+ * from its basis and the bytes that were sent.
+ *
+ * The signatures travel as a transfer of their own, from the
+ * receiver to the sender, whose start segment has DELTA_SIGS set:
+ *
+ *    bytes 0-3    block size
+ *    bytes 4-7    number of blocks, N
+ *    then N times 4 bytes of weak checksum and 8 of strong hash
+ *
+ * Only whole blocks are signed.  The delta itself is a stream of
+ * ops, cut into chunks of whole ops that go through the chunk
+ * stream (lz.h), so they are compressed if LZ was accepted:
+ *
+ *    'H' block size (4)                   first, once
+ *    'C' block index (4) count (2)        copy blocks of the basis
+ *    'L' length (2) bytes                 literal bytes
+ *    'E' crc32c (4) length (8)            of the whole new file, last
+ *
+ * Integers are most significant byte first.  The receiver writes
+ * the new file beside the basis and only replaces the basis if the
+ * checksum of what it wrote matches the 'E' op.  If it does not,
+ * it rejects the stream (LZ_STREAM_FAIL in lz.h), and the sender
+ * sends the whole file.
+ */
+
+#define DELTA_OPT 2		/* Start segment: delta offered, or accepted */
+#define DELTA_SIGS 4		/* Start segment: this carries signatures */
+
+#define DELTA_BLOCK_MIN 512
+#define DELTA_BLOCK_MAX 65536
+#define DELTA_SIG_LEN 12	/* Weak checksum and strong hash of a block */
+#define DELTA_NAME_MAX 100
+
+/*
+ * Signatures of the blocks of the file open on fd, in the form
+ * above, in a buffer the caller frees.  Returns the length.
+ */
+int delta_sign(int fd, char **sigs);
+
+/* Signatures received from 'peer' for file 'name' */
+struct delta_sigs {
+	int peer;
+	char name[DELTA_NAME_MAX];
+	char *raw;		/* As received */
+	int raw_len;
+	int raw_cap;
+	int block;		/* Once parsed */
+	int num;
+	unsigned int *weak;
+	unsigned long long *strong;
+	struct delta_sigs *next;
+};
+
+struct delta_sigs *delta_sigs_create(int peer, char name[]);
+
+/* Add n bytes of the signature transfer */
+void delta_sigs_append(struct delta_sigs *s, char data[], int n);
+
+/* Parse what has been received; returns 0 if it is malformed */
+int delta_sigs_parse(struct delta_sigs *s);
+
+void delta_sigs_free(struct delta_sigs *s);
+
+/*
+ * Sender: encode the file open on fd against the signatures s,
+ * which it takes over.  Each call to delta_enc_next() reads what it
+ * needs of the file and puts the next ops, up to LZ_CHUNK bytes, in
+ * chunk[].  The file is read once, front to back.
+ */
+struct delta_enc;
+
+struct delta_enc *delta_enc_create(struct delta_sigs *s, int fd);
+
+/* Returns the length of the ops put in chunk[] */
+int delta_enc_next(struct delta_enc *e, char chunk[]);
+
+/* The 'E' op has been put out */
+int delta_enc_done(struct delta_enc *e);
+
+/* Bytes of the file read, and those sent as references to blocks */
+long long delta_enc_bytes(struct delta_enc *e);
+long long delta_enc_matched(struct delta_enc *e);
+
+void delta_enc_free(struct delta_enc *e);
+
+/*
+ * Receiver: rebuild file 'name' from the basis open on basis_fd,
+ * writing it to out.  Chunks of ops are given in order.
+ */
+struct delta_dec;
+
+struct delta_dec *delta_dec_create(int basis_fd, FILE *out, char name[]);
+
+/* The name of the file being rebuilt */
+char *delta_dec_name(struct delta_dec *d);
+
+/* Apply a chunk of ops; returns -1 if it is corrupt */
+int delta_dec_chunk(struct delta_dec *d, char chunk[], int n);
+
+/* The 'E' op arrived and what was written matches it */
+int delta_dec_ok(struct delta_dec *d);
+
+/* Free the decoder and close the basis, but not out */
+void delta_dec_free(struct delta_dec *d);
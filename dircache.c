@@ -0,0 +1,276 @@
+/*
+ * dircache.c
+ *
+ * A host's index of its directory; see dircache.h.  Entries are
+ * chained in a hash table by name.  The inotify watch is set up
+ * before the directory is read, so nothing that changes while it
+ * is read is missed, and an overflow of inotify's queue is made
+ * good by reading the directory again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "dircache.h"
+
+#define DIRCACHE_FDS_MAX 64	/* Handles kept open per directory */
+#define DIRCACHE_EVENTS (IN_CREATE | IN_CLOSE_WRITE | IN_ATTRIB \
+	| IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO \
+	| IN_DELETE_SELF | IN_MOVE_SELF)
+
+static unsigned int dir_hash(char name[])
+{
+unsigned int h = 2166136261u;	/* FNV-1a */
+
+while (*name != '\0') {
+	h ^= (unsigned char) *name++;
+	h *= 16777619u;
+}
+return h & (DIRCACHE_BUCKETS - 1);
+}
+
+static struct dir_entry *dir_lookup(struct dir_cache *d, char name[])
+{
+struct dir_entry *e;
+
+for (e = d->bucket[dir_hash(name)]; e != NULL; e = e->next) {
+	if (strcmp(e->name, name) == 0) return e;
+}
+return NULL;
+}
+
+static void dir_close_fd(struct dir_cache *d, struct dir_entry *e)
+{
+if (e->fd < 0) return;
+close(e->fd);
+e->fd = -1;
+d->fds--;
+}
+
+static void dir_remove(struct dir_cache *d, char name[])
+{
+struct dir_entry **p;
+struct dir_entry *e;
+
+for (p = &d->bucket[dir_hash(name)]; (e = *p) != NULL; p = &e->next) {
+	if (strcmp(e->name, name) == 0) {
+		*p = e->next;
+		dir_close_fd(d, e);
+		free(e);
+		d->num--;
+		return;
+	}
+}
+}
+
+/* Index file 'name' as it now is, or forget it if it is gone */
+static void dir_stat(struct dir_cache *d, char name[])
+{
+struct dir_entry *e;
+struct stat st;
+unsigned int b;
+
+if (strlen(name) >= DIRCACHE_NAME_MAX) return;
+if (fstatat(d->dir_fd, name, &st, 0) < 0 || !S_ISREG(st.st_mode)) {
+	dir_remove(d, name);
+	return;
+}
+e = dir_lookup(d, name);
+if (e == NULL) {
+	e = (struct dir_entry *) malloc(sizeof(struct dir_entry));
+	strcpy(e->name, name);
+	e->fd = -1;
+	b = dir_hash(name);
+	e->next = d->bucket[b];
+	d->bucket[b] = e;
+	d->num++;
+}
+else if (e->ino != (long long) st.st_ino) {	/* Replaced */
+	dir_close_fd(d, e);
+}
+e->ino = (long long) st.st_ino;
+e->size = (long long) st.st_size;
+e->mtime = (long long) st.st_mtime;
+}
+
+static void dir_clear(struct dir_cache *d)
+{
+struct dir_entry *e;
+int b;
+
+for (b=0; b<DIRCACHE_BUCKETS; b++) {
+	while ((e = d->bucket[b]) != NULL) {
+		d->bucket[b] = e->next;
+		dir_close_fd(d, e);
+		free(e);
+	}
+}
+d->num = 0;
+}
+
+/* Index the directory from scratch */
+static void dir_scan(struct dir_cache *d)
+{
+struct dirent *de;
+DIR *dir;
+int fd;
+
+dir_clear(d);
+d->rescans++;
+fd = openat(d->dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+if (fd < 0) return;
+dir = fdopendir(fd);
+if (dir == NULL) {
+	close(fd);
+	return;
+}
+while ((de = readdir(dir)) != NULL) {
+	if (de->d_name[0] == '.') continue;
+	dir_stat(d, de->d_name);
+}
+closedir(dir);
+}
+
+struct dir_cache *dir_cache_open(char path[])
+{
+struct dir_cache *d;
+
+d = (struct dir_cache *) calloc(1, sizeof(struct dir_cache));
+d->dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+if (d->dir_fd < 0) {
+	free(d);
+	return NULL;
+}
+d->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+if (d->watch_fd >= 0
+		&& inotify_add_watch(d->watch_fd, path, DIRCACHE_EVENTS) < 0) {
+	close(d->watch_fd);
+	d->watch_fd = -1;
+}
+dir_scan(d);
+return d;
+}
+
+void dir_cache_close(struct dir_cache *d)
+{
+dir_clear(d);
+if (d->watch_fd >= 0) close(d->watch_fd);
+close(d->dir_fd);
+free(d);
+}
+
+void dir_cache_refresh(struct dir_cache *d)
+{
+char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+struct inotify_event *ev;
+int rescan = 0;
+int gone = 0;
+int i, n;
+
+if (d->watch_fd < 0) return;
+while ((n = read(d->watch_fd, buf, sizeof(buf))) > 0) {
+	for (i=0; i<n; i += sizeof(struct inotify_event) + ev->len) {
+		ev = (struct inotify_event *) (buf + i);
+		d->events++;
+		if (ev->mask & IN_Q_OVERFLOW) {
+			rescan = 1;
+		}
+		else if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF
+				| IN_IGNORED)) {
+			gone = 1;
+		}
+		else if (ev->len == 0) {
+			continue;
+		}
+		else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+			dir_remove(d, ev->name);
+		}
+		else {
+			dir_stat(d, ev->name);
+		}
+	}
+}
+if (rescan) dir_scan(d);
+if (gone) {		/* Look files up in what is left, if anything */
+	close(d->watch_fd);
+	d->watch_fd = -1;
+}
+}
+
+struct dir_entry *dir_cache_find(struct dir_cache *d, char name[])
+{
+if (d->watch_fd < 0) dir_stat(d, name);	/* Not kept current */
+return dir_lookup(d, name);
+}
+
+int dir_cache_read_fd(struct dir_cache *d, char name[])
+{
+struct dir_entry *e;
+int fd;
+
+e = dir_cache_find(d, name);
+if (e == NULL) return -1;
+if (e->fd < 0) {
+	fd = openat(d->dir_fd, name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || d->fds >= DIRCACHE_FDS_MAX) return fd;
+	e->fd = fd;
+	d->fds++;
+}
+return dup(e->fd);
+}
+
+FILE *dir_cache_create(struct dir_cache *d, char name[])
+{
+FILE *fp;
+int fd;
+
+fd = openat(d->dir_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+	0644);
+if (fd < 0) return NULL;
+fp = fdopen(fd, "w");
+if (fp == NULL) close(fd);
+return fp;
+}
+
+/*
+ * The index is brought up to date here as well as by inotify, so
+ * that a lookup right after sees the change
+ */
+int dir_cache_rename(struct dir_cache *d, char from[], char to[])
+{
+if (renameat(d->dir_fd, from, d->dir_fd, to) < 0) return 0;
+dir_stat(d, from);
+dir_stat(d, to);
+return 1;
+}
+
+void dir_cache_unlink(struct dir_cache *d, char name[])
+{
+unlinkat(d->dir_fd, name, 0);
+dir_stat(d, name);
+}
+
+int dir_cache_list(struct dir_cache *d, char buf[], int size)
+{
+struct dir_entry *e;
+char line[DIRCACHE_NAME_MAX + 48];
+int b, k, n;
+
+n = snprintf(buf, size, "%d\n", d->num);
+for (b=0; b<DIRCACHE_BUCKETS; b++) {
+	for (e = d->bucket[b]; e != NULL; e = e->next) {
+		k = sprintf(line, "%s %lld %lld\n",
+			e->name, e->size, e->mtime);
+		if (n + k >= size) return n;
+		memcpy(buf + n, line, k + 1);
+		n += k;
+	}
+}
+return n;
+}
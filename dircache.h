@@ -0,0 +1,71 @@
+/*
+ * dircache.h
+ *
+ * A host's index of its directory.  It is built when the manager
+ * sets the directory (command 'm') and kept current with inotify,
+ * so finding a file, its size and time, or a handle to read it
+ * is a hash lookup rather than a path lookup in the kernel.
+ *
+ * Only the regular files at the top of the directory are indexed,
+ * with their size and time as of their last close after writing.  Each
+ * entry keeps its file open once it has been read, until inotify
+ * reports the file replaced or removed.  If inotify is not
+ * available the index is not kept current, and files are looked
+ * up in the directory instead.
+ */
+
+#define DIRCACHE_NAME_MAX 100
+#define DIRCACHE_BUCKETS 256	/* A power of 2 */
+
+struct dir_entry {
+	char name[DIRCACHE_NAME_MAX];
+	long long size;
+	long long mtime;	/* Seconds */
+	long long ino;
+	int fd;			/* Open for reading, or -1 */
+	struct dir_entry *next;
+};
+
+struct dir_cache {
+	int dir_fd;		/* The directory, for openat() */
+	int watch_fd;		/* inotify, or -1 */
+	struct dir_entry *bucket[DIRCACHE_BUCKETS];
+	int num;		/* Files indexed */
+	int fds;		/* Handles open */
+	long events;		/* Statistics */
+	long rescans;
+};
+
+/* Index directory 'path'; NULL if it cannot be opened */
+struct dir_cache *dir_cache_open(char path[]);
+
+void dir_cache_close(struct dir_cache *d);
+
+/* Bring the index up to date with what inotify reports; no wait */
+void dir_cache_refresh(struct dir_cache *d);
+
+/* The entry of file 'name', or NULL */
+struct dir_entry *dir_cache_find(struct dir_cache *d, char name[]);
+
+/*
+ * A descriptor to read file 'name' with pread(), for the caller
+ * to close, or -1.  It shares the entry's handle, so the file is
+ * not opened again.
+ */
+int dir_cache_read_fd(struct dir_cache *d, char name[]);
+
+/* Create or truncate file 'name' for writing */
+FILE *dir_cache_create(struct dir_cache *d, char name[]);
+
+/* Rename file 'from' to 'to', replacing it; returns 0 if it fails */
+int dir_cache_rename(struct dir_cache *d, char from[], char to[]);
+
+/* Remove file 'name' */
+void dir_cache_unlink(struct dir_cache *d, char name[]);
+
+/*
+ * The number of files, then "name size mtime" for each, one per
+ * line, in buf[] of 'size' bytes.  Files that do not fit are left
+ * out.  Returns the length.
+ */
+int dir_cache_list(struct dir_cache *d, char buf[], int size);
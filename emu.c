@@ -0,0 +1,284 @@
+/*
+ * emu.c
+ *
+ * Link emulation: bandwidth, delay, jitter, loss and reordering.
+ * Frames in flight are kept in a binary min-heap on release time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "emu.h"
+
+void emu_init(struct link_emu *e, unsigned int seed)
+{
+memset(e, 0, sizeof(struct link_emu));
+e->queue = EMU_QUEUE_DEFAULT;
+emu_seed(e, seed);
+}
+
+/*
+ * Seed the random numbers.  Nearby seeds are mixed so the first
+ * numbers drawn are not all small, which would lose the first
+ * frames on every link with loss.
+ */
+void emu_seed(struct link_emu *e, unsigned int seed)
+{
+unsigned int x;
+
+x = seed * 2654435761u + 0x9e3779b9u;
+x ^= x >> 16;
+x *= 0x85ebca6bu;
+x ^= x >> 13;
+x *= 0xc2b2ae35u;
+x ^= x >> 16;
+e->rng = x != 0 ? x : 1;
+}
+
+/* Uniform random number in [0, 1), xorshift32 */
+static double emu_random(struct link_emu *e)
+{
+unsigned int x = e->rng;
+
+x ^= x << 13;
+x ^= x >> 17;
+x ^= x << 5;
+e->rng = x;
+return x / 4294967296.0;
+}
+
+/* A time like "20ms", "500us" or "1s"; milliseconds if no unit */
+static int emu_parse_time(char *s, long long *t)
+{
+double v;
+char unit[8] = "ms";
+
+if (sscanf(s, "%lf%7s", &v, unit) < 1 || v < 0) return -1;
+if (strcmp(unit, "us") == 0) *t = (long long) v;
+else if (strcmp(unit, "ms") == 0) *t = (long long) (v * 1000);
+else if (strcmp(unit, "s") == 0) *t = (long long) (v * 1000000);
+else return -1;
+return 1;
+}
+
+/* A probability like "0.01" or "1%" */
+static int emu_parse_prob(char *s, double *p)
+{
+double v;
+char unit[4] = "";
+
+if (sscanf(s, "%lf%3s", &v, unit) < 1) return -1;
+if (strcmp(unit, "%") == 0) v = v / 100;
+else if (unit[0] != '\0') return -1;
+if (v < 0 || v > 1) return -1;
+*p = v;
+return 1;
+}
+
+/* A rate in bits per second like "10M" */
+static int emu_parse_rate(char *s, long long *r)
+{
+double v;
+char unit[8] = "";
+
+if (sscanf(s, "%lf%7s", &v, unit) < 1 || v <= 0) return -1;
+if (unit[0] == 'k' || unit[0] == 'K') v *= 1e3;
+else if (unit[0] == 'M') v *= 1e6;
+else if (unit[0] == 'G') v *= 1e9;
+else if (unit[0] != '\0') return -1;
+*r = (long long) v;
+return 1;
+}
+
+int emu_parse_option(struct link_emu *e, char *opt)
+{
+if (strncmp(opt, "bw=", 3) == 0) {
+	return emu_parse_rate(opt+3, &e->bandwidth);
+}
+else if (strncmp(opt, "burst=", 6) == 0) {
+	return sscanf(opt+6, "%d", &e->burst) == 1 && e->burst > 0 ? 1 : -1;
+}
+else if (strncmp(opt, "queue=", 6) == 0) {
+	return sscanf(opt+6, "%d", &e->queue) == 1 && e->queue > 0 ? 1 : -1;
+}
+else if (strncmp(opt, "delay=", 6) == 0) {
+	return emu_parse_time(opt+6, &e->delay_us);
+}
+else if (strncmp(opt, "jitter=", 7) == 0) {
+	return emu_parse_time(opt+7, &e->jitter_us);
+}
+else if (strncmp(opt, "loss=", 5) == 0) {
+	return emu_parse_prob(opt+5, &e->loss);
+}
+else if (strncmp(opt, "reorder=", 8) == 0) {
+	return emu_parse_prob(opt+8, &e->reorder);
+}
+return 0;
+}
+
+int emu_valid(struct link_emu *e)
+{
+return e->bandwidth >= 0 && e->burst > 0 && e->queue > 0
+	&& e->delay_us >= 0 && e->jitter_us >= 0
+	&& e->loss >= 0 && e->loss <= 1
+	&& e->reorder >= 0 && e->reorder <= 1;
+}
+
+int emu_active(struct link_emu *e)
+{
+return e->bandwidth > 0 || e->delay_us > 0 || e->jitter_us > 0
+	|| e->loss > 0 || e->reorder > 0;
+}
+
+void emu_describe(struct link_emu *e, char str[])
+{
+int n = 0;
+
+str[0] = '\0';
+if (e->bandwidth > 0) {
+	n += sprintf(str+n, " bw=%lldbit/s burst=%d queue=%d",
+		e->bandwidth, e->burst, e->queue);
+}
+if (e->delay_us > 0) n += sprintf(str+n, " delay=%lldus", e->delay_us);
+if (e->jitter_us > 0) n += sprintf(str+n, " jitter=%lldus", e->jitter_us);
+if (e->loss > 0) n += sprintf(str+n, " loss=%g", e->loss);
+if (e->reorder > 0) n += sprintf(str+n, " reorder=%g", e->reorder);
+}
+
+/* Frame a comes out before frame b */
+static int emu_before(struct emu_frame *a, struct emu_frame *b)
+{
+return a->release_us < b->release_us
+	|| (a->release_us == b->release_us && a->seq < b->seq);
+}
+
+static void emu_heap_push(struct link_emu *e, struct emu_frame *f)
+{
+struct emu_frame t;
+int i, parent;
+
+if (e->num == e->cap) {
+	e->cap = e->cap == 0 ? 64 : 2 * e->cap;
+	e->heap = (struct emu_frame *)
+		realloc(e->heap, e->cap * sizeof(struct emu_frame));
+}
+i = e->num++;
+e->heap[i] = *f;
+while (i > 0) {
+	parent = (i - 1) / 2;
+	if (!emu_before(&e->heap[i], &e->heap[parent])) break;
+	t = e->heap[i];
+	e->heap[i] = e->heap[parent];
+	e->heap[parent] = t;
+	i = parent;
+}
+}
+
+static void emu_heap_pop(struct link_emu *e)
+{
+struct emu_frame t;
+int i, c;
+
+e->heap[0] = e->heap[--e->num];
+i = 0;
+while (1) {
+	c = 2 * i + 1;
+	if (c >= e->num) break;
+	if (c + 1 < e->num && emu_before(&e->heap[c+1], &e->heap[c])) c++;
+	if (!emu_before(&e->heap[c], &e->heap[i])) break;
+	t = e->heap[i];
+	e->heap[i] = e->heap[c];
+	e->heap[c] = t;
+	i = c;
+}
+}
+
+int emu_enqueue(struct link_emu *e, char *data, int length, long long now)
+{
+struct emu_frame f;
+long long depart;
+double rate;
+
+if (e->loss > 0 && emu_random(e) < e->loss) {
+	e->drops++;
+	free(data);
+	return 0;
+}
+
+/*
+ * Token bucket.  Tokens are bytes, refilled at the link rate up
+ * to the burst size.  A frame takes its length in tokens; if
+ * that leaves a debt, it departs when the debt is paid, so the
+ * frames queued behind it wait their turn.  The debt is the bytes
+ * waiting for the link, and a frame that would take it past the
+ * queue size is dropped at the tail.
+ */
+depart = now;
+if (e->bandwidth > 0) {
+	rate = e->bandwidth / 8.0 / 1e6;	/* Bytes per microsecond */
+	if (e->tb_us == 0) e->tokens = e->burst;
+	e->tokens += (now - e->tb_us) * rate;
+	if (e->tokens > e->burst) e->tokens = e->burst;
+	e->tb_us = now;
+	if (e->tokens - length < -e->queue) {
+		e->drops++;
+		free(data);
+		return 0;
+	}
+	e->tokens -= length;
+	if (e->tokens < 0) {
+		depart = now + (long long) (-e->tokens / rate);
+	}
+}
+
+f.data = data;
+f.length = length;
+f.seq = e->seq++;
+if (e->reorder > 0 && emu_random(e) < e->reorder) {
+	f.release_us = depart;	/* Overtakes frames in flight */
+	e->reordered++;
+}
+else {
+	f.release_us = depart + e->delay_us;
+	if (e->jitter_us > 0) {
+		f.release_us += (long long)
+			((2 * emu_random(e) - 1) * e->jitter_us);
+	}
+	if (f.release_us < depart) f.release_us = depart;
+	if (f.release_us < e->last_release) f.release_us = e->last_release;
+	e->last_release = f.release_us;
+}
+emu_heap_push(e, &f);
+return 1;
+}
+
+long long emu_wait(struct link_emu *e, long long now)
+{
+double rate;
+double tokens;
+
+if (e->bandwidth <= 0 || e->tb_us == 0) return 0;
+rate = e->bandwidth / 8.0 / 1e6;
+tokens = e->tokens + (now - e->tb_us) * rate;
+if (tokens >= 0) return 0;
+return (long long) (-tokens / rate);
+}
+
+long long emu_next(struct link_emu *e)
+{
+if (e->num == 0) return -1;
+return e->heap[0].release_us;
+}
+
+int emu_dequeue(struct link_emu *e, long long now, char **data)
+{
+int length;
+
+if (e->num == 0 || e->heap[0].release_us > now) return -1;
+*data = e->heap[0].data;
+length = e->heap[0].length;
+emu_heap_pop(e);
+return length;
+}
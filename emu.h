@@ -0,0 +1,97 @@
+/*
+ * emu.h
+ *
+ * Link emulation.  A port with emulation holds each frame it sends
+ * until the time it would have arrived over a real link, then
+ * releases it into the pipe.  Options in the network configuration
+ * file, after the link's node ids:
+ *
+ *    bw=10M        bandwidth in bits per second (suffix k, M, G),
+ *                  enforced with a token bucket
+ *    burst=30000   token bucket depth in bytes (default 2 frames)
+ *    queue=64000   bytes that may wait for the link; a frame that
+ *                  would wait behind more is dropped (default 64 KB)
+ *    delay=20ms    propagation delay (suffix us, ms, s)
+ *    jitter=5ms    delay varies uniformly by up to this much
+ *    loss=1%       probability a frame is dropped
+ *    reorder=5%    probability a frame skips the delay and
+ *                  overtakes frames still in flight
+ *
+ * Each direction of a link is emulated on its own.
+ */
+
+#define EMU_QUEUE_DEFAULT 65536	/* As much as a pipe holds */
+
+struct emu_frame {
+	long long release_us;	/* When the frame reaches the pipe */
+	long seq;		/* Orders frames with equal release */
+	int length;
+	char *data;
+};
+
+struct link_emu {
+	long long bandwidth;	/* Bits per second, 0 = unlimited */
+	int burst;		/* Bytes */
+	int queue;		/* Bytes that may wait for the link */
+	long long delay_us;
+	long long jitter_us;
+	double loss;
+	double reorder;
+
+	double tokens;		/* Token bucket, bytes; negative while */
+	long long tb_us;	/*    frames wait for the link */
+	long long last_release;	/* Keeps jitter from reordering */
+	unsigned int rng;
+
+	struct emu_frame *heap;	/* Frames in flight, earliest first */
+	int num;
+	int cap;
+	long seq;
+
+	long drops;		/* Statistics */
+	long reordered;
+};
+
+void emu_init(struct link_emu *e, unsigned int seed);
+
+/* Seed the random numbers for loss, jitter and reordering */
+void emu_seed(struct link_emu *e, unsigned int seed);
+
+/*
+ * Parse one link option from the configuration file.  Returns 1 if
+ * it is an emulation option, 0 if not, -1 if its value is bad.
+ */
+int emu_parse_option(struct link_emu *e, char *opt);
+
+/* Returns 1 if the options are all in the range emu_parse_option() takes */
+int emu_valid(struct link_emu *e);
+
+/* Returns 1 if any option makes the link differ from a plain pipe */
+int emu_active(struct link_emu *e);
+
+/* Describe the options in str[], e.g. for the startup display */
+void emu_describe(struct link_emu *e, char str[]);
+
+/*
+ * Take a frame of 'length' bytes sent at time 'now'.  The emulator
+ * keeps 'data', which must be from malloc(), and frees it if the
+ * frame is lost or the queue is full.  Returns 0 if the frame was
+ * dropped, else 1.
+ */
+int emu_enqueue(struct link_emu *e, char *data, int length, long long now);
+
+/*
+ * How long a frame sent at 'now' would wait for the frames queued
+ * ahead of it to go out on the link, in microseconds
+ */
+long long emu_wait(struct link_emu *e, long long now);
+
+/* Release time of the next frame, or -1 if none are in flight */
+long long emu_next(struct link_emu *e);
+
+/*
+ * Remove the next frame if its release time is not after 'now'.
+ * Returns its length and sets *data, which the caller frees,
+ * or returns -1.
+ */
+int emu_dequeue(struct link_emu *e, long long now, char **data);
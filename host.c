@@ -6,6 +6,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -15,27 +17,34 @@
 #include "man.h"
 #include "host.h"
 #include "packet.h"
+#include "transport.h"
+#include "lz.h"
+#include "timer.h"
+#include "uring.h"
+#include "traffic.h"
+#include "dircache.h"
+#include "delta.h"
+#include "stripe.h"
+#include "sched.h"
+#include "memq.h"
 
-#define MAX_FILE_BUFFER 1000
 #define MAX_MSG_LENGTH 100
 #define MAX_DIR_NAME 100
-#define MAX_FILE_NAME 100
-#define PKT_PAYLOAD_MAX 100
+#define TRAFFIC_BURST 256	/* Load test packets sent per pass */
+#define PKT_PAYLOAD_MAX PAYLOAD_MAX
 #define TENMILLISEC 10000   /* 10 millisecond sleep */
+#define HOST_RETRY_US 1000	/* Wait for room in a full pipe */
+#define HOST_GROUPS_MAX 16	/* Multicast groups a host is in */
+#define HOST_SIG_WAIT_US 5000000	/* Wait for a receiver's signatures */
+#define HOST_SCHED_HOLD_US 20000	/* Queue on a link, for uploads */
+#define HOST_PIPE_POLL_US 1000	/* Pass of a pipeline's threads */
+#define HOST_PIPE_QUEUE 1024	/* Packets between them, each way */
+#define HOST_PIPE_SCHED_MAX 16	/* Upload segments handed over, unsent */
+#define HOST_PIPE_RECV_MAX 256	/* Packets taken in per pass */
+#define HOST_DELTA_SUFFIX ".delta"	/* A file being rebuilt */
 
 /* Types of packets */
 
-struct file_buf {
-	char name[MAX_FILE_NAME];
-	int name_length;
-	char buffer[MAX_FILE_BUFFER+1];
-	int head;
-	int tail;
-	int occ;
-	FILE *fd;
-};
-
-
 /*
  * File buffer operations
  */
@@ -55,25 +64,20 @@ f->name_length = 0;
  */
 void file_buf_get_name(struct file_buf *f, char name[])
 {
-int i;
-
-for (i=0; i<f->name_length; i++) {
-	name[i] = f->name[i];
-}
+memcpy(name, f->name, f->name_length);
 name[f->name_length] = '\0';
 }
 
 /*
  *  Put name[] into the file name in the file buffer
- *  length = the length of name[]
+ *  length = the length of name[], which may come off the wire:
+ *  a longer name is cut to fit
  */
 void file_buf_put_name(struct file_buf *f, char name[], int length)
 {
-int i;
-
-for (i=0; i<length; i++) {
-	f->name[i] = name[i];
-}
+if (length < 0) length = 0;
+if (length > MAX_FILE_NAME-1) length = MAX_FILE_NAME-1;
+memcpy(f->name, name, length);
 f->name_length = length;
 }
 
@@ -118,11 +122,45 @@ return(i);
 
 int get_man_command(struct man_port_at_host *port, char msg[], char *c) {
 
+char *nl;
 int n;
 int i;
 int k;
 
-n = read(port->recv_fd, msg, MAN_MSG_LENGTH); /* Get command from manager */
+if (port->recv_fd < 0) return 0;  /* Simulator: not opened yet */
+
+/*
+ * Get command from manager.  Commands are one per line; what is
+ * read is kept in the port until the line it starts is whole.  A
+ * line too long for the buffer is taken as far as it goes.
+ */
+nl = memchr(port->rx_buf, '\n', port->rx_len);
+if (nl == NULL && port->rx_len < MAN_MSG_LENGTH-1) {
+	n = MAN_MSG_LENGTH-1 - port->rx_len;
+	if (port->urx != NULL) {
+		k = uring_read(port->urx, port->rx_buf + port->rx_len, n);
+	}
+	else k = read(port->recv_fd, port->rx_buf + port->rx_len, n);
+	if (k > 0) {
+		port->rx_len += k;
+		nl = memchr(port->rx_buf, '\n', port->rx_len);
+	}
+}
+if (nl != NULL) n = nl - port->rx_buf;
+else if (port->rx_len == MAN_MSG_LENGTH-1) n = port->rx_len;
+else return 0;
+memcpy(msg, port->rx_buf, n);
+msg[n] = '\0';
+k = nl != NULL ? n+1 : n;
+port->rx_len -= k;
+memmove(port->rx_buf, port->rx_buf + k, port->rx_len);
+port->tag = 0;
+if (n>0 && msg[0] == '#') {	/* A tag to answer with (man.h) */
+	port->tag = atoi(msg+1);
+	for (i=0; msg[i]!=' ' && i<n; i++);
+	n -= i;
+	memmove(msg, msg+i, n+1);
+}
 if (n>0) {  /* Remove the first char from "msg" */
 	for (i=0; msg[i]==' ' && i<n; i++);
 	*c = msg[i];
@@ -141,24 +179,96 @@ return n;
  * Operations requested by the manager
  */
 
-/* Send back state of the host to the manager as a text message */
+/* Send the manager the reply to the command tagged 'tag' */
+static void host_reply(struct man_port_at_host *port, int tag,
+		char msg[], int n)
+{
+char line[MAN_MSG_LENGTH + MAN_TAG_LEN];
+int m;
+
+m = sprintf(line, "#%d %d:", tag, n);
+memcpy(line + m, msg, n);
+write(port->send_fd, line, m + n);
+}
+
+/* 
+ * Send back state of the host to the manager as a text message:
+ * the directory, the host id, and the packet counts summed over
+ * the host's ports (sent, received, dropped for lack of buffer
+ * space or by link emulation, failed CRC)
+ */
 void reply_display_host_state(
 		struct man_port_at_host *port,
 		char dir[],
 		int dir_valid,
-		int host_id)
+		int host_id,
+		struct net_port **node_port,
+		int node_port_num)
 {
 int n;
-char reply_msg[MAX_MSG_LENGTH];
+int k;
+long tx = 0;
+long rx = 0;
+long drops = 0;
+long crc_errors = 0;
+char reply_msg[MAN_MSG_LENGTH];
+
+for (k=0; k<node_port_num; k++) {
+	tx += node_port[k]->tx_packets;
+	rx += node_port[k]->rx_packets;
+	drops += node_port[k]->tx_drops + node_port[k]->rx_drops;
+	crc_errors += node_port[k]->crc_errors;
+}
 
 if (dir_valid == 1) {
-	n =sprintf(reply_msg, "%s %d", dir, host_id);
+	n =sprintf(reply_msg, "%s %d %ld %ld %ld %ld", 
+		dir, host_id, tx, rx, drops, crc_errors);
 }
 else {
-	n = sprintf(reply_msg, "None %d", host_id);
+	n = sprintf(reply_msg, "None %d %ld %ld %ld %ld", 
+		host_id, tx, rx, drops, crc_errors);
 }
 
-write(port->send_fd, reply_msg, n);
+host_reply(port, port->tag, reply_msg, n);
+}
+
+/*
+ * Send back the host's counters for the manager's dashboard: the
+ * time, the jobs queued and the number of ports, then for each
+ * port the node at the other end, packets and bytes sent and
+ * received, drops, CRC errors, and the bytes waiting in its tx
+ * and rx buffers.  Ports that do not fit in a reply are left out.
+ */
+void reply_host_counters(
+		struct man_port_at_host *port,
+		int jobs,
+		struct net_port **node_port,
+		int node_port_num)
+{
+char reply_msg[MAN_MSG_LENGTH];
+char field[MAN_MSG_LENGTH];
+struct net_port *p;
+int num;
+int n, m;
+int k;
+
+num = 0;
+n = 0;
+for (k=0; k<node_port_num; k++) {
+	p = node_port[k];
+	m = sprintf(field, " %d %ld %ld %ld %ld %ld %ld %d %d",
+		p->pipe_peer_id, p->tx_packets, p->rx_packets,
+		p->tx_bytes, p->rx_bytes, p->tx_drops + p->rx_drops,
+		p->crc_errors, p->tx_len, p->rx_len);
+	if (n + m >= MAN_MSG_LENGTH - 64) break;
+	memcpy(reply_msg + n, field, m);
+	n += m;
+	num++;
+}
+m = sprintf(field, "%lld %d %d", timer_now_us(), jobs, num);
+memmove(reply_msg + m, reply_msg, n);
+memcpy(reply_msg, field, m);
+host_reply(port, port->tag, reply_msg, n + m);
 }
 
 
@@ -168,6 +278,7 @@ write(port->send_fd, reply_msg, n);
 /* Add a job to the job queue */
 void job_q_add(struct job_queue *j_q, struct host_job *j)
 {
+j->next = NULL;
 if (j_q->head == NULL ) {
 	j_q->head = j;
 	j_q->tail = j;
@@ -175,7 +286,6 @@ if (j_q->head == NULL ) {
 }
 else {
 	(j_q->tail)->next = j;
-	j->next = NULL;
 	j_q->tail = j;
 	j_q->occ++;
 }
@@ -206,451 +316,1644 @@ int job_q_num(struct job_queue *j_q)
 return j_q->occ;
 }
 
+/* Create a job that sends packet p on all ports, and queue it */
+void job_q_add_send(struct job_queue *j_q, struct packet *p)
+{
+struct host_job *j;
+
+j = (struct host_job *) malloc(sizeof(struct host_job));
+j->type = JOB_SEND_PKT_ALL_PORTS;
+j->packet = p;
+job_q_add(j_q, j);
+}
+
+
 /*
- *  Main 
+ * Transport connections
  */
 
-void host_main(int host_id)
+/*
+ * Find the upload sender for connection 'conn' to host 'peer', or
+ * to a group that 'peer' is one of the receivers of
+ */
+struct tp_sender *tp_sender_find(struct tp_sender *list, int peer, int conn)
 {
+for (; list != NULL; list = list->next) {
+	if ((list->dst == peer || list->peers > 0) && list->conn == conn) {
+		break;
+	}
+}
+return list;
+}
 
-/* State */
-char dir[MAX_DIR_NAME];
-int dir_valid = 0;
+/* Remove sender s from the list and free it */
+void tp_sender_remove(struct tp_sender **list, struct tp_sender *s)
+{
+struct tp_sender **p;
+
+for (p = list; *p != NULL; p = &((*p)->next)) {
+	if (*p == s) {
+		*p = s->next;
+		tp_sender_free(s);
+		free(s);
+		return;
+	}
+}
+}
 
-char man_msg[MAN_MSG_LENGTH];
-char man_reply_msg[MAN_MSG_LENGTH];
-char man_cmd;
-struct man_port_at_host *man_port;  // Port to the manager
+/* Find the receiver for connection 'conn' from host 'peer' */
+struct tp_receiver *tp_receiver_find(struct tp_receiver *list, 
+		int peer, int conn)
+{
+for (; list != NULL; list = list->next) {
+	if (list->peer == peer && list->conn == conn) break;
+}
+return list;
+}
 
-struct net_port *node_port_list;
-struct net_port **node_port;  // Array of pointers to node ports
-int node_port_num;            // Number of node ports
+/* Drop receivers that have been idle for too long */
+void tp_receiver_expire(struct tp_receiver **list, long long now)
+{
+struct tp_receiver **p;
+struct tp_receiver *r;
+
+p = list;
+while (*p != NULL) {
+	r = *p;
+	if (now - r->last_us > TP_IDLE_TIMEOUT) {
+		if (r->fp != NULL) fclose(r->fp);
+		free(r->fname);
+		if (r->zs != NULL) free(r->zs);
+		if (r->dd != NULL) delta_dec_free(r->dd);
+		if (r->sigs != NULL) delta_sigs_free(r->sigs);
+		tp_receiver_free(r);
+		*p = r->next;
+		free(r);
+	}
+	else {
+		p = &(r->next);
+	}
+}
+}
 
-int ping_reply_received;
+/*
+ * In pipeline mode (net367 -p) a host is two threads.  The I/O
+ * thread does all the work on the ports: it takes in the packets
+ * for the host and sends what the worker thread hands it.  The
+ * worker runs the host loop on the packets taken in.  They share
+ * only the queues, so a long job holds up neither the ports nor
+ * the time taken on arrival.
+ */
+struct host_pipe_msg {
+	struct packet *p;	/* From malloc(); the reader frees it */
+	int port;		/* Port it came in or goes out on, -1 for all */
+	long long at;		/* Time it came in */
+};
 
-int i, k, n;
-int dst;
-char name[MAX_FILE_NAME];
-char string[PKT_PAYLOAD_MAX+1]; 
+/* A port's counters, as the I/O thread last published them */
+struct host_pipe_stats {
+	_Atomic long tx_packets;
+	_Atomic long rx_packets;
+	_Atomic long tx_bytes;
+	_Atomic long rx_bytes;
+	_Atomic long drops;
+	_Atomic long crc_errors;
+	_Atomic int tx_len;
+	_Atomic int rx_len;
+};
 
-FILE *fp;
+struct host_pipe {
+	struct memq *in_q;	/* Packets taken in, to the worker */
+	struct memq *out_q;	/* Packets to send, from the worker */
+	struct memq *sched_q;	/* Upload segments, from the worker, to */
+				/*    go out as the links have room */
+	long sched_pushed;	/* Segments put on sched_q, by the worker */
+	_Atomic long sched_sent;	/*    and sent, by the I/O thread */
+	struct host_pipe_msg held;	/* Segment waiting for room, if p */
+	struct host_pipe_stats *stats;	/* Of each port, for the worker's */
+	struct net_port *copy;		/*    replies to the manager, which */
+	struct net_port **copy_port;	/*    read them from these copies */
+};
 
-struct packet *in_packet; /* Incoming packet */
-struct packet *new_packet;
+/*
+ * State of a host, kept between passes of its main loop
+ */
+struct host_state {
+	int host_id;
+	char dir[MAX_DIR_NAME];
+	int dir_valid;
+	struct dir_cache *cache;	/* Index of dir, or NULL */
+	struct man_port_at_host *man_port;  // Port to the manager
+	struct net_port **node_port;  // Array of pointers to node ports
+	int node_port_num;            // Number of node ports
+
+	int ping_reply_received;
+	long long ping_sent_at;	/* Time of the last ping request */
+	long long ping_rtt;	/* Its round trip time, microseconds */
+	struct job_queue job_q;
+	struct file_buf f_buf_upload;  
+	struct file_buf f_buf_download; 
+
+	struct tp_sender *tp_send_list;   /* Uploads in progress */
+	struct tp_receiver *tp_recv_list; /* Incoming transfers */
+	int tp_window;
+	int tp_next_conn;
+	int seg_max;	/* Segment size that fits the smallest port MTU */
+	int compress;	/* Offer to compress uploads */
+	int delta;	/* Send uploads as deltas, where the receiver has a copy */
+	struct delta_sigs *sig_list;	/* Receivers' signatures, for those */
+	int stripe;	/* Stripe uploads across the ports */
+	int weight;	/* Share of the ports new uploads get */
+	struct sched sched;	/* Uploads' segments waiting to go out */
+	int group[HOST_GROUPS_MAX];	/* Multicast groups joined */
+	int group_num;
+	struct uring *ring;	/* io_uring for the pipes, or NULL */
+	struct host_pipe *pipe;	/* The queues, in pipeline mode, or NULL */
+	int recv_next;	/* Port, or count, host_recv() is at */
+	struct traffic_sink *sink_list;	/* Load test traffic received */
+	int traffic_next_flow;
+};
 
-struct net_port *p;
-struct host_job *new_job;
-struct host_job *new_job2;
+/* The host takes packets sent to address 'dst' */
+static int host_accepts(struct host_state *h, int dst)
+{
+int i;
 
-struct job_queue job_q;
+if (dst == h->host_id || dst == BCAST_ADDR) return(1);
+if (!IS_MCAST(dst)) return(0);
+for (i=0; i<h->group_num; i++) {
+	if (MCAST_ADDR(h->group[i]) == dst) return(1);
+}
+return(0);
+}
 
-struct file_buf f_buf_upload;  
-struct file_buf f_buf_download; 
+/*
+ * Join (PKT_MCAST_JOIN) or leave (PKT_MCAST_LEAVE) multicast group
+ * g, telling the switches
+ */
+static void host_mcast(struct host_state *h, int g, int type)
+{
+struct packet *p;
+int i;
+
+if (g < 0 || g >= MCAST_GROUPS) return;
+for (i=0; i<h->group_num && h->group[i] != g; i++);
+if (type == PKT_MCAST_JOIN) {
+	if (i < h->group_num || h->group_num == HOST_GROUPS_MAX) return;
+	h->group[h->group_num++] = g;
+}
+else {
+	if (i == h->group_num) return;
+	h->group[i] = h->group[--h->group_num];
+}
+p = packet_alloc(0);
+p->src = h->host_id;
+p->dst = MCAST_ADDR(g);
+p->type = type;
+p->length = 0;
+job_q_add_send(&h->job_q, p);
+}
 
-file_buf_init(&f_buf_upload);
-file_buf_init(&f_buf_download);
+/* Hosts do their pipe I/O through io_uring (net367 -u) */
+static int g_host_uring = 0;
+
+void host_use_uring()
+{
+g_host_uring = 1;
+}
+
+/* Hosts run as an I/O thread and a worker thread (net367 -p) */
+static int g_host_pipeline = 0;
+
+void host_use_pipeline()
+{
+g_host_pipeline = 1;
+}
+
+struct host_state *host_create(int host_id)
+{
+struct host_state *h;
+struct net_port *node_port_list;
+struct net_port *p;
+int k;
+
+h = (struct host_state *) calloc(1, sizeof(struct host_state));
+h->host_id = host_id;
+h->dir_valid = 0;
+h->tp_send_list = NULL;
+h->tp_recv_list = NULL;
+h->tp_window = TP_WINDOW_DEFAULT;
+h->tp_next_conn = 1;
+h->compress = 0;
+h->weight = 1;
+sched_init(&h->sched);
+
+file_buf_init(&h->f_buf_upload);
+file_buf_init(&h->f_buf_download);
 
 /*
  * Initialize pipes 
  * Get link port to the manager
  */
 
-man_port = net_get_host_port(host_id);
+h->man_port = net_get_host_port(h->host_id);
 
 /*
  * Create an array node_port[ ] to store the network link ports
  * at the host.  The number of ports is node_port_num
  */
-node_port_list = net_get_port_list(host_id);
+node_port_list = net_get_port_list(h->host_id);
 
 	/*  Count the number of network link ports */
-node_port_num = 0;
+h->node_port_num = 0;
 for (p=node_port_list; p!=NULL; p=p->next) {
-	node_port_num++;
+	h->node_port_num++;
 }
 	/* Create memory space for the array */
-node_port = (struct net_port **) 
-	malloc(node_port_num*sizeof(struct net_port *));
+h->node_port = (struct net_port **) 
+	malloc(h->node_port_num*sizeof(struct net_port *));
 
 	/* Load ports into the array */
 p = node_port_list;
-for (k = 0; k < node_port_num; k++) {
-	node_port[k] = p;
+for (k = 0; k < h->node_port_num; k++) {
+	h->node_port[k] = p;
 	p = p->next;
 }	
 
+/* 
+ * Transfers send segments on every port, so they must fit 
+ * the smallest MTU among them
+ */
+h->seg_max = MTU_MAX;
+for (k = 0; k < h->node_port_num; k++) {
+	if (h->node_port[k]->mtu < h->seg_max) {
+		h->seg_max = h->node_port[k]->mtu;
+	}
+}
+h->seg_max -= TP_HDR_LEN;
+
+/* 
+ * With io_uring every pipe gets a channel on the host's ring;
+ * if the ring cannot be made the host uses read() and write()
+ */
+if (g_host_uring && !g_host_pipeline) h->ring = uring_create();
+if (h->ring != NULL) {
+	for (k = 0; k < h->node_port_num; k++) {
+		p = h->node_port[k];
+		if (p->type != PIPE) continue;
+		p->urx = uring_chan_create(h->ring, p->pipe_recv_fd, 0);
+		p->utx = uring_chan_create(h->ring, p->pipe_send_fd, 1);
+	}
+	if (h->man_port->recv_fd >= 0) {
+		h->man_port->urx = uring_chan_create(h->ring,
+			h->man_port->recv_fd, 0);
+	}
+	uring_submit(h->ring);
+}
+
 /* Initialize the job queue */
-job_q_init(&job_q);
+job_q_init(&h->job_q);
+
+if (g_host_pipeline) {
+	h->pipe = (struct host_pipe *) calloc(1, sizeof(struct host_pipe));
+	h->pipe->in_q = memq_create(HOST_PIPE_QUEUE
+		* sizeof(struct host_pipe_msg));
+	h->pipe->out_q = memq_create(HOST_PIPE_QUEUE
+		* sizeof(struct host_pipe_msg));
+	h->pipe->sched_q = memq_create(HOST_PIPE_SCHED_MAX
+		* sizeof(struct host_pipe_msg));
+	h->pipe->stats = (struct host_pipe_stats *) calloc(
+		h->node_port_num, sizeof(struct host_pipe_stats));
+	h->pipe->copy = (struct net_port *) calloc(
+		h->node_port_num, sizeof(struct net_port));
+	h->pipe->copy_port = (struct net_port **) malloc(
+		h->node_port_num * sizeof(struct net_port *));
+	for (k = 0; k < h->node_port_num; k++) {
+		h->pipe->copy[k].pipe_peer_id = h->node_port[k]->pipe_peer_id;
+		h->pipe->copy_port[k] = &h->pipe->copy[k];
+	}
+}
 
-while(1) {
-	/* Execute command from manager, if any */
-
-		/* Get command from manager */
-	n = get_man_command(man_port, man_msg, &man_cmd);
-
-		/* Execute command */
-	if (n>0) {
-		switch(man_cmd) {
-			case 's':
-				reply_display_host_state(man_port,
-					dir, 
-					dir_valid,
-					host_id);
-				break;	
-			
-			case 'm':
-				dir_valid = 1;
-				for (i=0; man_msg[i] != '\0'; i++) {
-					dir[i] = man_msg[i];
-				}
-				dir[i] = man_msg[i];
-				break;
+return(h);
+}
+
+struct net_port **host_ports(struct host_state *h, int *num)
+{
+*num = h->node_port_num;
+return(h->node_port);
+}
 
-			case 'p': // Sending ping request
-				// Create new ping request packet
-				sscanf(man_msg, "%d", &dst);
-				new_packet = (struct packet *) 
-						malloc(sizeof(struct packet));	
-				new_packet->src = (char) host_id;
-				new_packet->dst = (char) dst;
-				new_packet->type = (char) PKT_PING_REQ;
-				new_packet->length = 0;
-				new_job = (struct host_job *) 
-						malloc(sizeof(struct host_job));
-				new_job->packet = new_packet;
-				new_job->type = JOB_SEND_PKT_ALL_PORTS;
-				job_q_add(&job_q, new_job);
-
-				new_job2 = (struct host_job *) 
-						malloc(sizeof(struct host_job));
-				ping_reply_received = 0;
-				new_job2->type = JOB_PING_WAIT_FOR_REPLY;
-				new_job2->ping_timer = 10;
-				job_q_add(&job_q, new_job2);
+int host_busy(struct host_state *h)
+{
+int k;
 
-				break;
+if (job_q_num(&h->job_q) > 0) return(1);
+if (h->tp_send_list != NULL || h->tp_recv_list != NULL) return(1);
+for (k=0; k<h->node_port_num; k++) {
+	if (h->node_port[k]->rx_len > 0) return(1);
+}
+return(0);
+}
 
-			case 'u': /* Upload a file to a host */
-				sscanf(man_msg, "%d %s", &dst, name);
-				new_job = (struct host_job *) 
-						malloc(sizeof(struct host_job));
-				new_job->type = JOB_FILE_UPLOAD_SEND;
-				new_job->file_upload_dst = dst;	
-				for (i=0; name[i] != '\0'; i++) {
-					new_job->fname_upload[i] = name[i];
-				}
-				new_job->fname_upload[i] = '\0';
-				job_q_add(&job_q, new_job);
-					
-				break;
-			default:
-			;
-		}
+/*
+ * A load test job from the arguments of command 'g': the
+ * destinations, e.g. "1-4,7", packets per second, payload bytes,
+ * the pattern (traffic.h), and milliseconds to run, with the on
+ * and off periods in milliseconds for TRAFFIC_ONOFF.  NULL if the
+ * arguments do not make sense.
+ */
+static struct host_job *host_traffic_job(struct host_state *h, char msg[])
+{
+struct host_job *job;
+struct traffic_gen *g;
+char dsts[NAME_LENGTH];
+char pattern;
+double rate;
+int size, ms, on_ms, off_ms;
+
+on_ms = off_ms = 0;
+if (sscanf(msg, "%99s %lf %d %c %d %d %d", dsts, &rate, &size,
+		&pattern, &ms, &on_ms, &off_ms) < 5) {
+	return(NULL);
+}
+if (pattern != TRAFFIC_CONSTANT && pattern != TRAFFIC_POISSON
+		&& pattern != TRAFFIC_ONOFF) {
+	return(NULL);
+}
+/* Packets go out on every port, so they must fit every MTU */
+if (size > h->seg_max + TP_HDR_LEN) size = h->seg_max + TP_HDR_LEN;
+
+g = (struct traffic_gen *) malloc(sizeof(struct traffic_gen));
+if (!traffic_gen_init(g, h->host_id, h->traffic_next_flow++, dsts,
+		rate, size, pattern, on_ms * 1000LL, off_ms * 1000LL,
+		ms * 1000LL, timer_now_us())) {
+	free(g);
+	return(NULL);
+}
+job = (struct host_job *) malloc(sizeof(struct host_job));
+job->type = JOB_TRAFFIC_GEN;
+job->gen = g;
+job->packet = (struct packet *) malloc(sizeof(struct packet));
+return(job);
+}
+
+/*
+ * A job to upload file 'name' to host dst, or to the 'peers'
+ * receivers of a multicast group
+ */
+static struct host_job *host_upload_job(int dst, int peers, char name[])
+{
+struct host_job *job;
+
+job = (struct host_job *) calloc(1, sizeof(struct host_job));
+job->type = JOB_FILE_UPLOAD_SEND;
+job->file_upload_dst = dst;
+job->file_upload_peers = peers;
+job->fd = -1;
+strncpy(job->fname_upload, name, MAX_FILE_NAME-1);
+return(job);
+}
+
+/* Take the signatures 'peer' sent of file 'name', if they came */
+static struct delta_sigs *host_take_sigs(struct host_state *h, int peer,
+		char name[])
+{
+struct delta_sigs **p;
+struct delta_sigs *s;
+
+for (p = &h->sig_list; (s = *p) != NULL; p = &s->next) {
+	if (s->peer == peer && strcmp(s->name, name) == 0) {
+		*p = s->next;
+		s->next = NULL;
+		return(s);
 	}
-	
-	/*
-	 * Get packets from incoming links and translate to jobs
-  	 * Put jobs in job queue
- 	 */
+}
+return(NULL);
+}
 
-	for (k = 0; k < node_port_num; k++) { /* Scan all ports */
+/*
+ * The next chunk of an upload's stream: its signatures, the ops of
+ * its delta, or the file.  A delta the receiver did not accept is
+ * dropped for the file.  Sets job->eof after the last.
+ */
+static int host_upload_read(struct host_job *job, int peer_opts,
+		char chunk[])
+{
+int n;
 
-		in_packet = (struct packet *) malloc(sizeof(struct packet));
-		n = packet_recv(node_port[k], in_packet);
+if (job->send_sigs) {
+	n = job->sigs_len - (int) job->offset;
+	if (n > LZ_CHUNK) n = LZ_CHUNK;
+	memcpy(chunk, job->sigs + job->offset, n);
+	job->offset += n;
+	job->eof = job->offset >= job->sigs_len;
+	return(n);
+}
+if (job->dz != NULL && !(peer_opts & DELTA_OPT)) {
+	delta_enc_free(job->dz);
+	job->dz = NULL;
+}
+if (job->dz != NULL) {
+	n = delta_enc_next(job->dz, chunk);
+	job->eof = delta_enc_done(job->dz);
+	return(n);
+}
+n = pread(job->fd, chunk, LZ_CHUNK, job->offset);
+if (n < 0) n = 0;
+job->offset += n;
+job->eof = n < LZ_CHUNK;
+return(n);
+}
 
-		if ((n > 0) && ((int) in_packet->dst == host_id)) {
-			new_job = (struct host_job *) 
+/*
+ * The transfer coming in on tr has ended, or its stream is corrupt
+ * if ok is 0.  Signatures are kept for the upload that asked for
+ * them.  A file rebuilt from a delta replaces its basis only if it
+ * came out as the sender's, and a file cut short by a corrupt
+ * stream is removed; either way the acks tell the sender.
+ */
+static void host_recv_close(struct host_state *h, struct tp_receiver *tr,
+		int ok)
+{
+char tmp[MAX_FILE_NAME + sizeof(HOST_DELTA_SUFFIX)];
+char *name;
+
+if (tr->fp != NULL) {
+	fclose(tr->fp);
+	tr->fp = NULL;
+	if (!ok && tr->dd == NULL) {
+		printf("Host %d: upload of %s from host %d did not "
+			"decode, removed\n", h->host_id, tr->fname, tr->peer);
+		fflush(stdout);
+		dir_cache_unlink(h->cache, tr->fname);
+		tr->opts |= LZ_STREAM_FAIL;
+	}
+}
+if (tr->sigs != NULL) {
+	if (ok && delta_sigs_parse(tr->sigs)) {
+		tr->sigs->next = h->sig_list;
+		h->sig_list = tr->sigs;
+	}
+	else {
+		delta_sigs_free(tr->sigs);
+	}
+	tr->sigs = NULL;
+}
+if (tr->dd != NULL) {
+	name = delta_dec_name(tr->dd);
+	snprintf(tmp, sizeof(tmp), "%s%s", name, HOST_DELTA_SUFFIX);
+	if (ok && delta_dec_ok(tr->dd)) {
+		dir_cache_rename(h->cache, tmp, name);
+	}
+	else {
+		printf("Host %d: delta of %s from host %d did not "
+			"check out, %s left as it was\n",
+			h->host_id, name, tr->peer, name);
+		fflush(stdout);
+		dir_cache_unlink(h->cache, tmp);
+		tr->opts |= LZ_STREAM_FAIL;
+	}
+	delta_dec_free(tr->dd);
+	tr->dd = NULL;
+}
+}
+
+/*
+ * The ports whose counters go in replies to the manager.  In
+ * pipeline mode the ports are the I/O thread's, so the worker
+ * reads copies of the counters it published.
+ */
+static struct net_port **host_stats_ports(struct host_state *h)
+{
+struct host_pipe_stats *st;
+struct net_port *p;
+int k;
+
+if (h->pipe == NULL) return(h->node_port);
+for (k = 0; k < h->node_port_num; k++) {
+	st = &h->pipe->stats[k];
+	p = &h->pipe->copy[k];
+	p->tx_packets = st->tx_packets;
+	p->rx_packets = st->rx_packets;
+	p->tx_bytes = st->tx_bytes;
+	p->rx_bytes = st->rx_bytes;
+	p->tx_drops = st->drops;
+	p->crc_errors = st->crc_errors;
+	p->tx_len = st->tx_len;
+	p->rx_len = st->rx_len;
+}
+return(h->pipe->copy_port);
+}
+
+/*
+ * Carry out command 'cmd' from the manager, with its
+ * arguments in msg[]
+ */
+void host_command(struct host_state *h, char cmd, char msg[])
+{
+struct packet *new_packet;
+struct host_job *new_job;
+struct host_job *new_job2;
+char name[MAX_FILE_NAME];
+char man_reply_msg[MAN_MSG_LENGTH];
+int dst;
+int i, n;
+
+switch(cmd) {
+	case 's':
+		reply_display_host_state(h->man_port,
+			h->dir, 
+			h->dir_valid,
+			h->host_id,
+			host_stats_ports(h),
+			h->node_port_num);
+		break;
+
+	case 'g': /* Generate traffic: dsts rate size pattern ms [on off] */
+		new_job = host_traffic_job(h, msg);
+		if (new_job != NULL) job_q_add(&h->job_q, new_job);
+		break;
+
+	case 'r': /* Report the traffic received, and clear it if "1" */
+		n = traffic_sink_report(h->sink_list, man_reply_msg);
+		host_reply(h->man_port, h->man_port->tag, man_reply_msg, n);
+		if (sscanf(msg, "%d", &i) == 1 && i == 1) {
+			traffic_sink_clear(&h->sink_list);
+		}
+		break;
+
+	case 'k':	/* Counters for the dashboard */
+		reply_host_counters(h->man_port, h->job_q.occ,
+			host_stats_ports(h), h->node_port_num);
+		break;
+
+	case 'm':
+		if (strlen(msg) >= MAX_DIR_NAME) {
+			printf("Host %d: directory name longer than %d, "
+				"not set\n", h->host_id, MAX_DIR_NAME-1);
+			fflush(stdout);
+			break;
+		}
+		h->dir_valid = 1;
+		strcpy(h->dir, msg);
+		if (h->cache != NULL) dir_cache_close(h->cache);
+		h->cache = dir_cache_open(h->dir);
+		break;
+
+	case 'i':	/* List the files in the directory */
+		if (h->cache != NULL) {
+			n = dir_cache_list(h->cache, man_reply_msg,
+				MAN_MSG_LENGTH-1);
+		}
+		else {
+			n = sprintf(man_reply_msg, "0\n");
+		}
+		host_reply(h->man_port, h->man_port->tag, man_reply_msg, n);
+		break;
+
+	case 'p': // Sending ping request
+		// Create new ping request packet
+		sscanf(msg, "%d", &dst);
+		new_packet = packet_alloc(0);
+		new_packet->src = h->host_id;
+		new_packet->dst = dst;
+		new_packet->type = PKT_PING_REQ;
+		new_packet->length = 0;
+		new_job = (struct host_job *) 
 				malloc(sizeof(struct host_job));
-			new_job->in_port_index = k;
-			new_job->packet = in_packet;
+		new_job->packet = new_packet;
+		new_job->type = JOB_SEND_PKT_ALL_PORTS;
+		job_q_add(&h->job_q, new_job);
 
-			switch(in_packet->type) {
-				/* Consider the packet type */
+		new_job2 = (struct host_job *) 
+				malloc(sizeof(struct host_job));
+		h->ping_reply_received = 0;
+		h->ping_sent_at = timer_now_us();
+		new_job2->type = JOB_PING_WAIT_FOR_REPLY;
+		new_job2->ping_timer = 10;
+		new_job2->man_tag = h->man_port->tag;
+		job_q_add(&h->job_q, new_job2);
+
+		break;
+
+	case 'u': /* Upload a file to a host */
+		sscanf(msg, "%d %s", &dst, name);
+		job_q_add(&h->job_q, host_upload_job(dst, 0, name));
+		break;
+
+	case 'd': /* Download a file from a host */
+		/* 
+		 * Ask the host to upload the file to us
+		 */
+		sscanf(msg, "%d %s", &dst, name);
+		n = strlen(name);
+		new_packet = packet_alloc(n);
+		new_packet->src = h->host_id;
+		new_packet->dst = dst;
+		new_packet->type = PKT_FILE_DOWNLOAD_REQ;
+		new_packet->length = n;
+		memcpy(new_packet->payload, name, n);
+		job_q_add_send(&h->job_q, new_packet);
+		break;
+
+	case 'j': /* Join a multicast group */
+		if (sscanf(msg, "%d", &dst) == 1) {
+			host_mcast(h, dst, PKT_MCAST_JOIN);
+		}
+		break;
 
-				/* 
-				 * The next two packet types are 
-				 * the ping request and ping reply
-				 */
-				case (char) PKT_PING_REQ: 
-					new_job->type = JOB_PING_SEND_REPLY;
-					job_q_add(&job_q, new_job);
-					break;
+	case 'l': /* Leave a multicast group */
+		if (sscanf(msg, "%d", &dst) == 1) {
+			host_mcast(h, dst, PKT_MCAST_LEAVE);
+		}
+		break;
+
+	case 'f': /* Send a file to the i receivers of group dst */
+		if (sscanf(msg, "%d %d %s", &dst, &i, name) != 3) break;
+		if (dst < 0 || dst >= MCAST_GROUPS || i < 1) break;
+		job_q_add(&h->job_q,
+			host_upload_job(MCAST_ADDR(dst), i, name));
+		break;
+
+	case 'z': /* Turn upload compression on or off */
+		sscanf(msg, "%d", &h->compress);
+		break;
+
+	case 'x': /* Turn delta uploads on or off */
+		sscanf(msg, "%d", &h->delta);
+		break;
+
+	case 'y': /* Turn multipath striping on or off */
+		sscanf(msg, "%d", &h->stripe);
+		break;
+
+	case 'e': /* Set the weight of new uploads */
+		sscanf(msg, "%d", &h->weight);
+		if (h->weight < 1) h->weight = 1;
+		if (h->weight > SCHED_WEIGHT_MAX) {
+			h->weight = SCHED_WEIGHT_MAX;
+		}
+		break;
 
-				case (char) PKT_PING_REPLY:
-					ping_reply_received = 1;
-					free(in_packet);
-					free(new_job);
-					break;
+	case 'w': /* Set the transport window */
+		sscanf(msg, "%d", &h->tp_window);
+		if (h->tp_window < 1) h->tp_window = 1;
+		if (h->tp_window > TP_WINDOW_MAX) {
+			h->tp_window = TP_WINDOW_MAX;
+		}
+		break;
+	default:
+	;
+}
+}
 
-				/* 
-				 * The next two packet types
-				 * are for the upload file operation.
-				 *
-				 * The first type is the start packet
-				 * which includes the file name in
-				 * the payload.
-				 *
-				 * The second type is the end packet
-				 * which carries the content of the file
-				 * in its payload
-				 */
-		
-				case (char) PKT_FILE_UPLOAD_START:
-					new_job->type 
-						= JOB_FILE_UPLOAD_RECV_START;
-					job_q_add(&job_q, new_job);
-					break;
+/*
+ * Send packet p on port k, or on every port if k is -1.  In
+ * pipeline mode one copy is handed to the I/O thread, which is
+ * waited for if it is behind, and sent on the ports from there.
+ */
+static void host_send(struct host_state *h, int k, struct packet *p)
+{
+struct host_pipe_msg msg;
 
-				case (char) PKT_FILE_UPLOAD_END:
-					new_job->type 
-						= JOB_FILE_UPLOAD_RECV_END;
-					job_q_add(&job_q, new_job);
-					break;
-				default:
-					free(in_packet);
-					free(new_job);
-			}
+if (h->pipe == NULL) {
+	if (k >= 0) packet_send(h->node_port[k], p);
+	else for (k=0; k<h->node_port_num; k++) {
+		packet_send(h->node_port[k], p);
+	}
+	return;
+}
+while (memq_room(h->pipe->out_q) < sizeof(msg)) {
+	timer_sleep_until(timer_now_us() + HOST_RETRY_US);
+}
+msg.p = packet_dup(p);
+msg.port = k;
+msg.at = 0;
+memq_write(h->pipe->out_q, (char *) &msg, sizeof(msg));
+}
+
+/*
+ * Send the uploads' segments in the scheduler's order while the
+ * links they go out on have room, i.e. while what the links have
+ * queued goes out within HOST_SCHED_HOLD_US.  That is long enough
+ * that they do not run dry before the next pass.  In pipeline mode
+ * the links are the I/O thread's, so it is handed a few segments
+ * at a time and keeps to the same limit (host_pipe_sched()).
+ */
+static void host_sched_send(struct host_state *h)
+{
+struct host_pipe *hp = h->pipe;
+struct host_pipe_msg msg;
+struct sched_item *it;
+struct packet *p;
+int port;
+int k;
+
+if (hp != NULL) {
+	while (hp->sched_pushed - hp->sched_sent < HOST_PIPE_SCHED_MAX
+		&& memq_room(hp->sched_q) >= sizeof(msg)
+		&& (p = sched_remove(&h->sched, &port)) != NULL) {
+		msg.p = p;
+		msg.port = port;
+		msg.at = 0;
+		memq_write(hp->sched_q, (char *) &msg, sizeof(msg));
+		hp->sched_pushed++;
+	}
+	return;
+}
+
+while ((it = sched_peek(&h->sched)) != NULL) {
+	for (k=0; k<h->node_port_num; k++) {
+		if ((it->port < 0 || it->port == k)
+			&& packet_wait(h->node_port[k]) > HOST_SCHED_HOLD_US) {
+			return;
 		}
-		else {
-			free(in_packet);
+	}
+	p = sched_remove(&h->sched, &port);
+	if (port >= 0) {
+		packet_send(h->node_port[port], p);
+	}
+	else for (k=0; k<h->node_port_num; k++) {
+		packet_send(h->node_port[k], p);
+	}
+	free(p);
+}
+}
+
+/*
+ * The next packet for the host on this pass, with the port it came
+ * in on and when: one from each port in turn, or in pipeline mode
+ * those the I/O thread has taken in.  NULL when there are no more.
+ */
+static struct packet *host_recv(struct host_state *h, int *port,
+		long long *at)
+{
+struct host_pipe_msg msg;
+struct packet_view v;
+int k;
+
+if (h->pipe != NULL) {
+	while (h->recv_next < HOST_PIPE_RECV_MAX
+		&& memq_read(h->pipe->in_q, (char *) &msg, sizeof(msg)) > 0) {
+		h->recv_next++;
+		if (host_accepts(h, msg.p->dst)) {
+			*port = msg.port;
+			*at = msg.at;
+			return msg.p;
 		}
+		free(msg.p);
 	}
+	h->recv_next = 0;
+	return NULL;
+}
 
-	/*
- 	 * Execute one job in the job queue
- 	 */
+/*
+ * The packet is looked at where it lies in the port's
+ * rx buffer, and copied out only if it is for us
+ */
+while (h->recv_next < h->node_port_num) {
+	k = h->recv_next++;
+	packet_flush(h->node_port[k]);
+	if (packet_recv_view(h->node_port[k], &v) > 0
+		&& host_accepts(h, v.dst)) {
+		*port = k;
+		*at = timer_now_us();
+		return packet_view_dup(&v);
+	}
+}
+h->recv_next = 0;
+return NULL;
+}
 
-	if (job_q_num(&job_q) > 0) {
+/*
+ * Get packets from incoming links and translate to jobs
+ * Put jobs in job queue
+ */
+static void host_receive(struct host_state *h)
+{
+char string[MAX_FILE_NAME];
+struct packet *in_packet;
+struct host_job *new_job;
+struct tp_sender *tp;
+long long at;
+int k, n;
+
+while ((in_packet = host_recv(h, &k, &at)) != NULL) {
+	new_job = (struct host_job *) 
+		malloc(sizeof(struct host_job));
+	new_job->in_port_index = k;
+	new_job->packet = in_packet;
+
+	switch(in_packet->type) {
+		/* Consider the packet type */
+
+		/* 
+		 * The next two packet types are 
+		 * the ping request and ping reply
+		 */
+		case PKT_PING_REQ: 
+			new_job->type = JOB_PING_SEND_REPLY;
+			job_q_add(&h->job_q, new_job);
+			break;
 
-		/* Get a new job from the job queue */
-		new_job = job_q_remove(&job_q);
+		case PKT_PING_REPLY:
+			h->ping_reply_received = 1;
+			h->ping_rtt = at - h->ping_sent_at;
+			free(in_packet);
+			free(new_job);
+			break;
 
+		/* 
+		 * The next packet types are for the 
+		 * upload file operation, and are 
+		 * segments of the reliable transport.
+		 *
+		 * The start packet includes the file 
+		 * name in the payload.
+		 *
+		 * The data packets and the end packet
+		 * carry the content of the file in
+		 * their payload.
+		 */
+
+		case PKT_FILE_UPLOAD_START:
+		case PKT_FILE_UPLOAD_DATA:
+		case PKT_FILE_UPLOAD_END:
+			new_job->type = JOB_FILE_UPLOAD_RECV;
+			job_q_add(&h->job_q, new_job);
+			break;
 
-		/* Send packet on all ports */
-		switch(new_job->type) {
+		/*
+		 * Load test traffic is counted
+		 * as it arrives, for its delay
+		 */
+		case PKT_TRAFFIC:
+			traffic_sink_input(&h->sink_list, in_packet, at);
+			free(in_packet);
+			free(new_job);
+			break;
 
-		/* Send packets on all ports */	
-		case JOB_SEND_PKT_ALL_PORTS:
-			for (k=0; k<node_port_num; k++) {
-				packet_send(node_port[k], new_job->packet);
+		/*
+		 * Acks are handed to the sender
+		 * right away, which clocks out
+		 * the next segments
+		 */
+		case PKT_FILE_ACK:
+			tp = tp_sender_find(h->tp_send_list,
+				(int) in_packet->src,
+				tp_conn_id(in_packet));
+			if (tp != NULL) {
+				tp_sender_ack(tp, in_packet, at);
 			}
-			free(new_job->packet);
+			if (tp != NULL && tp->stripe != NULL) {
+				stripe_ack(tp->stripe, tp, k, at);
+			}
+			free(in_packet);
 			free(new_job);
 			break;
 
-		/* The next three jobs deal with the pinging process */
-		case JOB_PING_SEND_REPLY:
-			/* Send a ping reply packet */
+		/*
+		 * A download request is served by
+		 * uploading the file back, and a
+		 * request for a file's signatures
+		 * by uploading them
+		 */
+		case PKT_FILE_DOWNLOAD_REQ:
+		case PKT_FILE_SIG_REQ:
+			n = in_packet->length < MAX_FILE_NAME-1
+				? in_packet->length : MAX_FILE_NAME-1;
+			memcpy(string, in_packet->payload, n);
+			string[n] = '\0';
+			free(new_job);
+			new_job = host_upload_job(
+				(int) in_packet->src, 0, string);
+			new_job->send_sigs = 
+				in_packet->type == PKT_FILE_SIG_REQ;
+			free(in_packet);
+			job_q_add(&h->job_q, new_job);
+			break;
+		default:
+			free(in_packet);
+			free(new_job);
+	}
+}
+}
+
+/*
+ * One pass of the host's main loop: a command from the manager,
+ * a packet from each port, and one job from the job queue
+ */
+void host_poll(struct host_state *h)
+{
+char man_msg[MAN_MSG_LENGTH];
+char man_reply_msg[MAN_MSG_LENGTH];
+char man_cmd;
 
-			/* Create ping reply packet */
-			new_packet = (struct packet *) 
-				malloc(sizeof(struct packet));
-			new_packet->dst = new_job->packet->src;
-			new_packet->src = (char) host_id;
-			new_packet->type = PKT_PING_REPLY;
-			new_packet->length = 0;
+int i, k, n;
+int type;
+int m;
+long long now;
+long long raw;
+char name[MAX_FILE_NAME + sizeof(HOST_DELTA_SUFFIX)];
+char string[PKT_PAYLOAD_MAX+1]; 
+char chunk[LZ_CHUNK];
+int offer;
+int basis;
+int retry;
 
-			/* Create job for the ping reply */
-			new_job2 = (struct host_job *)
-				malloc(sizeof(struct host_job));
-			new_job2->type = JOB_SEND_PKT_ALL_PORTS;
-			new_job2->packet = new_packet;
+struct packet *new_packet;
 
-			/* Enter job in the job queue */
-			job_q_add(&job_q, new_job2);
+struct host_job *new_job;
+struct host_job *new_job2;
 
-			/* Free old packet and job memory space */
-			free(new_job->packet);
-			free(new_job);
-			break;
+struct tp_sender *tp;
+struct tp_receiver *tr;
+struct packet *tp_out[3*TP_WINDOW_MAX];
+struct lz_stream *zs;
+struct delta_sigs *sigs;
 
-		case JOB_PING_WAIT_FOR_REPLY:
-			/* Wait for a ping reply packet */
+/* Execute command from manager, if any */
 
-			if (ping_reply_received == 1) {
-				n = sprintf(man_reply_msg, "Ping acked!"); 
-				man_reply_msg[n] = '\0';
-				write(man_port->send_fd, man_reply_msg, n+1);
-				free(new_job);
-			}
-			else if (new_job->ping_timer > 1) {
-				new_job->ping_timer--;
-				job_q_add(&job_q, new_job);
-			}
-			else { /* Time out */
-				n = sprintf(man_reply_msg, "Ping time out!"); 
-				man_reply_msg[n] = '\0';
-				write(man_port->send_fd, man_reply_msg, n+1);
-				free(new_job);
-			}
+	/* Get command from manager */
+n = get_man_command(h->man_port, man_msg, &man_cmd);
 
-			break;	
-
-
-		/* The next three jobs deal with uploading a file */
-
-			/* This job is for the sending host */
-		case JOB_FILE_UPLOAD_SEND:
-
-			/* Open file */
-			if (dir_valid == 1) {
-				n = sprintf(name, "./%s/%s", 
-					dir, new_job->fname_upload);
-				name[n] = '\0';
-				fp = fopen(name, "r");
-				if (fp != NULL) {
-
-				        /* 
-					 * Create first packet which
-					 * has the file name 
-					 */
-					new_packet = (struct packet *) 
-						malloc(sizeof(struct packet));
-					new_packet->dst 
-						= new_job->file_upload_dst;
-					new_packet->src = (char) host_id;
-					new_packet->type 
-						= PKT_FILE_UPLOAD_START;
-					for (i=0; 
-						new_job->fname_upload[i]!= '\0'; 
-						i++) {
-						new_packet->payload[i] = 
-							new_job->fname_upload[i];
-					}
-					new_packet->length = i;
-
-					/* 
-					 * Create a job to send the packet
-					 * and put it in the job queue
-					 */
-					new_job2 = (struct host_job *)
-						malloc(sizeof(struct host_job));
-					new_job2->type = JOB_SEND_PKT_ALL_PORTS;
-					new_job2->packet = new_packet;
-					job_q_add(&job_q, new_job2);
-
-					/* 
-					 * Create the second packet which
-					 * has the file contents
-					 */
-					new_packet = (struct packet *) 
-						malloc(sizeof(struct packet));
-					new_packet->dst 
-						= new_job->file_upload_dst;
-					new_packet->src = (char) host_id;
-					new_packet->type = PKT_FILE_UPLOAD_END;
-
-
-					n = fread(string,sizeof(char),
-						PKT_PAYLOAD_MAX, fp);
-					fclose(fp);
-					string[n] = '\0';
-
-					for (i=0; i<n; i++) {
-						new_packet->payload[i] 
-							= string[i];
-					}
+	/* Execute command */
+if (n>0) {
+	host_command(h, man_cmd, man_msg);
+}
 
-					new_packet->length = n;
+/* Catch up with changes to the directory */
+if (h->cache != NULL) dir_cache_refresh(h->cache);
+	
+/* Packets from the ports become jobs */
+host_receive(h);
 
-					/*
-					 * Create a job to send the packet
-					 * and put the job in the job queue
-					 */
+/*
+ 	 * Execute one job in the job queue
+ 	 */
 
-					new_job2 = (struct host_job *)
-						malloc(sizeof(struct host_job));
-					new_job2->type 
-						= JOB_SEND_PKT_ALL_PORTS;
-					new_job2->packet = new_packet;
-					job_q_add(&job_q, new_job2);
+if (job_q_num(&h->job_q) > 0) {
 
-					free(new_job);
-				}
-				else {  
-					/* Didn't open file */
-				}
-			}
-			break;
+	/* Get a new job from the job queue */
+	new_job = job_q_remove(&h->job_q);
 
-			/* The next two jobs are for the receving host */
 
-		case JOB_FILE_UPLOAD_RECV_START:
+	/* Send packet on all ports */
+	switch(new_job->type) {
 
-			/* Initialize the file buffer data structure */
-			file_buf_init(&f_buf_upload);
+	/* Send packets on all ports */	
+	case JOB_SEND_PKT_ALL_PORTS:
+		host_send(h, -1, new_job->packet);
+		free(new_job->packet);
+		free(new_job);
+		break;
 
-			/* 
-			 * Transfer the file name in the packet payload
-			 * to the file buffer data structure
-			 */
-			file_buf_put_name(&f_buf_upload, 
-				new_job->packet->payload, 
-				new_job->packet->length);
+	/* The next three jobs deal with the pinging process */
+	case JOB_PING_SEND_REPLY:
+		/* Send a ping reply packet */
 
-			free(new_job->packet);
+		/* Create ping reply packet */
+		new_packet = packet_alloc(0);
+		new_packet->dst = new_job->packet->src;
+		new_packet->src = h->host_id;
+		new_packet->type = PKT_PING_REPLY;
+		new_packet->length = 0;
+
+		/* Create job for the ping reply */
+		new_job2 = (struct host_job *)
+			malloc(sizeof(struct host_job));
+		new_job2->type = JOB_SEND_PKT_ALL_PORTS;
+		new_job2->packet = new_packet;
+
+		/* Enter job in the job queue */
+		job_q_add(&h->job_q, new_job2);
+
+		/* Free old packet and job memory space */
+		free(new_job->packet);
+		free(new_job);
+		break;
+
+	case JOB_PING_WAIT_FOR_REPLY:
+		/* Wait for a ping reply packet */
+
+		if (h->ping_reply_received == 1) {
+			n = sprintf(man_reply_msg, "Ping acked! rtt=%.3f ms",
+				h->ping_rtt / 1000.0);
+			man_reply_msg[n] = '\0';
+			host_reply(h->man_port, new_job->man_tag,
+				man_reply_msg, n);
+			free(new_job);
+		}
+		else if (new_job->ping_timer > 1) {
+			new_job->ping_timer--;
+			job_q_add(&h->job_q, new_job);
+		}
+		else { /* Time out */
+			n = sprintf(man_reply_msg, "Ping time out!"); 
+			man_reply_msg[n] = '\0';
+			host_reply(h->man_port, new_job->man_tag,
+				man_reply_msg, n);
 			free(new_job);
+		}
+
+		break;	
+
+
+	/* The next two jobs deal with uploading a file */
+
+		/* This job is for the sending host */
+	case JOB_FILE_UPLOAD_SEND:
+
+		/*
+		 * The job stays in the job queue until the
+		 * transfer is acknowledged.  The first time
+		 * it runs it opens the file and the transport
+		 * connection, and queues the start segment
+		 * with the options we offer and the file name.
+		 *
+		 * A delta upload first asks the receiver for
+		 * the signatures of its copy, and waits for
+		 * them a while before it starts.  Signatures
+		 * are sent in place of the file they are of,
+		 * and there are some even if it is missing.
+		 */
+		if (new_job->tp == NULL && h->delta
+			&& !new_job->send_sigs && !new_job->whole
+			&& new_job->file_upload_peers == 0
+			&& new_job->sigs_wait == 0) {
+			n = strlen(new_job->fname_upload);
+			new_packet = packet_alloc(n);
+			new_packet->src = h->host_id;
+			new_packet->dst = new_job->file_upload_dst;
+			new_packet->type = PKT_FILE_SIG_REQ;
+			memcpy(new_packet->payload, 
+				new_job->fname_upload, n);
+			new_packet->length = n;
+			host_send(h, -1, new_packet);
+			free(new_packet);
+			new_job->sigs_wait = timer_now_us() 
+				+ HOST_SIG_WAIT_US;
+			job_q_add(&h->job_q, new_job);
 			break;
+		}
+		if (new_job->tp == NULL) {
+			sigs = NULL;
+			if (new_job->sigs_wait > 0) {
+				sigs = host_take_sigs(h, 
+					new_job->file_upload_dst,
+					new_job->fname_upload);
+				if (sigs == NULL 
+				&& timer_now_us() < new_job->sigs_wait) {
+					job_q_add(&h->job_q, new_job);
+					break;
+				}
+			}
+			if (h->cache != NULL) {
+				new_job->fd = dir_cache_read_fd(h->cache,
+					new_job->fname_upload);
+			}
+			if (new_job->send_sigs) {
+				new_job->sigs_len = delta_sign(new_job->fd,
+					&new_job->sigs);
+				if (new_job->fd >= 0) close(new_job->fd);
+				new_job->fd = -1;
+			}
+			else if (new_job->fd < 0) { /* No such file */
+				if (sigs != NULL) delta_sigs_free(sigs);
+				free(new_job);
+				break;
+			}
+			if (sigs != NULL && sigs->num == 0) {
+				delta_sigs_free(sigs);	/* No copy */
+			}
+			else if (sigs != NULL) {
+				new_job->dz = delta_enc_create(sigs,
+					new_job->fd);
+			}
 
-		case JOB_FILE_UPLOAD_RECV_END:
+			tp = (struct tp_sender *) 
+				malloc(sizeof(struct tp_sender));
+			tp_sender_init(tp, h->host_id, 
+				new_job->file_upload_dst,
+				h->tp_next_conn, h->tp_window, 
+				h->seg_max);
+			if (new_job->file_upload_peers > 0) {
+				tp_sender_multicast(tp, 
+					new_job->file_upload_peers);
+			}
+			/*
+			 * A striped upload's segments can
+			 * arrive out of order, which must
+			 * not pass for loss
+			 */
+			else if (h->stripe && h->node_port_num > 1) {
+				tp->stripe = (struct stripe *)
+					malloc(sizeof(struct stripe));
+				stripe_init(tp->stripe, h->node_port_num);
+				tp_sender_reorder(tp, tp->window / 2);
+			}
+			h->tp_next_conn = h->tp_next_conn % TP_CONN_MAX + 1;
+			tp->next = h->tp_send_list;
+			h->tp_send_list = tp;
+
+			new_job->offer = h->compress && !new_job->whole
+				? LZ_CODECS : LZ_CODEC_NONE;
+			if (new_job->dz != NULL) {
+				new_job->offer |= DELTA_OPT;
+			}
+			if (new_job->send_sigs) {
+				new_job->offer |= DELTA_SIGS;
+			}
+			string[0] = (char) new_job->offer;
+			n = strlen(new_job->fname_upload);
+			if (n > h->seg_max - 1) n = h->seg_max - 1;
+			memcpy(string+1, new_job->fname_upload, n);
+			tp_sender_queue(tp, PKT_FILE_UPLOAD_START,
+				string, n+1);
+
+			new_job->tp = tp;
+			new_job->flow = (struct sched_flow *)
+				malloc(sizeof(struct sched_flow));
+			sched_flow_init(new_job->flow, h->weight);
+			new_job->zs = (struct lz_stream *)
+				malloc(sizeof(struct lz_stream));
+			lz_stream_init(new_job->zs);
+			new_job->start_us = timer_now_us();
+		}
+		tp = new_job->tp;
+		zs = new_job->zs;
+
+		/* 
+		 * Fill the window.  The file is read a chunk 
+		 * at a time into the stream, compressed once
+		 * the receiver has accepted the codec, and 
+		 * the stream is cut into segments.  The last 
+		 * of it goes out in the end segment.  When we
+		 * offered a codec or a delta, nothing is read
+		 * until the start segment is acked, so that the
+		 * whole file goes out as the receiver accepted.
+		 */
+		while (tp_sender_space(tp) > 0 
+			&& ((new_job->offer & (LZ_CODECS | DELTA_OPT)) == 0
+				|| tp->snd_una > 0)) {
+			if (zs->len < h->seg_max && !new_job->eof) {
+				n = host_upload_read(new_job, 
+					tp->peer_opts, chunk);
+				if (n > 0) {
+					lz_stream_put_chunk(zs, chunk, n,
+						tp->peer_opts & LZ_CODEC_LZ);
+				}
+				continue;
+			}
+			n = lz_stream_get(zs, string, h->seg_max);
+			if (new_job->eof && zs->len == 0) {
+				tp_sender_queue(tp, 
+					PKT_FILE_UPLOAD_END, string, n);
+			}
+			else {
+				tp_sender_queue(tp, 
+					PKT_FILE_UPLOAD_DATA, string, n);
+			}
+		}
 
+		/* 
+		 * Queue new segments and retransmissions for the
+		 * scheduler, together so a full window is in
+		 * flight, for every port or, striped, the one
+		 * picked.
+		 */
+		n = tp_sender_poll(tp, timer_now_us(), 
+			tp_out, 3*TP_WINDOW_MAX);
+		for (i=0; i<n; i++) {
+			k = tp->stripe != NULL ? stripe_pick(tp->stripe,
+				tp, tp_out[i], timer_now_us()) : -1;
+			sched_add(&h->sched, new_job->flow, tp_out[i], k);
+		}
+
+		if (tp_sender_done(tp) || tp_sender_failed(tp)) {
 			/* 
-			 * Download packet payload into file buffer 
-			 * data structure 
+			 * Report how the transfer went.  The bytes
+			 * of a delta are those of the file.
 			 */
-			file_buf_add(&f_buf_upload, 
-				new_job->packet->payload,
-				new_job->packet->length);
+			now = timer_now_us() - new_job->start_us;
+			retry = tp_sender_done(tp) && !new_job->whole
+				&& tp->peers == 0
+				&& (tp->peer_opts & LZ_STREAM_FAIL);
+			raw = new_job->dz != NULL 
+				? delta_enc_bytes(new_job->dz) 
+				: zs->raw_bytes;
+			if (!new_job->send_sigs) {
+				printf("Host %d: %s %s to %s %d, "
+				"%lld bytes, %ld in stream (ratio %.2f), "
+				"%.2f s, %.1f KB/s, %ld retransmits",
+				h->host_id,
+				tp_sender_done(tp) ? "sent" : "gave up on",
+				new_job->fname_upload, 
+				tp->peers > 0 ? "group" : "host",
+				tp->peers > 0 ? tp->dst - MCAST_BASE : tp->dst,
+				raw, zs->wire_bytes,
+				zs->wire_bytes > 0 ? (double) 
+				raw / zs->wire_bytes : 1.0,
+				now / 1e6, 
+				raw / 1024.0 / (now / 1e6),
+				tp->segs_retx);
+				if (new_job->dz != NULL) {
+					printf(", delta with %lld bytes "
+						"from the receiver's copy",
+						delta_enc_matched(new_job->dz));
+				}
+				if (retry && new_job->dz != NULL) {
+					printf(", which did not check out "
+						"there; sending the whole file");
+				}
+				else if (retry) {
+					printf(", which did not decode "
+						"there; sending it as it is");
+				}
+				if (tp->stripe != NULL) {
+					stripe_report(tp->stripe, string);
+					printf(", striped (sent/lost "
+						"per port) %s", string);
+				}
+				printf("\n");
+				fflush(stdout);
+			}
 
+			/* The receiver could not rebuild it: again */
+			if (retry) {
+				new_job2 = host_upload_job(tp->dst, 0,
+					new_job->fname_upload);
+				new_job2->whole = 1;
+				job_q_add(&h->job_q, new_job2);
+			}
+			if (new_job->fd >= 0) close(new_job->fd);
+			if (new_job->dz != NULL) delta_enc_free(new_job->dz);
+			free(new_job->sigs);
+			free(tp->stripe);
+			sched_flow_drop(&h->sched, new_job->flow);
+			free(new_job->flow);
+			tp_sender_remove(&h->tp_send_list, tp);
+			free(new_job->zs);
+			free(new_job);
+		}
+		else {
+			job_q_add(&h->job_q, new_job);
+		}
+		break;
+
+		/*
+		 * A load test.  The job stays in the queue until
+		 * its time is up, and each time it runs it sends
+		 * the packets that have fallen due, up to a burst.
+		 */
+	case JOB_TRAFFIC_GEN:
+		now = timer_now_us();
+		for (i=0; i<TRAFFIC_BURST
+			&& traffic_gen_next(new_job->gen, now,
+				new_job->packet); i++) {
+			host_send(h, -1, new_job->packet);
+		}
+		if (traffic_gen_done(new_job->gen, now)) {
+			now -= new_job->gen->start_us;
+			printf("Host %d: generated %ld packets, %ld bytes "
+				"to %d hosts in %.2f s, %.1f packets/s, "
+				"%.1f KB/s\n", h->host_id,
+				new_job->gen->sent, new_job->gen->bytes,
+				new_job->gen->dst_num, now / 1e6,
+				new_job->gen->sent / (now / 1e6),
+				new_job->gen->bytes / 1024.0 / (now / 1e6));
+			fflush(stdout);
+			free(new_job->gen);
 			free(new_job->packet);
 			free(new_job);
-
-			if (dir_valid == 1) {
-
-				/* 
-				 * Get file name from the file buffer 
-				 * Then open the file
+		}
+		else {
+			job_q_add(&h->job_q, new_job);
+		}
+		break;
+
+		/* This job is for the receving host */
+
+	case JOB_FILE_UPLOAD_RECV:
+
+		now = timer_now_us();
+		tr = tp_receiver_find(h->tp_recv_list, 
+			(int) new_job->packet->src,
+			tp_conn_id(new_job->packet));
+		if (tr == NULL) {
+			tr = (struct tp_receiver *) 
+				malloc(sizeof(struct tp_receiver));
+			tp_receiver_init(tr, h->host_id, 
+				(int) new_job->packet->src,
+				tp_conn_id(new_job->packet));
+			tr->next = h->tp_recv_list;
+			h->tp_recv_list = tr;
+		}
+		tp_receiver_input(tr, new_job->packet, now);
+
+		/* 
+		 * Consume the segments that are now in order.
+		 * The start segment has the codecs offered and
+		 * the file name, and opens the file.  The others
+		 * carry the chunk stream.  Each chunk is decoded
+		 * as soon as it is complete and goes through the
+		 * file buffer into the file.
+		 */
+		while ((n = tp_receiver_deliver(tr, &type, string)) >= 0) {
+			if (type == PKT_FILE_UPLOAD_START) {
+				offer = string[0];
+				tr->opts = offer & LZ_CODECS;
+				tr->zs = (struct lz_stream *)
+					malloc(sizeof(struct lz_stream));
+				lz_stream_init(tr->zs);
+				file_buf_init(&h->f_buf_upload);
+				file_buf_put_name(&h->f_buf_upload, 
+					string+1, n-1);
+				file_buf_get_name(&h->f_buf_upload, string);
+				if (offer & DELTA_SIGS) {
+					tr->sigs = delta_sigs_create(
+						tr->peer, string);
+					continue;
+				}
+				if (h->cache == NULL) continue;
+				/*
+				 * A delta is taken if we still have
+				 * the copy it is against, and the file
+				 * is rebuilt beside it
 				 */
-				file_buf_get_name(&f_buf_upload, string);
-				n = sprintf(name, "./%s/%s", dir, string);
-				name[n] = '\0';
-				fp = fopen(name, "w");
-
-				if (fp != NULL) {
-					/* 
-					 * Write contents in the file
-					 * buffer into file
-					 */
-
-					while (f_buf_upload.occ > 0) {
+				basis = -1;
+				if (offer & DELTA_OPT) {
+					basis = dir_cache_read_fd(h->cache,
+						string);
+				}
+				if (basis >= 0) {
+					tr->opts |= DELTA_OPT;
+					snprintf(name, sizeof(name), "%s%s",
+						string, HOST_DELTA_SUFFIX);
+					tr->fp = dir_cache_create(h->cache,
+						name);
+					tr->dd = delta_dec_create(basis,
+						tr->fp, string);
+				}
+				else {
+					tr->fp = dir_cache_create(h->cache,
+						string);
+					tr->fname = strdup(string);
+				}
+				continue;
+			}
+
+			lz_stream_append(tr->zs, string, n);
+			while ((m = lz_stream_next_chunk(tr->zs, chunk)) > 0) {
+				if (tr->sigs != NULL) {
+					delta_sigs_append(tr->sigs, chunk, m);
+					continue;
+				}
+				if (tr->dd != NULL) {
+					if (delta_dec_chunk(tr->dd, 
+							chunk, m) < 0) {
+						m = -1;
+						break;
+					}
+					continue;
+				}
+				for (i=0; i<m; ) {
+					i += file_buf_add(&h->f_buf_upload, 
+						chunk+i, m-i);
+					while (h->f_buf_upload.occ > 0) {
 						n = file_buf_remove(
-							&f_buf_upload, 
-							string,
+							&h->f_buf_upload, 
+							string, 
 							PKT_PAYLOAD_MAX);
-						string[n] = '\0';
-						n = fwrite(string,
-							sizeof(char),
-							n, 
-							fp);
+						if (tr->fp != NULL) {
+							fwrite(string, 
+							sizeof(char), 
+							n, tr->fp);
+						}
 					}
-
-					fclose(fp);
-				}	
+				}
+			}
+			if (m < 0) { /* Corrupt stream */
+				host_recv_close(h, tr, 0);
+			}
+			if (type == PKT_FILE_UPLOAD_END) {
+				host_recv_close(h, tr, 1);
 			}
-
-			break;
 		}
 
+		/* 
+		 * Acknowledge what we have.  The ack goes out 
+		 * right away rather than through the job queue,
+		 * so it keeps pace with the arriving segments.
+		 */
+		new_packet = tp_receiver_ack(tr);
+		host_send(h, -1, new_packet);
+		free(new_packet);
+
+		free(new_job->packet);
+		free(new_job);
+		break;
 	}
 
+}
 
-	/* The host goes to sleep for 10 ms */
-	usleep(TENMILLISEC);
+host_sched_send(h);
 
-} /* End of while loop */
+/* Forget transfers that have gone quiet */
+tp_receiver_expire(&h->tp_recv_list, timer_now_us());
 
 }
 
+/*
+ *  Main 
+ */
 
+void host_main(int host_id)
+{
+host_run(host_create(host_id));
+}
 
+/*
+ * Send the upload segments the worker has handed over, in its
+ * order, while the links have room (see host_sched_send())
+ */
+static void host_pipe_sched(struct host_state *h)
+{
+struct host_pipe *hp = h->pipe;
+int k;
+
+while (hp->held.p != NULL
+	|| memq_read(hp->sched_q, (char *) &hp->held, sizeof(hp->held)) > 0) {
+	for (k=0; k<h->node_port_num; k++) {
+		if ((hp->held.port < 0 || hp->held.port == k)
+			&& packet_wait(h->node_port[k]) > HOST_SCHED_HOLD_US) {
+			return;
+		}
+	}
+	if (hp->held.port >= 0) {
+		packet_send(h->node_port[hp->held.port], hp->held.p);
+	}
+	else for (k=0; k<h->node_port_num; k++) {
+		packet_send(h->node_port[k], hp->held.p);
+	}
+	free(hp->held.p);
+	hp->held.p = NULL;
+	hp->sched_sent++;
+}
+}
+
+/* Publish the ports' counters for the worker (host_stats_ports()) */
+static void host_pipe_publish(struct host_state *h)
+{
+struct host_pipe_stats *st;
+struct net_port *p;
+int k;
+
+for (k=0; k<h->node_port_num; k++) {
+	st = &h->pipe->stats[k];
+	p = h->node_port[k];
+	st->tx_packets = p->tx_packets;
+	st->rx_packets = p->rx_packets;
+	st->tx_bytes = p->tx_bytes;
+	st->rx_bytes = p->rx_bytes;
+	st->drops = p->tx_drops + p->rx_drops;
+	st->crc_errors = p->crc_errors;
+	st->tx_len = p->tx_len;
+	st->rx_len = p->rx_len;
+}
+}
+
+/*
+ * A pass of the I/O thread: send what the worker has handed over,
+ * and take in the packets for the host while the worker has room
+ * for them.  Multicast packets are all passed on, as the worker
+ * keeps the groups.
+ */
+static void host_pipe_io(struct host_state *h)
+{
+struct host_pipe *hp = h->pipe;
+struct host_pipe_msg msg;
+struct packet_view v;
+int i, k;
+
+while (memq_read(hp->out_q, (char *) &msg, sizeof(msg)) > 0) {
+	if (msg.port >= 0) packet_send(h->node_port[msg.port], msg.p);
+	else for (k=0; k<h->node_port_num; k++) {
+		packet_send(h->node_port[k], msg.p);
+	}
+	free(msg.p);
+}
+host_pipe_sched(h);
+
+for (k=0; k<h->node_port_num; k++) {
+	packet_flush(h->node_port[k]);
+	for (i=0; i<HOST_PIPE_RECV_MAX
+		&& memq_room(hp->in_q) >= sizeof(msg); i++) {
+		if (packet_recv_view(h->node_port[k], &v) <= 0) break;
+		if (v.dst != h->host_id && v.dst != BCAST_ADDR
+			&& !IS_MCAST(v.dst)) {
+			continue;
+		}
+		msg.p = packet_view_dup(&v);
+		msg.port = k;
+		msg.at = timer_now_us();
+		memq_write(hp->in_q, (char *) &msg, sizeof(msg));
+	}
+}
+host_pipe_publish(h);
+}
+
+/*
+ * The worker thread: a pass of the host loop every 10 ms, as
+ * host_run() does, and in between, every HOST_PIPE_POLL_US, the
+ * packets taken in and the segments the links have room for
+ */
+static void *host_pipe_worker(void *arg)
+{
+struct host_state *h = (struct host_state *) arg;
+long long next_pass;
+long long now;
+long long wake;
+
+next_pass = timer_now_us();
+while (1) {
+	now = timer_now_us();
+	if (now >= next_pass) {
+		host_poll(h);
+		next_pass = now + TENMILLISEC;
+	}
+	else {
+		host_receive(h);
+		host_sched_send(h);
+	}
+	wake = now + HOST_PIPE_POLL_US;
+	timer_sleep_until(wake < next_pass ? wake : next_pass);
+}
+return NULL;
+}
+
+void host_run(struct host_state *h)
+{
+long long loop_start;
+long long wake;
+long long now;
+long long t;
+long long period = TENMILLISEC;
+pthread_t tid;
+int k;
+
+/* In pipeline mode this thread is the I/O thread */
+if (h->pipe != NULL) {
+	if (pthread_create(&tid, NULL, host_pipe_worker, h) == 0) {
+		pthread_detach(tid);
+		period = HOST_PIPE_POLL_US;
+	}
+	else {
+		printf("Host %d: no worker thread, running as one\n",
+			h->host_id);
+		h->pipe = NULL;
+	}
+}
 
+while(1) {
+	loop_start = timer_now_us();
+
+	if (h->pipe != NULL) host_pipe_io(h);
+	else host_poll(h);
+	if (h->ring != NULL) uring_submit(h->ring);
+
+	/*
+	 * The host sleeps until 10 ms after the start of the loop,
+	 * or its I/O thread until HOST_PIPE_POLL_US after.
+	 * Frames that link emulation releases in the meantime are
+	 * written to their pipes on time rather than at the next
+	 * loop, so a link's delay is not rounded up to 10 ms.
+	 * One that finds its pipe full is tried again a little
+	 * later, rather than spun on until the end of the loop.
+	 */
+	while (1) {
+		wake = loop_start + period;
+		now = timer_now_us();
+		for (k=0; k<h->node_port_num; k++) {
+			t = packet_next_release(h->node_port[k]);
+			if (t >= 0 && t <= now) {
+				/* Due; if the pipe is full, retry later */
+				packet_flush(h->node_port[k]);
+				t = packet_next_release(h->node_port[k]);
+				if (t >= 0 && t <= now) {	/* Pipe full */
+					t = now + HOST_RETRY_US;
+				}
+			}
+			if (t >= 0 && t < wake) wake = t;
+		}
+		timer_sleep_until(wake);
+		if (wake >= loop_start + period) break;
+		for (k=0; k<h->node_port_num; k++) {
+			packet_flush(h->node_port[k]);
+		}
+		if (h->ring != NULL) uring_submit(h->ring);
+	}
+
+} /* End of while loop */
+
+}
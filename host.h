@@ -8,8 +8,8 @@ enum host_job_type {
 	JOB_PING_SEND_REPLY,
 	JOB_PING_WAIT_FOR_REPLY,
 	JOB_FILE_UPLOAD_SEND,
-	JOB_FILE_UPLOAD_RECV_START,
-	JOB_FILE_UPLOAD_RECV_END
+	JOB_FILE_UPLOAD_RECV,
+	JOB_TRAFFIC_GEN
 };
 
 struct host_job {
@@ -20,7 +20,24 @@ struct host_job {
 	char fname_download[100];
 	char fname_upload[100];
 	int ping_timer;
+	int man_tag;		/* Of the manager's command it answers */
 	int file_upload_dst;
+	int file_upload_peers;	/* Receivers, if dst is a multicast group */
+	struct tp_sender *tp;	/* Transport state of an upload */
+	int fd;			/* File being uploaded, or -1 */
+	long long offset;	/* Bytes of it read */
+	int eof;		/* All of it is in the stream */
+	int offer;		/* Options offered in the start segment */
+	int send_sigs;		/* Send the file's signatures, not the file */
+	char *sigs;		/*    which are these */
+	int sigs_len;
+	long long sigs_wait;	/* Wait until then for the receiver's */
+	struct delta_enc *dz;	/* Delta of the file against them */
+	int whole;		/* Send the file as it is: no delta, no codec */
+	struct lz_stream *zs;	/* Chunk stream of an upload */
+	struct sched_flow *flow;	/* Its segments waiting to go out */
+	long long start_us;	/* When the upload started */
+	struct traffic_gen *gen;	/* Generator of a load test */
 	struct host_job *next;
 };
 
@@ -31,6 +48,67 @@ struct job_queue {
 	int occ;
 };
 
+/* Job queue operations, in host.c */
+void job_q_init(struct job_queue *j_q);
+void job_q_add(struct job_queue *j_q, struct host_job *j);
+struct host_job *job_q_remove(struct job_queue *j_q);
+int job_q_num(struct job_queue *j_q);
+
+#define MAX_FILE_BUFFER 1000
+#define MAX_FILE_NAME 100
+
+/* A ring of bytes on their way between a file and the network */
+struct file_buf {
+	char name[MAX_FILE_NAME];
+	int name_length;
+	char buffer[MAX_FILE_BUFFER+1];
+	int head;
+	int tail;
+	int occ;
+	FILE *fd;
+};
+
+void file_buf_init(struct file_buf *f);
+
+/* Add up to 'length' bytes; returns how many fit */
+int file_buf_add(struct file_buf *f, char string[], int length);
+
+/* Take up to 'length' bytes; returns how many there were */
+int file_buf_remove(struct file_buf *f, char string[], int length);
+
+/*
+ * A host is a state machine.  host_main() runs one as a process,
+ * polling it every 10 ms; the simulator (sim.c) polls many of them
+ * in virtual time.
+ */
+struct host_state;
+
+struct host_state *host_create(int host_id);
+
+/* One pass of the host loop */
+void host_poll(struct host_state *h);
+
+/* Carry out a manager command, e.g. cmd 'u' with msg "3 file" */
+void host_command(struct host_state *h, char cmd, char msg[]);
+
+/* The host has work in progress and should be polled again soon */
+int host_busy(struct host_state *h);
+
+/* The host's network ports */
+struct net_port **host_ports(struct host_state *h, int *num);
+
+/* Hosts created from now on do their pipe I/O through io_uring */
+void host_use_uring();
+
+/*
+ * Hosts created from now on run in pipeline mode: host_run() keeps
+ * the ports in one thread and runs the jobs in another
+ */
+void host_use_pipeline();
+
+/* Run the host loop in real time, forever */
+void host_run(struct host_state *h);
+
 void host_main(int host_id);
 
 
@@ -0,0 +1,276 @@
+/*
+ * lz.c
+ *
+ * LZ77 codec in the style of LZ4, and the chunked stream used
+ * by file transfers.
+ *
+ * Compressed data is a list of sequences.  Each sequence is a token
+ * byte whose high nibble is the literal count and low nibble the
+ * match length minus 4 (15 means more length bytes follow, each
+ * adding up to 255), the literals, then a 2-byte match offset.
+ * The last sequence has literals only.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+#include "lz.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+
+static unsigned int lz_read32(const char *p)
+{
+unsigned int v;
+
+memcpy(&v, p, 4);
+return v;
+}
+
+static int lz_hash(unsigned int v)
+{
+return (int) ((v * 2654435761u) >> (32 - LZ_HASH_BITS));
+}
+
+/* Write a length that did not fit in the token nibble */
+static char *lz_put_length(char *op, int len)
+{
+while (len >= 255) {
+	*op++ = (char) 255;
+	len -= 255;
+}
+*op++ = (char) len;
+return op;
+}
+
+/* Emit a sequence.  Returns NULL if dst would overflow */
+static char *lz_put_sequence(char *op, char *oend, const char *lit,
+		int lit_len, int match_len, int offset)
+{
+char *token;
+int ml;
+
+if (op + 1 + lit_len + lit_len/255 + 1 + 2 + match_len/255 + 1 > oend) {
+	return NULL;
+}
+token = op++;
+*token = (char) ((lit_len >= 15 ? 15 : lit_len) << 4);
+if (lit_len >= 15) op = lz_put_length(op, lit_len - 15);
+memcpy(op, lit, lit_len);
+op += lit_len;
+
+if (match_len > 0) {
+	op[0] = (char) (offset & 0xff);
+	op[1] = (char) (offset >> 8);
+	op += 2;
+	ml = match_len - LZ_MIN_MATCH;
+	*token |= (char) (ml >= 15 ? 15 : ml);
+	if (ml >= 15) op = lz_put_length(op, ml - 15);
+}
+return op;
+}
+
+int lz_compress(const char *src, int n, char *dst, int cap)
+{
+int table[1 << LZ_HASH_BITS];
+char *op = dst;
+char *oend = dst + cap;
+int anchor = 0;
+int ip = 0;
+int ref;
+int len;
+int h;
+
+for (h=0; h < (1 << LZ_HASH_BITS); h++) table[h] = -1;
+
+while (ip + LZ_MIN_MATCH <= n) {
+	h = lz_hash(lz_read32(src + ip));
+	ref = table[h];
+	table[h] = ip;
+	if (ref < 0 || ip - ref > LZ_MAX_OFFSET
+			|| lz_read32(src + ref) != lz_read32(src + ip)) {
+		ip++;
+		continue;
+	}
+
+	len = LZ_MIN_MATCH;
+	while (ip + len < n && src[ref + len] == src[ip + len]) len++;
+
+	op = lz_put_sequence(op, oend, src + anchor, ip - anchor,
+		len, ip - ref);
+	if (op == NULL) return 0;
+	ip += len;
+	anchor = ip;
+}
+
+op = lz_put_sequence(op, oend, src + anchor, n - anchor, 0, 0);
+if (op == NULL) return 0;
+return (int) (op - dst);
+}
+
+/* Read an extended length.  Returns -1 if the input runs out */
+static int lz_get_length(const unsigned char **ip, const unsigned char *iend)
+{
+int len = 0;
+int b;
+
+do {
+	if (*ip >= iend) return -1;
+	b = *(*ip)++;
+	len += b;
+} while (b == 255);
+return len;
+}
+
+int lz_decompress(const char *src, int n, char *dst, int cap)
+{
+const unsigned char *ip = (const unsigned char *) src;
+const unsigned char *iend = ip + n;
+int op = 0;
+int token;
+int lit_len;
+int match_len;
+int offset;
+int k;
+
+while (ip < iend) {
+	token = *ip++;
+
+	lit_len = token >> 4;
+	if (lit_len == 15) {
+		k = lz_get_length(&ip, iend);
+		if (k < 0) return -1;
+		lit_len += k;
+	}
+	if (lit_len > iend - ip || lit_len > cap - op) return -1;
+	memcpy(dst + op, ip, lit_len);
+	ip += lit_len;
+	op += lit_len;
+
+	if (ip == iend) break;	/* Last sequence */
+
+	if (iend - ip < 2) return -1;
+	offset = ip[0] | (ip[1] << 8);
+	ip += 2;
+	match_len = (token & 15) + LZ_MIN_MATCH;
+	if ((token & 15) == 15) {
+		k = lz_get_length(&ip, iend);
+		if (k < 0) return -1;
+		match_len += k;
+	}
+	if (offset == 0 || offset > op || match_len > cap - op) return -1;
+
+	/* Byte by byte, since the match may overlap the output */
+	for (k=0; k<match_len; k++) {
+		dst[op+k] = dst[op-offset+k];
+	}
+	op += match_len;
+}
+return op;
+}
+
+
+/*
+ * Chunked stream
+ */
+
+void lz_stream_init(struct lz_stream *z)
+{
+z->head = 0;
+z->len = 0;
+z->raw_bytes = 0;
+z->wire_bytes = 0;
+}
+
+/* Move the bytes to the front of buf[] so there is room at the end */
+static void lz_stream_compact(struct lz_stream *z)
+{
+if (z->head > 0) {
+	memmove(z->buf, z->buf + z->head, z->len);
+	z->head = 0;
+}
+}
+
+void lz_stream_put_chunk(struct lz_stream *z, char data[], int n, int use_lz)
+{
+char *rec;
+int m = 0;
+
+lz_stream_compact(z);
+rec = z->buf + z->len;
+if (use_lz) {
+	m = lz_compress(data, n, rec + LZ_REC_HDR, n - 1);
+}
+if (m > 0) {
+	rec[0] = LZ_REC_LZ;
+}
+else {	/* Did not compress, send it raw */
+	rec[0] = LZ_REC_RAW;
+	memcpy(rec + LZ_REC_HDR, data, n);
+	m = n;
+}
+rec[1] = (char) (n >> 8);
+rec[2] = (char) n;
+rec[3] = (char) (m >> 8);
+rec[4] = (char) m;
+z->len += LZ_REC_HDR + m;
+z->raw_bytes += n;
+z->wire_bytes += LZ_REC_HDR + m;
+}
+
+int lz_stream_get(struct lz_stream *z, char data[], int max)
+{
+int n;
+
+n = z->len < max ? z->len : max;
+memcpy(data, z->buf + z->head, n);
+z->head += n;
+z->len -= n;
+if (z->len == 0) z->head = 0;
+return n;
+}
+
+int lz_stream_append(struct lz_stream *z, char data[], int n)
+{
+if (z->head + z->len + n > LZ_STREAM_MAX) lz_stream_compact(z);
+if (z->len + n > LZ_STREAM_MAX) return 0;
+memcpy(z->buf + z->head + z->len, data, n);
+z->len += n;
+z->wire_bytes += n;
+return 1;
+}
+
+int lz_stream_next_chunk(struct lz_stream *z, char chunk[])
+{
+unsigned char *rec;
+int raw_len;
+int m;
+int n;
+
+if (z->len < LZ_REC_HDR) return 0;
+rec = (unsigned char *) z->buf + z->head;
+raw_len = (rec[1] << 8) | rec[2];
+m = (rec[3] << 8) | rec[4];
+if (raw_len > LZ_CHUNK || m > LZ_CHUNK) return -1;
+if (z->len < LZ_REC_HDR + m) return 0;
+
+if (rec[0] == LZ_REC_RAW && m == raw_len) {
+	memcpy(chunk, rec + LZ_REC_HDR, m);
+	n = m;
+}
+else if (rec[0] == LZ_REC_LZ) {
+	n = lz_decompress((char *) rec + LZ_REC_HDR, m, chunk, LZ_CHUNK);
+	if (n != raw_len) return -1;
+}
+else {
+	return -1;
+}
+
+z->head += LZ_REC_HDR + m;
+z->len -= LZ_REC_HDR + m;
+if (z->len == 0) z->head = 0;
+z->raw_bytes += n;
+return n;
+}
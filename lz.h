@@ -0,0 +1,79 @@
+/*
+ * lz.h
+ *
+ * Fast LZ77 codec (LZ4-style sequences) and the chunked stream
+ * that file transfers use to send compressed data.
+ *
+ * The sender cuts the file into chunks of up to LZ_CHUNK bytes.
+ * Each chunk becomes a record in the byte stream carried by the
+ * transport segments:
+ *
+ *    byte 0      LZ_REC_RAW or LZ_REC_LZ
+ *    bytes 1-2   length of the chunk before compression
+ *    bytes 3-4   length of the record data
+ *    data
+ *
+ * A chunk that does not get smaller is sent raw, so the receiver
+ * can decompress record by record as the stream arrives.  If the
+ * stream does not decode, or the file it makes does not check out,
+ * the receiver removes what it wrote and sets LZ_STREAM_FAIL in
+ * its acks from then on, and the sender sends the file again as
+ * it is.
+ */
+
+#define LZ_CODEC_NONE 0		/* Codec bits offered and accepted */
+#define LZ_CODEC_LZ 1		/*    in the start segment and acks */
+#define LZ_CODECS LZ_CODEC_LZ	/* What this build understands */
+#define LZ_STREAM_FAIL 8	/* Acks: the stream was rejected (and see
+				   delta.h for bits 2 and 4) */
+
+#define LZ_CHUNK 4096
+#define LZ_REC_HDR 5
+#define LZ_REC_RAW 0
+#define LZ_REC_LZ 1
+#define LZ_STREAM_MAX (2*LZ_CHUNK + 2*LZ_REC_HDR + 2*PAYLOAD_MAX)
+
+/* Worst case size of compressing n bytes */
+#define LZ_BOUND(n) ((n) + (n)/255 + 16)
+
+/*
+ * Compress n bytes of src into dst, which holds cap bytes.
+ * Returns the compressed length, or 0 if it does not fit.
+ */
+int lz_compress(const char *src, int n, char *dst, int cap);
+
+/*
+ * Decompress n bytes of src into dst, which holds cap bytes.
+ * Returns the decompressed length, or -1 if the input is corrupt.
+ */
+int lz_decompress(const char *src, int n, char *dst, int cap);
+
+struct lz_stream {
+	char buf[LZ_STREAM_MAX];
+	int head;		/* Offset of the first byte in buf[] */
+	int len;		/* Number of bytes in buf[] */
+	long raw_bytes;		/* Chunk bytes before compression */
+	long wire_bytes;	/* Record bytes put in the stream */
+};
+
+void lz_stream_init(struct lz_stream *z);
+
+/*
+ * Sender: append a record for n bytes of data, compressed if
+ * use_lz is set and it helps.  There must be room for
+ * LZ_CHUNK + LZ_REC_HDR bytes.
+ */
+void lz_stream_put_chunk(struct lz_stream *z, char data[], int n, int use_lz);
+
+/* Sender: remove up to max bytes of stream into data[] */
+int lz_stream_get(struct lz_stream *z, char data[], int max);
+
+/* Receiver: append n bytes of stream.  Returns 0 if there is no room */
+int lz_stream_append(struct lz_stream *z, char data[], int n);
+
+/*
+ * Receiver: decode the next complete record into chunk[], which
+ * holds LZ_CHUNK bytes.  Returns the chunk length, 0 if the
+ * record has not fully arrived, or -1 if it is corrupt.
+ */
+int lz_stream_next_chunk(struct lz_stream *z, char chunk[]);
@@ -1,19 +1,54 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "main.h"
 #include "net.h"
 #include "man.h"
 #include "host.h"
+#include "sim.h"
+#include "crc32c.h"
+#include "uring.h"
+#include "place.h"
+#include "switch.h"
+#include "emu.h"
+#include "config.h"
+#include "capture.h"
 
+#define HOST_STACK (1024*1024)	/* Stack of a host run as a thread */
 
-void main()
+/*
+ * Load the network configuration from file 'fname', or from one
+ * whose name is asked for if NULL.  Nothing can run without it.
+ */
+static void load_network(char *fname)
+{
+if ((fname != NULL ? net_init_file(fname) : net_init()) == 0) exit(1);
+}
+
+static void *host_thread(void *arg)
+{
+host_run((struct host_state *) arg);
+return NULL;
+}
+
+static void *switch_thread(void *arg)
+{
+switch_run((struct switch_state *) arg);
+return NULL;
+}
+
+void main(int argc, char *argv[])
 {
 
 pid_t pid;  /* Process id */
@@ -21,15 +56,131 @@ int k=0;
 int status;
 struct net_node *node_list;
 struct net_node *p_node;
+struct rlimit lim;
+pthread_attr_t attr;
+pthread_t tid;
+cpu_set_t set;
+int *cpu_of = NULL;	/* CPU of each node, with -a */
+int max_id;
+int affinity = 0;
+int sim = 0;
+int threads = 1;
+int threaded = 0;
+int pipeline = 0;
+char *config = NULL;	/* Configuration file, if not asked for */
+char *capture_dir = NULL;
+int snap = CAPTURE_SNAP_DEFAULT;
+
+/*
+ * With -s the network is simulated in this process rather
+ * than run as a process per node, with -j N using N threads.
+ * Its links are in memory, but the hosts the manager talks to
+ * get pipes.  In every mode the manager holds many pipes for a
+ * while, so allow as many files as we may.
+ */
+for (k=1; k<argc; k++) {
+	if (strcmp(argv[k], "-s") == 0) sim = 1;
+	else if (strcmp(argv[k], "-j") == 0 && k+1 < argc) {
+		threads = atoi(argv[++k]);
+	}
+	else if (strcmp(argv[k], "-t") == 0) threaded = 1;
+	else if (strcmp(argv[k], "-a") == 0) affinity = 1;
+	else if (strcmp(argv[k], "-p") == 0) pipeline = 1;
+	else if (strcmp(argv[k], "-c") == 0 && k+2 < argc) {
+		/* Convert a configuration file to the other format */
+		exit(config_convert(argv[k+1], argv[k+2]) ? 0 : 1);
+	}
+	else if (strcmp(argv[k], "-w") == 0 && k+1 < argc) {
+		capture_dir = argv[++k];	/* Capture the links */
+	}
+	else if (strcmp(argv[k], "-W") == 0 && k+1 < argc) {
+		snap = atoi(argv[++k]);		/* Bytes of each frame */
+	}
+	else if (argv[k][0] != '-') config = argv[k];
+	else if (strcmp(argv[k], "-u") == 0) {
+		/*
+		 * Hosts use io_uring for their pipes.  Each host
+		 * makes its own ring; check one can be made here.
+		 */
+		if (uring_available()) host_use_uring();
+		else printf("io_uring is not available, "
+			"using read() and write()\n");
+	}
+}
+if (capture_dir != NULL) {
+	mkdir(capture_dir, 0755);
+	capture_enable(capture_dir, snap > 0 ? snap : CAPTURE_SNAP_DEFAULT);
+}
+getrlimit(RLIMIT_NOFILE, &lim);
+lim.rlim_cur = lim.rlim_max;
+setrlimit(RLIMIT_NOFILE, &lim);
+if (sim) {
+	net_use_sim_links();
+	load_network(config);
+	sim_init(net_get_node_list(), threads);
+	man_main();
+	return;
+}
+
+/*
+ * With -p each host is an I/O thread and a worker thread (not in
+ * the simulator, which polls the hosts itself); they use no ring
+ */
+if (pipeline) host_use_pipeline();
+
+/*
+ * With -t each host is a thread of this process rather than a
+ * process of its own, and links between them are queues in memory.
+ * The hosts are set up here, one at a time, since that takes their
+ * ports from the shared lists, and the CRC tables are filled before
+ * the threads could race to do it.
+ */
+if (threaded) {
+	net_use_memq_links();
+	load_network(config);
+	if (affinity) cpu_of = place_nodes(net_get_node_list(), &max_id);
+	crc32c_sw(0, "", 0);
+	for (p_node = net_get_node_list(); p_node != NULL;
+			p_node = p_node->next) {
+		/* A fresh attr each time, so an unplaced node is not pinned */
+		pthread_attr_init(&attr);
+		pthread_attr_setstacksize(&attr, HOST_STACK);
+		if (cpu_of != NULL && cpu_of[p_node->id] >= 0) {
+			CPU_ZERO(&set);
+			CPU_SET(cpu_of[p_node->id], &set);
+			pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+		}
+		if (p_node->type == HOST) {
+			k = pthread_create(&tid, &attr, host_thread,
+				host_create(p_node->id));
+		}
+		else {
+			k = pthread_create(&tid, &attr, switch_thread,
+				switch_create(p_node->id));
+		}
+		pthread_attr_destroy(&attr);
+		if (k != 0) {
+			printf("Error:  the pthread_create() failed\n");
+			exit(1);
+		}
+		pthread_detach(tid);
+	}
+	man_main();
+	exit(0);
+}
+k = 0;
 
 /*
  * Read network configuration file, which specifies
  *   - nodes, creates a list of nodes
  *   - links, creates/implements the links, e.g., using pipes or sockets
  */
-net_init();  
+load_network(config);
 node_list = net_get_node_list(); /* Returns the list of nodes */
 
+/* With -a each node runs on a CPU chosen from the link graph */
+if (affinity) cpu_of = place_nodes(node_list, &max_id);
+
 
 /* Create nodes, which are child processwa */ 
 
@@ -42,14 +193,17 @@ for (p_node = node_list; p_node != NULL; p_node = p_node->next) {
 		return;
 	}
 	else if (pid == 0) { /* The child process, which is a node  */
+		net_close_ports_except(p_node->id);
+		if (cpu_of != NULL) place_pin(cpu_of[p_node->id]);
 		if (p_node->type == HOST) {  /* Execute host routine */
 			host_main(p_node->id);
 		}
-		else if (p_node->type = SWITCH) {
-			/* Execute switch routine, which you have to write */
+		else if (p_node->type == SWITCH) {
+			switch_main(p_node->id);
 		}
 		return;
 	}  
+	net_close_node_ports(p_node->id);	/* Only the node uses them */
 }
 
 /* 
@@ -1,6 +1,14 @@
 
-#define BCAST_ADDR 100
-#define PAYLOAD_MAX 100
+#define BCAST_ADDR 0x7fffffff	/* Above any node id */
+
+/*
+ * Multicast group g has address MCAST_ADDR(g), between the node ids
+ * and BCAST_ADDR.  Hosts join and leave groups (see switch.h).
+ */
+#define MCAST_BASE 0x7f000000
+#define MCAST_GROUPS 65536
+#define MCAST_ADDR(g) (MCAST_BASE + (g))
+#define IS_MCAST(a) ((a) >= MCAST_BASE && (a) < BCAST_ADDR)
 #define STRING_MAX 100
 #define NAME_LENGTH 100
 
@@ -11,7 +19,9 @@ enum NetNodeType { /* Types of network nodes */
 
 enum NetLinkType { /* Types of linkls */
 	PIPE,
-	SOCKET
+	SOCKET,
+	SIM,	/* In memory, between hosts of the simulator */
+	MEMQ	/* In memory, between nodes run as threads */
 };
 
 struct net_node { /* Network node, e.g., host or switch */
@@ -20,20 +30,60 @@ struct net_node { /* Network node, e.g., host or switch */
 	struct net_node *next;
 };
 
+/*
+ * Link MTU: the largest payload a link carries in one frame.
+ * It is set per link in the network configuration file.
+ */
+#define MTU_DEFAULT 1500
+#define MTU_MIN 64
+#define MTU_MAX 65536		/* Jumbo frames */
+#define PAYLOAD_MAX MTU_MAX
+
 struct net_port { /* port to communicate with another node */
 	enum NetLinkType type;
 	int pipe_host_id;
+	int pipe_peer_id;	/* Node at the other end of the link */
 	int pipe_send_fd;
 	int pipe_recv_fd;
+	int mtu;
+	int crc;		/* Append a CRC32C trailer to sent frames */
+	struct link_emu *emu;	/* Link emulation, NULL for a plain pipe */
+	struct net_port *peer;	/* SIM: the port at the other end */
+	long long release_at;	/* SIM: when the simulator next releases
+				   the port's emulated frames, or -1 */
+	struct memq *tx_q;	/* MEMQ: queues that take the place */
+	struct memq *rx_q;	/*    of the pipes */
+	struct uring_chan *urx;	/* io_uring channels for the pipes, */
+	struct uring_chan *utx;	/*    or NULL to use read() and write() */
+	struct capture *cap;	/* Capture of its frames, or NULL */
+
+	char *rx_buf;		/* Bytes read but not yet made into */
+	int rx_head;		/*    packets, allocated on first use */
+	int rx_len;
+	int rx_cap;
+	char *tx_buf;		/* Frames waiting for room in the pipe */
+	int tx_head;
+	int tx_len;
+	int tx_cap;
+
+	long tx_packets;	/* Statistics */
+	long rx_packets;
+	long tx_bytes;
+	long rx_bytes;
+	long tx_drops;		/* Frames that did not fit the tx buffer
+				   or were lost by link emulation */
+	long rx_drops;		/* Simulator: frames that did not fit
+				   the rx buffer */
+	long crc_errors;	/* Received frames that failed the CRC */
 	struct net_port *next;
 };
 
 /* Packet sent between nodes  */
 
 struct packet { /* struct for a packet */
-	char src;
-	char dst;
-	char type;
+	int src;
+	int dst;
+	int type;
 	int length;
 	char payload[PAYLOAD_MAX];
 };
@@ -44,5 +94,12 @@ struct packet { /* struct for a packet */
 #define PKT_PING_REPLY		1
 #define PKT_FILE_UPLOAD_START	2
 #define PKT_FILE_UPLOAD_END	3
+#define PKT_FILE_UPLOAD_DATA	4
+#define PKT_FILE_ACK		5
+#define PKT_FILE_DOWNLOAD_REQ	6
+#define PKT_MCAST_JOIN		7	/* To a group address, from the */
+#define PKT_MCAST_LEAVE		8	/*    host joining or leaving */
+#define PKT_TRAFFIC		9	/* Load test, see traffic.h */
+#define PKT_FILE_SIG_REQ	10	/* Signatures of a file, delta.h */
 
 
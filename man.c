@@ -6,20 +6,28 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <poll.h>
 
 #include "main.h"
 #include "man.h"
 #include "net.h"
 #include "host.h"
+#include "sim.h"
+#include "sched.h"
 
 #define MAXBUFFER 1000
 #define PIPE_WRITE 1 
 #define PIPE_READ  0
 #define TENMILLISEC 10000
 #define DELAY_FOR_HOST_REPLY 10  /* Delay in ten of milliseconds */
+#define MAN_REPLY_TIMEOUT 5000000	/* Give up on a reply after 5 s */
+#define MAN_EVENTS 64		/* Replies taken per epoll_wait() */
+#define MAN_FILES_MAX 100	/* Files a listing can show */
 
 void display_host(struct man_port_at_man *list, 
 			struct man_port_at_man *curr_host);
@@ -29,8 +37,157 @@ void display_host(struct man_port_at_man *list,
 			struct man_port_at_man *curr_host);
 void display_host_state(struct man_port_at_man *curr_host);
 void set_host_dir(struct man_port_at_man *curr_host);
+void list_host_files(struct man_port_at_man *curr_host);
 char man_get_user_cmd(int curr_host); 
 
+/*
+ * Replies from the hosts are multiplexed with epoll, so commands
+ * to any number of hosts can be outstanding at once.  A host's
+ * pipe is watched from the first command sent to it.
+ */
+static int g_man_epoll = -1;
+static int g_man_outstanding = 0;	/* Commands awaiting a reply */
+
+static void man_watch(struct man_port_at_man *host)
+{
+struct epoll_event ev;
+
+if (host->watched || host->recv_fd < 0) return;
+if (g_man_epoll < 0) g_man_epoll = epoll_create1(0);
+ev.events = EPOLLIN;
+ev.data.ptr = host;
+epoll_ctl(g_man_epoll, EPOLL_CTL_ADD, host->recv_fd, &ev);
+host->watched = 1;
+}
+
+/*
+ * Under the simulator (net367 -s) the hosts only run when the
+ * manager lets simulated time pass.  man_send() gives the host
+ * its command at once, and man_wait() runs the network for the
+ * time the manager would otherwise sleep.
+ */
+void man_send(struct man_port_at_man *host, char msg[], int n)
+{
+char line[MAN_MSG_LENGTH+1];
+
+if (sim_active()) net_open_man_port(host->host_id);
+man_watch(host);
+memcpy(line, msg, n);		/* One command per line, so that */
+line[n] = '\n';			/*    commands sent together stay apart */
+write(host->send_fd, line, n+1);
+if (sim_active()) {
+	sim_wake(host->host_id);
+	sim_run(0);
+}
+}
+
+void man_wait(long long us)
+{
+if (sim_active()) sim_run(us);
+else usleep(us);
+}
+
+/*
+ * Wait up to 'us' for replies and hand each to the function of
+ * the command it answers.  Under the simulator the time is run
+ * first and the pipes then checked without waiting.
+ */
+static void man_poll(long long us)
+{
+struct epoll_event ev[MAN_EVENTS];
+struct man_port_at_man *host;
+char reply[2*(MAN_MSG_LENGTH + MAN_TAG_LEN)];
+char *p, *body;
+char c;
+int tag, len, off;
+int i, k, n;
+
+if (g_man_epoll < 0) {
+	man_wait(us);
+	return;
+}
+if (sim_active()) {
+	sim_run(us);
+	us = 0;
+}
+k = epoll_wait(g_man_epoll, ev, MAN_EVENTS, (int) (us / 1000));
+for (i=0; i<k; i++) {
+	host = (struct man_port_at_man *) ev[i].data.ptr;
+	n = read(host->recv_fd, reply, sizeof(reply)-1);
+	if (n <= 0) continue;
+	reply[n] = '\0';
+
+	/* Take the reply with the tag awaited; drop stale ones */
+	for (p = reply; p < reply + n; p = body + len) {
+		if (sscanf(p, "#%d %d:%n", &tag, &len, &off) != 2
+				|| len < 0 || p + off + len > reply + n) {
+			break;		/* Not a whole reply */
+		}
+		body = p + off;
+		if (host->pending == 0 || tag != host->tag) continue;
+		c = body[len];
+		body[len] = '\0';
+		host->pending = 0;
+		g_man_outstanding--;
+		host->on_reply(host, body);
+		body[len] = c;
+	}
+}
+}
+
+/*
+ * Send a command that the host replies to, tagged (man.h).  The
+ * reply goes to on_reply() when man_collect() takes it.  A host has
+ * one such command at a time, so one still outstanding is waited
+ * for.
+ */
+void man_request(struct man_port_at_man *host, char msg[], int n,
+		void (*on_reply)(struct man_port_at_man *, char *))
+{
+char line[MAN_MSG_LENGTH];
+long long waited;
+
+for (waited = 0; host->pending && waited < MAN_REPLY_TIMEOUT;
+		waited += TENMILLISEC) {
+	man_poll(TENMILLISEC);
+}
+if (host->pending) {		/* Never came; forget it */
+	host->pending = 0;
+	g_man_outstanding--;
+	host->on_reply(host, NULL);
+}
+host->pending = msg[0];
+host->tag = host->tag % 1000000 + 1;
+host->on_reply = on_reply;
+g_man_outstanding++;
+n = snprintf(line, sizeof(line), "#%d %.*s", host->tag, n, msg);
+man_send(host, line, n);
+}
+
+/*
+ * Take replies until every outstanding command has one, or
+ * MAN_REPLY_TIMEOUT passes; hosts that have not replied by then
+ * get on_reply(host, NULL)
+ */
+void man_collect()
+{
+struct man_port_at_man *host;
+long long waited;
+
+for (waited = 0; g_man_outstanding > 0 && waited < MAN_REPLY_TIMEOUT;
+		waited += TENMILLISEC) {
+	man_poll(TENMILLISEC);
+}
+for (host = net_get_man_ports_at_man_list(); host != NULL;
+		host = host->next) {
+	if (host->pending) {
+		host->pending = 0;
+		g_man_outstanding--;
+		host->on_reply(host, NULL);
+	}
+}
+}
+
 
 /* Get the user command */
 char man_get_user_cmd(int curr_host)
@@ -42,11 +199,28 @@ while(1) {
    	printf("\nCommands (Current host ID = %d):\n",curr_host );
  	printf("   (s) Display host's state\n");
 	printf("   (m) Set host's main directory\n");
+	printf("   (l) List the files in host's directory\n");
 	printf("   (h) Display all hosts\n");
 	printf("   (c) Change host\n");
 	printf("   (p) Ping a host\n");
 	printf("   (u) Upload a file to a host\n");
 	printf("   (d) Download a file from a host\n");
+	printf("   (w) Set host's transport window\n");
+	printf("   (z) Set host's upload compression\n");
+	printf("   (x) Set host's delta uploads\n");
+	printf("   (y) Set host's multipath striping\n");
+	printf("   (e) Set the weight of host's uploads\n");
+	printf("   (t) Let time pass\n");
+	printf("   (S) Display the state of a group of hosts\n");
+	printf("   (M) Set the directory of a group of hosts\n");
+	printf("   (P) Ping between all pairs of a group of hosts\n");
+	printf("   (U) Upload a file from a group of hosts to another\n");
+	printf("   (J) Join a group of hosts to a multicast group\n");
+	printf("   (L) Take a group of hosts out of a multicast group\n");
+	printf("   (F) Multicast a file to a group of hosts\n");
+	printf("   (G) Generate traffic from a group of hosts\n");
+	printf("   (R) Report the traffic a group of hosts received\n");
+	printf("   (D) Dashboard of the traffic of a group of hosts\n");
 	printf("   (q) Quit\n");
 	printf("   Enter Command: ");
 	do {
@@ -58,11 +232,28 @@ while(1) {
 	{
 		case 's':
 		case 'm':
+		case 'l':
 		case 'h':
 		case 'c':
 		case 'p':
 		case 'u':
 		case 'd':
+		case 'w':
+		case 'z':
+		case 'x':
+		case 'y':
+		case 'e':
+		case 't':
+		case 'S':
+		case 'M':
+		case 'P':
+		case 'U':
+		case 'J':
+		case 'L':
+		case 'F':
+		case 'G':
+		case 'R':
+		case 'D':
 		case 'q': return cmd;
 		default: 
 			printf("Invalid: you entered %c\n\n", cmd);
@@ -114,29 +305,92 @@ for (p=list; p!=NULL; p=p->next) {
  * Wait for reply from host, which should be the host's state.
  * Then display on the console. 
  */
-void display_host_state(struct man_port_at_man *curr_host)
+static void show_host_state(struct man_port_at_man *host, char reply[])
 {
-char msg[MAN_MSG_LENGTH];
-char reply[MAN_MSG_LENGTH];
 char dir[NAME_LENGTH];
 int host_id;
-int n;
+long tx, rx, drops, crc_errors;
 
-msg[0] = 's';
-write(curr_host->send_fd, msg, 1);
-
-n = 0;
-while (n <= 0) {
-	usleep(TENMILLISEC);
-	n = read(curr_host->recv_fd, reply, MAN_MSG_LENGTH);
+if (reply == NULL) {
+	printf("Host %d: no reply\n", host->host_id);
+	return;
 }
-reply[n] = '\0';
-sscanf(reply, "%s %d", dir, &host_id);
+tx = rx = drops = crc_errors = 0;
+sscanf(reply, "%s %d %ld %ld %ld %ld", 
+	dir, &host_id, &tx, &rx, &drops, &crc_errors);
 printf("Host %d state: \n", host_id);
 printf("    Directory = %s\n", dir);
+printf("    Packets sent = %ld, received = %ld, dropped = %ld, "
+	"CRC errors = %ld\n", tx, rx, drops, crc_errors);
+}
+
+void display_host_state(struct man_port_at_man *curr_host)
+{
+char msg[MAN_MSG_LENGTH];
+
+msg[0] = 's';
+man_request(curr_host, msg, 1, show_host_state);
+man_collect();
 }
 
 
+static int file_line_cmp(const void *x, const void *y)
+{
+return strcmp(*(char **) x, *(char **) y);
+}
+
+/*
+ * The host's reply to 'i' is the number of files in its directory,
+ * then "name size mtime" for those that fit, one per line.  They
+ * are shown sorted by name.
+ */
+static void show_host_files(struct man_port_at_man *host, char reply[])
+{
+char *line[MAN_FILES_MAX];
+char name[NAME_LENGTH];
+char date[32];
+long long size, mtime;
+time_t t;
+char *s;
+int total = 0;
+int n = 0;
+int i;
+
+if (reply == NULL) {
+	printf("Host %d: no reply\n", host->host_id);
+	return;
+}
+sscanf(reply, "%d", &total);
+s = strchr(reply, '\n');
+while (s != NULL && s[1] != '\0' && n < MAN_FILES_MAX) {
+	*s = '\0';
+	line[n++] = s+1;
+	s = strchr(s+1, '\n');
+}
+if (s != NULL) *s = '\0';
+qsort(line, n, sizeof(char *), file_line_cmp);
+
+printf("Host %d: %d files\n", host->host_id, total);
+for (i=0; i<n; i++) {
+	if (sscanf(line[i], "%s %lld %lld", name, &size, &mtime) != 3) {
+		continue;
+	}
+	t = (time_t) mtime;
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&t));
+	printf("   %-40s %12lld  %s\n", name, size, date);
+}
+if (n < total) printf("   ... and %d more\n", total - n);
+}
+
+void list_host_files(struct man_port_at_man *curr_host)
+{
+char msg[MAN_MSG_LENGTH];
+
+msg[0] = 'i';
+man_request(curr_host, msg, 1, show_host_files);
+man_collect();
+}
+
 void set_host_dir(struct man_port_at_man *curr_host)
 {
 char name[NAME_LENGTH];
@@ -146,7 +400,7 @@ int n;
 printf("Enter directory name: ");
 scanf("%s", name);
 n = sprintf(msg, "m %s", name);
-write(curr_host->send_fd, msg, n);
+man_send(curr_host, msg, n);
 }
 
 /* 
@@ -161,10 +415,15 @@ write(curr_host->send_fd, msg, n);
  * Wiat for a reply
  */
 
+static void show_ping(struct man_port_at_man *host, char reply[])
+{
+if (reply == NULL) printf("Host %d: no reply\n", host->host_id);
+else printf("%s\n", reply);
+}
+
 void ping(struct man_port_at_man *curr_host)
 {
 char msg[MAN_MSG_LENGTH];
-char reply[MAN_MSG_LENGTH];
 int host_to_ping;
 int n;
 
@@ -172,15 +431,8 @@ printf("Enter id of host to ping: ");
 scanf("%d", &host_to_ping);
 n = sprintf(msg, "p %d", host_to_ping);
 
-write(curr_host->send_fd, msg, n);
-
-n = 0;
-while (n <= 0) {
-	usleep(TENMILLISEC);
-	n = read(curr_host->recv_fd, reply, MAN_MSG_LENGTH);
-}
-reply[n] = '\0';
-printf("%s\n",reply);
+man_request(curr_host, msg, n, show_ping);
+man_collect();
 }
 
 
@@ -211,8 +463,840 @@ scanf("%d", &host_id);
 printf("\n");
 
 n = sprintf(msg, "u %d %s", host_id, name);
-write(curr_host->send_fd, msg, n);
-usleep(TENMILLISEC);
+man_send(curr_host, msg, n);
+man_wait(TENMILLISEC);
+}
+
+
+/*
+ * Command host to download a file from another host.
+ *
+ * User is queried for the
+ *    - name of the file to transfer
+ *    - id of the host that has the file
+ *
+ * A command message is sent to the current host.
+ *    The message starts with 'd' followed by the 
+ *    -  id of the host that has the file
+ *    -  name of file to transfer
+ * The file is stored in the current host's directory.
+ */
+void file_download(struct man_port_at_man *curr_host)
+{
+int n;
+int host_id;
+char name[NAME_LENGTH];
+char msg[MAN_MSG_LENGTH];
+
+printf("Enter file name to download: ");
+scanf("%s", name);
+printf("Enter host id of source:  ");
+scanf("%d", &host_id);
+printf("\n");
+
+n = sprintf(msg, "d %d %s", host_id, name);
+man_send(curr_host, msg, n);
+man_wait(TENMILLISEC);
+}
+
+/*
+ * Set the number of segments the current host keeps in flight
+ * for its file transfers.  The message is 'w' followed by the
+ * window size.
+ */
+void set_host_window(struct man_port_at_man *curr_host)
+{
+char msg[NAME_LENGTH];
+int window;
+int n;
+
+printf("Enter transport window (segments): ");
+scanf("%d", &window);
+n = sprintf(msg, "w %d", window);
+man_send(curr_host, msg, n);
+}
+
+/*
+ * Turn compression of the current host's uploads on or off.
+ * The message is 'z' followed by 1 (on) or 0 (off).  The
+ * receiving host still has to accept the codec.
+ */
+void set_host_compress(struct man_port_at_man *curr_host)
+{
+char msg[NAME_LENGTH];
+int on;
+int n;
+
+printf("Compress uploads (1 = on, 0 = off): ");
+scanf("%d", &on);
+n = sprintf(msg, "z %d", on);
+man_send(curr_host, msg, n);
+}
+
+/*
+ * Uploads as deltas send only what the receiver's copy of the
+ * file lacks, if it has one
+ */
+void set_host_delta(struct man_port_at_man *curr_host)
+{
+char msg[NAME_LENGTH];
+int on;
+int n;
+
+printf("Delta uploads (1 = on, 0 = off): ");
+scanf("%d", &on);
+n = sprintf(msg, "x %d", on);
+man_send(curr_host, msg, n);
+}
+
+/*
+ * A striped upload sends each segment on one of the host's ports
+ * rather than all, to add up the paths to the receiver
+ */
+void set_host_stripe(struct man_port_at_man *curr_host)
+{
+char msg[NAME_LENGTH];
+int on;
+int n;
+
+printf("Multipath striping (1 = on, 0 = off): ");
+scanf("%d", &on);
+n = sprintf(msg, "y %d", on);
+man_send(curr_host, msg, n);
+}
+
+/*
+ * Concurrent uploads share the host's ports in proportion to
+ * their weights, which they keep from when they start
+ */
+void set_host_weight(struct man_port_at_man *curr_host)
+{
+char msg[NAME_LENGTH];
+int weight;
+int n;
+
+printf("Weight of uploads from now on (1-%d): ", SCHED_WEIGHT_MAX);
+scanf("%d", &weight);
+n = sprintf(msg, "e %d", weight);
+man_send(curr_host, msg, n);
+}
+
+
+/*
+ * Wait while the network runs.  Under the simulator this runs
+ * the given simulated time as fast as it can, so long transfers
+ * can be left to finish without waiting for them.
+ */
+void let_time_pass()
+{
+int ms;
+
+printf("Enter time to pass (ms): ");
+scanf("%d", &ms);
+man_wait((long long) ms * 1000);
+if (sim_active()) sim_report();
+}
+
+
+/*
+ * Group commands.  A group of hosts is entered as "all", or as
+ * host ids and ranges separated by commas, e.g. "0-3,7".  The
+ * command goes to every host in the group at once and the
+ * replies are gathered as they come.
+ */
+
+/* The port to host 'host_id', or NULL */
+static struct man_port_at_man *man_find_host(struct man_port_at_man *list,
+		int host_id)
+{
+struct man_port_at_man *p;
+
+for (p=list; p!=NULL && p->host_id != host_id; p=p->next);
+return p;
+}
+
+/*
+ * Ask for a group of hosts and return it in a new array,
+ * in host id order, with its size in *num
+ */
+static struct man_port_at_man **man_get_group(struct man_port_at_man *list,
+		char prompt[], int *num)
+{
+struct man_port_at_man **group;
+struct man_port_at_man *p;
+char str[MAN_MSG_LENGTH];
+char *s;
+int hosts, lo, hi, id, k;
+
+printf("%s (all, or e.g. 0-3,7): ", prompt);
+scanf("%s", str);
+for (hosts=0, p=list; p!=NULL; p=p->next) hosts++;
+group = (struct man_port_at_man **)
+	malloc(hosts * sizeof(struct man_port_at_man *));
+
+*num = 0;
+if (strcmp(str, "all") == 0) {
+	lo = 0;
+	hi = -1;
+	for (p=list; p!=NULL; p=p->next) {
+		if (p->host_id > hi) hi = p->host_id;
+	}
+	for (id=lo; id<=hi; id++) {
+		p = man_find_host(list, id);
+		if (p != NULL) group[(*num)++] = p;
+	}
+	return group;
+}
+for (s = strtok(str, ","); s != NULL; s = strtok(NULL, ",")) {
+	k = sscanf(s, "%d-%d", &lo, &hi);
+	if (k < 1) continue;
+	if (k == 1) hi = lo;
+	for (id=lo; id<=hi && *num < hosts; id++) {
+		p = man_find_host(list, id);
+		if (p != NULL) group[(*num)++] = p;
+	}
+}
+return group;
+}
+
+/* Totals of the group's state replies */
+static long g_group_tx, g_group_rx, g_group_drops, g_group_crc;
+static int g_group_replies;
+
+static void group_state_reply(struct man_port_at_man *host, char reply[])
+{
+char dir[NAME_LENGTH];
+int host_id;
+long tx, rx, drops, crc_errors;
+
+if (reply == NULL) {
+	printf("   %6d  no reply\n", host->host_id);
+	return;
+}
+tx = rx = drops = crc_errors = 0;
+sscanf(reply, "%s %d %ld %ld %ld %ld",
+	dir, &host_id, &tx, &rx, &drops, &crc_errors);
+printf("   %6d  %-20s %10ld %10ld %8ld %8ld\n",
+	host_id, dir, tx, rx, drops, crc_errors);
+g_group_tx += tx;
+g_group_rx += rx;
+g_group_drops += drops;
+g_group_crc += crc_errors;
+g_group_replies++;
+}
+
+void display_group_state(struct man_port_at_man *list)
+{
+struct man_port_at_man **group;
+char msg[MAN_MSG_LENGTH];
+int num, i;
+
+group = man_get_group(list, "Enter hosts", &num);
+g_group_tx = g_group_rx = g_group_drops = g_group_crc = 0;
+g_group_replies = 0;
+printf("     Host  %-20s %10s %10s %8s %8s\n",
+	"Directory", "Sent", "Received", "Dropped", "CRC err");
+msg[0] = 's';
+for (i=0; i<num; i++) {
+	man_request(group[i], msg, 1, group_state_reply);
+}
+man_collect();
+printf("   %d of %d hosts replied: sent %ld, received %ld, dropped %ld, "
+	"CRC errors %ld\n", g_group_replies, num, g_group_tx, g_group_rx,
+	g_group_drops, g_group_crc);
+free(group);
+}
+
+void set_group_dir(struct man_port_at_man *list)
+{
+struct man_port_at_man **group;
+char name[NAME_LENGTH];
+char msg[MAN_MSG_LENGTH];
+int num, i, n;
+
+group = man_get_group(list, "Enter hosts", &num);
+printf("Enter directory name: ");
+scanf("%s", name);
+n = sprintf(msg, "m %s", name);
+for (i=0; i<num; i++) {
+	man_send(group[i], msg, n);
+}
+printf("Directory of %d hosts set to %s\n", num, name);
+free(group);
+}
+
+/*
+ * Start an upload of the file from every source to every
+ * destination other than itself.  The hosts report each
+ * upload when it is done.
+ */
+void group_upload(struct man_port_at_man *list)
+{
+struct man_port_at_man **src;
+struct man_port_at_man **dst;
+char name[NAME_LENGTH];
+char msg[MAN_MSG_LENGTH];
+int src_num, dst_num, uploads;
+int i, j, n;
+
+printf("Enter file name to upload: ");
+scanf("%s", name);
+src = man_get_group(list, "Enter source hosts", &src_num);
+dst = man_get_group(list, "Enter destination hosts", &dst_num);
+uploads = 0;
+for (i=0; i<src_num; i++) {
+	for (j=0; j<dst_num; j++) {
+		if (src[i] == dst[j]) continue;
+		n = sprintf(msg, "u %d %s", dst[j]->host_id, name);
+		man_send(src[i], msg, n);
+		uploads++;
+	}
+}
+printf("Started %d uploads of %s from %d hosts to %d hosts\n",
+	uploads, name, src_num, dst_num);
+man_wait(TENMILLISEC);
+free(src);
+free(dst);
+}
+
+/*
+ * Multicast.  Hosts join and leave multicast groups, numbered from
+ * 0, and a file sent to a group goes once over each link on the way
+ * to its members.  The message to join is 'j' followed by the group,
+ * and to leave 'l'.
+ */
+#define MCAST_JOIN_WAIT 100000	/* Time for joins to reach the switches */
+
+static int man_get_mcast_group()
+{
+int g;
+
+printf("Enter multicast group (0-%d): ", MCAST_GROUPS - 1);
+scanf("%d", &g);
+if (g < 0 || g >= MCAST_GROUPS) {
+	printf("No such group\n");
+	return -1;
+}
+return g;
+}
+
+void set_group_mcast(struct man_port_at_man *list, char cmd)
+{
+struct man_port_at_man **group;
+char msg[MAN_MSG_LENGTH];
+int num, g, i, n;
+
+g = man_get_mcast_group();
+if (g < 0) return;
+group = man_get_group(list, "Enter hosts", &num);
+n = sprintf(msg, "%c %d", cmd, g);
+for (i=0; i<num; i++) {
+	man_send(group[i], msg, n);
+}
+printf("%d hosts %s multicast group %d\n", num,
+	cmd == 'j' ? "joined" : "left", g);
+man_wait(TENMILLISEC);
+free(group);
+}
+
+/*
+ * Join the receivers to the group, give the joins time to reach
+ * the switches, and have the current host send the file to the
+ * group: 'f' followed by the group, the number of receivers, and
+ * the file name.  The host reports when every receiver has it.
+ */
+void file_multicast(struct man_port_at_man *list,
+		struct man_port_at_man *curr_host)
+{
+struct man_port_at_man **group;
+char name[NAME_LENGTH];
+char msg[MAN_MSG_LENGTH];
+int num, receivers, g, i, n;
+
+printf("Enter file name to multicast: ");
+scanf("%s", name);
+g = man_get_mcast_group();
+if (g < 0) return;
+group = man_get_group(list, "Enter receiving hosts", &num);
+n = sprintf(msg, "j %d", g);
+receivers = 0;
+for (i=0; i<num; i++) {
+	if (group[i] == curr_host) continue;
+	man_send(group[i], msg, n);
+	receivers++;
+}
+if (receivers > 0) {
+	man_wait(MCAST_JOIN_WAIT);
+	n = sprintf(msg, "f %d %d %s", g, receivers, name);
+	man_send(curr_host, msg, n);
+	printf("Multicasting %s from host %d to %d hosts in group %d\n",
+		name, curr_host->host_id, receivers, g);
+}
+man_wait(TENMILLISEC);
+free(group);
+}
+
+/*
+ * Ping mesh.  In round r every host i of the group pings host
+ * i+r, so each host has one ping outstanding, and after k-1
+ * rounds every pair has been tried.  The round trip times are
+ * shown as a matrix for small groups, and summed up for all.
+ */
+#define MESH_MATRIX_MAX 16	/* Largest group shown as a matrix */
+
+static double *g_mesh_rtt;	/* Milliseconds, or -1 if no reply */
+static struct man_port_at_man **g_mesh_group;
+static int g_mesh_num;
+static int g_mesh_round;
+
+static void mesh_reply(struct man_port_at_man *host, char reply[])
+{
+double rtt;
+int i;
+
+for (i=0; i<g_mesh_num && g_mesh_group[i] != host; i++);
+if (i == g_mesh_num) return;
+if (reply == NULL || sscanf(reply, "Ping acked! rtt=%lf", &rtt) != 1) {
+	rtt = -1;
+}
+g_mesh_rtt[i * g_mesh_num + (i + g_mesh_round) % g_mesh_num] = rtt;
+}
+
+void ping_mesh(struct man_port_at_man *list)
+{
+char msg[MAN_MSG_LENGTH];
+double rtt, min, max, sum;
+int reached, pairs;
+int k, r, i, j, n;
+
+g_mesh_group = man_get_group(list, "Enter hosts", &g_mesh_num);
+k = g_mesh_num;
+g_mesh_rtt = (double *) malloc(k * k * sizeof(double));
+for (i=0; i<k*k; i++) g_mesh_rtt[i] = -1;
+
+for (r=1; r<k; r++) {
+	g_mesh_round = r;
+	for (i=0; i<k; i++) {
+		n = sprintf(msg, "p %d", g_mesh_group[(i+r)%k]->host_id);
+		man_request(g_mesh_group[i], msg, n, mesh_reply);
+	}
+	man_collect();
+}
+
+if (k <= MESH_MATRIX_MAX) {
+	printf("Round trip times (ms), from row to column:\n       ");
+	for (j=0; j<k; j++) printf(" %7d", g_mesh_group[j]->host_id);
+	printf("\n");
+	for (i=0; i<k; i++) {
+		printf("   %4d", g_mesh_group[i]->host_id);
+		for (j=0; j<k; j++) {
+			rtt = g_mesh_rtt[i*k+j];
+			if (i == j) printf(" %7s", "");
+			else if (rtt < 0) printf(" %7s", "-");
+			else printf(" %7.2f", rtt);
+		}
+		printf("\n");
+	}
+}
+reached = 0;
+pairs = k * (k - 1);
+min = max = sum = 0;
+for (i=0; i<k*k; i++) {
+	rtt = g_mesh_rtt[i];
+	if (i / k == i % k || rtt < 0) continue;
+	if (reached == 0 || rtt < min) min = rtt;
+	if (reached == 0 || rtt > max) max = rtt;
+	sum += rtt;
+	reached++;
+}
+printf("Ping mesh of %d hosts: %d of %d pairs replied", k, reached, pairs);
+if (reached > 0) {
+	printf(", rtt min %.2f avg %.2f max %.2f ms",
+		min, sum / reached, max);
+}
+printf("\n");
+free(g_mesh_rtt);
+free(g_mesh_group);
+}
+
+/*
+ * Load tests.  Each source host runs a traffic generator to the
+ * destinations (traffic.h), and the hosts' sinks are asked later
+ * for what they received.
+ */
+void group_traffic(struct man_port_at_man *list)
+{
+struct man_port_at_man **src;
+struct man_port_at_man *p;
+char dsts[NAME_LENGTH];
+char msg[MAN_MSG_LENGTH];
+char pattern;
+double rate;
+int src_num, size, ms, on_ms, off_ms, max_id;
+int i, n;
+
+src = man_get_group(list, "Enter source hosts", &src_num);
+printf("Enter destination hosts (all, or e.g. 0-3,7): ");
+scanf("%99s", dsts);
+if (strcmp(dsts, "all") == 0) {
+	for (max_id=0, p=list; p!=NULL; p=p->next) {
+		if (p->host_id > max_id) max_id = p->host_id;
+	}
+	sprintf(dsts, "0-%d", max_id);
+}
+printf("Enter packets per second: ");
+scanf("%lf", &rate);
+printf("Enter payload bytes: ");
+scanf("%d", &size);
+printf("Enter pattern (c = constant, p = Poisson, b = on/off bursts): ");
+scanf(" %c", &pattern);
+on_ms = off_ms = 0;
+if (pattern == 'b') {
+	printf("Enter on and off periods (ms): ");
+	scanf("%d %d", &on_ms, &off_ms);
+}
+printf("Enter time to run (ms): ");
+scanf("%d", &ms);
+
+n = sprintf(msg, "g %s %.3f %d %c %d %d %d", dsts, rate, size,
+	pattern, ms, on_ms, off_ms);
+for (i=0; i<src_num; i++) {
+	man_send(src[i], msg, n);
+}
+printf("Started load test from %d hosts to %s\n", src_num, dsts);
+man_wait(TENMILLISEC);
+free(src);
+}
+
+/* Totals of the group's sink reports */
+static long g_sink_packets, g_sink_bytes, g_sink_lost;
+static int g_sink_replies;
+
+static void sink_reply(struct man_port_at_man *host, char reply[])
+{
+long packets, bytes, lost, reordered;
+long long avg, min, max;
+double secs;
+int flows;
+
+if (reply == NULL || sscanf(reply, "%d %ld %ld %ld %ld %lf %lld %lld %lld",
+		&flows, &packets, &bytes, &lost, &reordered, &secs,
+		&avg, &min, &max) != 9) {
+	printf("   %6d  no reply\n", host->host_id);
+	return;
+}
+g_sink_replies++;
+if (flows == 0) return;
+printf("   %6d %6d %10ld %10ld %8ld %8ld %10.1f %8.2f %8.2f %8.2f\n",
+	host->host_id, flows, packets, bytes, lost, reordered,
+	secs > 0 ? bytes / 1024.0 / secs : 0.0,
+	avg / 1000.0, min / 1000.0, max / 1000.0);
+g_sink_packets += packets;
+g_sink_bytes += bytes;
+g_sink_lost += lost;
+}
+
+void group_traffic_report(struct man_port_at_man *list)
+{
+struct man_port_at_man **group;
+char msg[MAN_MSG_LENGTH];
+int num, clear, i, n;
+
+group = man_get_group(list, "Enter hosts", &num);
+printf("Clear the counts after (1 = yes, 0 = no): ");
+scanf("%d", &clear);
+g_sink_packets = g_sink_bytes = g_sink_lost = 0;
+g_sink_replies = 0;
+printf("     Host  Flows    Packets      Bytes     Lost  Reorder "
+	"     KB/s   Avg ms   Min ms   Max ms\n");
+n = sprintf(msg, "r %d", clear == 1);
+for (i=0; i<num; i++) {
+	man_request(group[i], msg, n, sink_reply);
+}
+man_collect();
+printf("   %d of %d hosts replied: received %ld packets, %ld bytes, "
+	"%ld lost (%.2f%%)\n", g_sink_replies, num, g_sink_packets,
+	g_sink_bytes, g_sink_lost, g_sink_packets + g_sink_lost > 0
+	? 100.0 * g_sink_lost / (g_sink_packets + g_sink_lost) : 0.0);
+free(group);
+}
+
+
+/*
+ * Dashboard.  Every interval the hosts of a group are asked for
+ * their counters ('k'), and the rates since the last sample are
+ * shown for each host and each of its links, busiest first, in
+ * place on a terminal.  Rates use the hosts' own times of the
+ * samples, so they hold under the simulator too.  Every row can
+ * also go to a CSV file.  Links are seen from the hosts' ends;
+ * switches have no port to the manager.
+ */
+#define DASH_PORTS_MAX 32	/* Ports of a host kept */
+#define DASH_ROWS_MAX 20	/* Busiest hosts and links shown */
+#define DASH_SILENT_MAX 32	/* Hosts listed as not replying */
+
+struct dash_port {
+	int peer;
+	long tx, rx;		/* Packets */
+	long tx_bytes, rx_bytes;
+	long drops, crc;
+	int tx_q, rx_q;		/* Bytes in the port's buffers */
+};
+
+struct dash_sample {
+	long long t;		/* Host's time of the sample, -1 if none */
+	int jobs;
+	int port_num;
+	struct dash_port port[DASH_PORTS_MAX];
+};
+
+struct dash_row {
+	int host;
+	int peer;		/* -1 for the host's total */
+	double tx, rx, tx_bytes, rx_bytes, drops, crc;	/* Per second */
+	int tx_q, rx_q;
+	int jobs;
+};
+
+static struct dash_sample *g_dash_cur;
+static int *g_dash_index;	/* Position in the group of each host id */
+
+static void dash_reply(struct man_port_at_man *host, char reply[])
+{
+struct dash_sample *s;
+struct dash_port *p;
+char *c;
+int num, k;
+
+s = &g_dash_cur[g_dash_index[host->host_id]];
+s->t = -1;
+if (reply == NULL) return;
+c = reply;
+s->t = strtoll(c, &c, 10);
+s->jobs = (int) strtol(c, &c, 10);
+num = (int) strtol(c, &c, 10);
+if (num > DASH_PORTS_MAX) num = DASH_PORTS_MAX;
+for (k=0; k<num; k++) {
+	p = &s->port[k];
+	p->peer = (int) strtol(c, &c, 10);
+	p->tx = strtol(c, &c, 10);
+	p->rx = strtol(c, &c, 10);
+	p->tx_bytes = strtol(c, &c, 10);
+	p->rx_bytes = strtol(c, &c, 10);
+	p->drops = strtol(c, &c, 10);
+	p->crc = strtol(c, &c, 10);
+	p->tx_q = (int) strtol(c, &c, 10);
+	p->rx_q = (int) strtol(c, &c, 10);
+}
+s->port_num = num;
+}
+
+/* Ask every host of the group for a sample, into g_dash_cur[] */
+static void dash_sample(struct man_port_at_man **group, int num)
+{
+char msg[MAN_MSG_LENGTH];
+int i;
+
+msg[0] = 'k';
+for (i=0; i<num; i++) {
+	g_dash_cur[i].t = -1;
+	man_request(group[i], msg, 1, dash_reply);
+}
+man_collect();
+}
+
+/* Rates of port b since port a, over dt seconds */
+static void dash_rate(struct dash_row *r, struct dash_port *a,
+		struct dash_port *b, double dt)
+{
+r->tx += (b->tx - a->tx) / dt;
+r->rx += (b->rx - a->rx) / dt;
+r->tx_bytes += (b->tx_bytes - a->tx_bytes) / dt;
+r->rx_bytes += (b->rx_bytes - a->rx_bytes) / dt;
+r->drops += (b->drops - a->drops) / dt;
+r->crc += (b->crc - a->crc) / dt;
+r->tx_q += b->tx_q;
+r->rx_q += b->rx_q;
+}
+
+/* Busiest first */
+static int dash_row_cmp(const void *x, const void *y)
+{
+const struct dash_row *a = (const struct dash_row *) x;
+const struct dash_row *b = (const struct dash_row *) y;
+double ta = a->tx_bytes + a->rx_bytes;
+double tb = b->tx_bytes + b->rx_bytes;
+
+if (ta != tb) return ta > tb ? -1 : 1;
+if (a->host != b->host) return a->host < b->host ? -1 : 1;
+return a->peer < b->peer ? -1 : a->peer > b->peer;
+}
+
+static void dash_print_rows(char title[], struct dash_row *row, int num)
+{
+int i;
+
+printf("   %-12s %9s %9s %10s %10s %8s %8s %7s %7s\n", title,
+	"Pkt/s tx", "Pkt/s rx", "KB/s tx", "KB/s rx", "Drop/s",
+	"CRC/s", "Txq B", "Rxq B");
+if (num > DASH_ROWS_MAX) num = DASH_ROWS_MAX;
+for (i=0; i<num; i++) {
+	if (row[i].peer < 0) printf("   %-12d", row[i].host);
+	else printf("   %5d->%-5d", row[i].host, row[i].peer);
+	printf(" %9.0f %9.0f %10.1f %10.1f %8.1f %8.1f %7d %7d",
+		row[i].tx, row[i].rx, row[i].tx_bytes / 1000,
+		row[i].rx_bytes / 1000, row[i].drops, row[i].crc,
+		row[i].tx_q, row[i].rx_q);
+	if (row[i].peer < 0) printf("  jobs %d", row[i].jobs);
+	printf("\n");
+}
+}
+
+static void dash_csv_rows(FILE *fp, double t, struct dash_row *row, int num)
+{
+int i;
+
+for (i=0; i<num; i++) {
+	fprintf(fp, "%.3f,%d,", t, row[i].host);
+	if (row[i].peer >= 0) fprintf(fp, "%d", row[i].peer);
+	fprintf(fp, ",%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%d,%d,",
+		row[i].tx, row[i].rx, row[i].tx_bytes, row[i].rx_bytes,
+		row[i].drops, row[i].crc, row[i].tx_q, row[i].rx_q);
+	if (row[i].peer < 0) fprintf(fp, "%d", row[i].jobs);
+	fprintf(fp, "\n");
+}
+}
+
+/* A line has been typed on the manager's terminal; take it */
+static int dash_stop_typed()
+{
+struct pollfd pfd;
+int c;
+
+pfd.fd = STDIN_FILENO;
+pfd.events = POLLIN;
+if (poll(&pfd, 1, 0) <= 0) return 0;
+while ((c = getchar()) != '\n' && c != EOF);
+return 1;
+}
+
+void dashboard(struct man_port_at_man *list)
+{
+struct man_port_at_man **group;
+struct dash_sample *prev;
+struct dash_sample *tmp;
+struct dash_row *hosts;
+struct dash_row *links;
+struct dash_row *r;
+char name[NAME_LENGTH];
+FILE *fp = NULL;
+long long t0 = -1;
+double dt;
+int num, host_num, link_num, silent;
+int ms, refreshes, tty;
+int i, k, j, n, max_id;
+
+group = man_get_group(list, "Enter hosts", &num);
+printf("Enter refresh interval (ms): ");
+scanf("%d", &ms);
+printf("Enter number of refreshes (0 = until Enter): ");
+scanf("%d", &refreshes);
+printf("Enter CSV file to log to (- for none): ");
+scanf("%s", name);
+if (num == 0 || ms <= 0) {
+	free(group);
+	return;
+}
+if (strcmp(name, "-") != 0) {
+	fp = fopen(name, "w");
+	if (fp == NULL) perror(name);
+	else fprintf(fp, "time,host,peer,tx_pkts,rx_pkts,tx_bytes,"
+		"rx_bytes,drops,crc_errors,tx_queue,rx_queue,jobs\n");
+}
+
+for (max_id=0, i=0; i<num; i++) {
+	if (group[i]->host_id > max_id) max_id = group[i]->host_id;
+}
+g_dash_index = (int *) malloc((max_id + 1) * sizeof(int));
+for (i=0; i<num; i++) g_dash_index[group[i]->host_id] = i;
+prev = (struct dash_sample *) malloc(num * sizeof(struct dash_sample));
+g_dash_cur = (struct dash_sample *) malloc(num * sizeof(struct dash_sample));
+hosts = (struct dash_row *) malloc(num * sizeof(struct dash_row));
+links = (struct dash_row *)
+	malloc(num * DASH_PORTS_MAX * sizeof(struct dash_row));
+tty = isatty(STDOUT_FILENO);
+
+dash_sample(group, num);
+for (n = 1; refreshes == 0 || n <= refreshes; n++) {
+	tmp = prev;
+	prev = g_dash_cur;
+	g_dash_cur = tmp;
+	man_wait((long long) ms * 1000);
+	dash_sample(group, num);
+
+	host_num = link_num = silent = 0;
+	for (i=0; i<num; i++) {
+		if (g_dash_cur[i].t < 0 || prev[i].t < 0
+				|| g_dash_cur[i].t <= prev[i].t
+				|| g_dash_cur[i].port_num != prev[i].port_num) {
+			silent += g_dash_cur[i].t < 0;
+			continue;
+		}
+		if (t0 < 0) t0 = prev[i].t;
+		dt = (g_dash_cur[i].t - prev[i].t) / 1e6;
+		r = &hosts[host_num++];
+		memset(r, 0, sizeof(struct dash_row));
+		r->host = group[i]->host_id;
+		r->peer = -1;
+		r->jobs = g_dash_cur[i].jobs;
+		for (k=0; k<g_dash_cur[i].port_num; k++) {
+			dash_rate(r, &prev[i].port[k], &g_dash_cur[i].port[k], dt);
+			memset(&links[link_num], 0, sizeof(struct dash_row));
+			links[link_num].host = r->host;
+			links[link_num].peer = g_dash_cur[i].port[k].peer;
+			dash_rate(&links[link_num++], &prev[i].port[k],
+				&g_dash_cur[i].port[k], dt);
+		}
+		if (fp != NULL) {
+			dt = (g_dash_cur[i].t - t0) / 1e6;
+			dash_csv_rows(fp, dt, r, 1);
+			dash_csv_rows(fp, dt, links + link_num
+				- g_dash_cur[i].port_num, g_dash_cur[i].port_num);
+		}
+	}
+	if (fp != NULL) fflush(fp);
+	qsort(hosts, host_num, sizeof(struct dash_row), dash_row_cmp);
+	qsort(links, link_num, sizeof(struct dash_row), dash_row_cmp);
+
+	if (tty) printf("\033[H\033[J");	/* Redraw in place */
+	printf("Dashboard of %d hosts every %d ms, refresh %d", num, ms, n);
+	if (refreshes > 0) printf(" of %d", refreshes);
+	else printf(", Enter to stop");
+	printf("\n\n");
+	dash_print_rows("Host", hosts, host_num);
+	printf("\n");
+	dash_print_rows("Link", links, link_num);
+	if (silent > 0) {
+		printf("\n   %d hosts did not reply:", silent);
+		for (i=0, j=0; i<num && j<DASH_SILENT_MAX; i++) {
+			if (g_dash_cur[i].t >= 0) continue;
+			printf(" %d", group[i]->host_id);
+			j++;
+		}
+		if (silent > j) printf(" ...");
+		printf("\n");
+	}
+	fflush(stdout);
+	if (refreshes == 0 && dash_stop_typed()) break;
+}
+
+if (fp != NULL) fclose(fp);
+free(links);
+free(hosts);
+free(g_dash_cur);
+free(prev);
+free(g_dash_index);
+free(group);
 }
 
 
@@ -244,6 +1328,9 @@ while(1) {
 		case 'm': /* Set host directory */
 			set_host_dir(curr_host);
 			break;
+		case 'l': /* List the files in the host's directory */
+			list_host_files(curr_host);
+			break;
 		case 'h': /* Display all hosts connected to manager */
 			display_host(host_list, curr_host);
 			break;
@@ -258,7 +1345,55 @@ while(1) {
 			file_upload(curr_host);
 			break;
 		case 'd': /* Download a file from a host */
-			printf("This command is not implemented\n");
+			file_download(curr_host);
+			break;
+		case 'w': /* Set the transport window */
+			set_host_window(curr_host);
+			break;
+		case 'z': /* Set upload compression */
+			set_host_compress(curr_host);
+			break;
+		case 'x': /* Set delta uploads */
+			set_host_delta(curr_host);
+			break;
+		case 'y': /* Set multipath striping */
+			set_host_stripe(curr_host);
+			break;
+		case 'e': /* Set the weight of uploads */
+			set_host_weight(curr_host);
+			break;
+		case 't': /* Let the network run for a while */
+			let_time_pass();
+			break;
+		case 'S': /* State of a group of hosts */
+			display_group_state(host_list);
+			break;
+		case 'M': /* Directory of a group of hosts */
+			set_group_dir(host_list);
+			break;
+		case 'P': /* Ping between all pairs of a group */
+			ping_mesh(host_list);
+			break;
+		case 'U': /* Uploads from a group to a group */
+			group_upload(host_list);
+			break;
+		case 'J': /* Join a multicast group */
+			set_group_mcast(host_list, 'j');
+			break;
+		case 'L': /* Leave a multicast group */
+			set_group_mcast(host_list, 'l');
+			break;
+		case 'F': /* Multicast a file */
+			file_multicast(host_list, curr_host);
+			break;
+		case 'G': /* Load test from a group of hosts */
+			group_traffic(host_list);
+			break;
+		case 'R': /* What the load test delivered */
+			group_traffic_report(host_list);
+			break;
+		case 'D': /* Live traffic of a group of hosts */
+			dashboard(host_list);
 			break;
 		case 'q':  /* Quit */
 			return;
@@ -3,17 +3,28 @@
  */
 
 #define MAN_MSG_LENGTH 1000
+#define MAN_TAG_LEN 24		/* Room for a reply's "#tag length:" */
 
 
 /*
  *  The next two structs are ports used to transfer commands
- *  and replies between the manager and hosts
+ *  and replies between the manager and hosts.
+ *
+ *  A command that is answered goes as "#tag cmd args", with a tag
+ *  the manager numbers its requests to the host by, and the host
+ *  writes the reply as "#tag length:" and the reply.  A reply that
+ *  comes after the manager has given up on it so is not taken for
+ *  the answer to the next command.
  */
 
 struct man_port_at_host {  /* Port located at the man */
 	int host_id;
 	int send_fd;
 	int recv_fd;
+	struct uring_chan *urx;	/* io_uring channel for recv_fd, or NULL */
+	int tag;		/* Of the command being carried out, or 0 */
+	char rx_buf[MAN_MSG_LENGTH];	/* Read, not yet taken as commands */
+	int rx_len;
 	struct man_port_at_host *next;
 };
 
@@ -21,6 +32,11 @@ struct man_port_at_man {  /* Port located at the host */
 	int host_id;
 	int send_fd;
 	int recv_fd;
+	int watched;		/* recv_fd is in the manager's epoll set */
+	char pending;		/* Command awaiting a reply, or 0 */
+	int tag;		/*    and its tag */
+	void (*on_reply)(struct man_port_at_man *host, char reply[]);
+				/* Takes the reply, NULL if none came */
 	struct man_port_at_man *next;
 };
 
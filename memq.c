@@ -0,0 +1,76 @@
+/*
+ * memq.c
+ *
+ * Single-producer single-consumer byte ring.  head and tail count
+ * bytes ever read and written, so the queue holds tail - head bytes
+ * and their positions in buf[] are the counts modulo cap.  Each side
+ * only stores its own count, with release order so the other side,
+ * loading it with acquire order, sees the bytes it covers.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "memq.h"
+
+struct memq *memq_create(int cap)
+{
+struct memq *q;
+int c;
+
+for (c=1; c<cap; c*=2);
+q = (struct memq *) calloc(1, sizeof(struct memq));
+q->cap = c;
+q->buf = (char *) malloc(c);
+atomic_init(&q->head, 0);
+atomic_init(&q->tail, 0);
+return(q);
+}
+
+int memq_write(struct memq *q, char *data, int n)
+{
+long head, tail;
+int room, pos, k;
+
+tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+head = atomic_load_explicit(&q->head, memory_order_acquire);
+room = q->cap - (int) (tail - head);
+if (n > room) n = room;
+if (n <= 0) return 0;
+
+pos = (int) (tail & (q->cap - 1));
+k = q->cap - pos < n ? q->cap - pos : n;	/* Up to the end of buf */
+memcpy(q->buf + pos, data, k);
+memcpy(q->buf, data + k, n - k);
+atomic_store_explicit(&q->tail, tail + n, memory_order_release);
+return n;
+}
+
+int memq_read(struct memq *q, char *data, int n)
+{
+long head, tail;
+int avail, pos, k;
+
+head = atomic_load_explicit(&q->head, memory_order_relaxed);
+tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+avail = (int) (tail - head);
+if (n > avail) n = avail;
+if (n <= 0) return 0;
+
+pos = (int) (head & (q->cap - 1));
+k = q->cap - pos < n ? q->cap - pos : n;
+memcpy(data, q->buf + pos, k);
+memcpy(data + k, q->buf, n - k);
+atomic_store_explicit(&q->head, head + n, memory_order_release);
+return n;
+}
+
+int memq_room(struct memq *q)
+{
+long head, tail;
+
+tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+head = atomic_load_explicit(&q->head, memory_order_acquire);
+return q->cap - (int) (tail - head);
+}
@@ -0,0 +1,30 @@
+/*
+ * memq.h
+ *
+ * A byte queue in memory with one writer and one reader, which may
+ * be different threads.  It stands in for a pipe between nodes that
+ * run as threads of one process (net367 -t): like a nonblocking
+ * pipe, a write takes what fits and a read takes what is there,
+ * but neither makes a system call or takes a lock.
+ */
+
+struct memq {
+	_Atomic long head;	/* Bytes read so far, set by the reader */
+	char pad1[64 - sizeof(long)];	/* Keep head and tail on */
+	_Atomic long tail;	/* Bytes written so far, set by the writer */
+	char pad2[64 - sizeof(long)];	/*    their own cache lines */
+	int cap;		/* A power of 2 */
+	char *buf;
+};
+
+/* A queue that holds up to 'cap' bytes, rounded up to a power of 2 */
+struct memq *memq_create(int cap);
+
+/* Write up to n bytes; returns how many fit, 0 if the queue is full */
+int memq_write(struct memq *q, char *data, int n);
+
+/* Read up to n bytes; returns how many there were, 0 if none */
+int memq_read(struct memq *q, char *data, int n);
+
+/* Bytes a write would take now; only grows until the writer writes */
+int memq_room(struct memq *q);
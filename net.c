@@ -26,26 +26,18 @@
 #include "host.h"
 #include "net.h"
 #include "packet.h"
+#include "emu.h"
+#include "memq.h"
+#include "config.h"
 
 
 #define MAX_FILE_NAME 100
 #define PIPE_READ 0
 #define PIPE_WRITE 1
+#define NET_LIST_MAX 64	/* Nodes and links listed when loading */
 
 enum bool {FALSE, TRUE};
 
-/* 
- * Struct used to store a link. It is used when the 
- * network configuration file is loaded.
- */
-
-struct net_link {
-	enum NetLinkType type;
-	int pipe_node0;
-	int pipe_node1;
-};
-
-
 /* 
  * The following are private global variables to this file net.c
  */
@@ -77,12 +69,19 @@ static struct net_port *g_port_list = NULL;
 static struct man_port_at_man *g_man_man_port_list = NULL;
 static struct man_port_at_host *g_man_host_port_list = NULL;
 
+/* Links are made in memory for the simulator rather than with pipes */
+static int g_sim_links = FALSE;
+
+/* Links are queues in memory, for nodes that are threads */
+static int g_memq_links = FALSE;
+#define MEMQ_BYTES 65536	/* As much as a pipe holds */
+
 /* 
  * Loads network configuration file and creates data structures
  * for nodes and links.  The results are accessible through
  * the private global variables
  */
-int load_net_data_file();
+int load_net_data_file(char fname[]);
 
 /*
  * Creates a data structure for the nodes
@@ -95,6 +94,12 @@ void create_node_list();
  */
 void create_port_list();
 
+/*
+ * Link emulation state for one direction of a link, or NULL
+ * if the link is a plain pipe
+ */
+struct link_emu *net_port_emu(struct net_link *link, unsigned int seed);
+
 /*
  * Creates ports at the manager and ports at the hosts so that
  * the manager can communicate with the hosts.  The list of
@@ -104,6 +109,7 @@ void create_port_list();
 void create_man_ports(
 		struct man_port_at_man **p_m, 
 		struct man_port_at_host **p_h);
+void create_man_pipes(struct man_port_at_man *p_m, struct man_port_at_host *p_h);
 
 void net_close_man_ports_at_hosts();
 void net_close_man_ports_at_hosts_except(int host_id);
@@ -123,6 +129,16 @@ struct net_node *net_get_node_list();
 
 
 
+void net_use_sim_links()
+{
+g_sim_links = TRUE;
+}
+
+void net_use_memq_links()
+{
+g_memq_links = TRUE;
+}
+
 /*
  * Remove all the ports for the host from linked lisst g_port_list.
  * and create another linked list.  Return the pointer to this
@@ -159,6 +175,22 @@ struct net_node *net_get_node_list()
 return g_node_list;
 }
 
+int net_get_node_num()
+{
+return g_net_node_num;
+}
+
+int net_get_link_num()
+{
+return g_net_link_num;
+}
+
+void net_get_link_nodes(int i, int *node0, int *node1)
+{
+*node0 = g_net_link[i].pipe_node0;
+*node1 = g_net_link[i].pipe_node1;
+}
+
 /* Return linked list of ports used by the manager to connect to hosts */
 struct man_port_at_man *net_get_man_ports_at_man_list()
 {
@@ -252,15 +284,69 @@ while (p_m != NULL) {
 }
 }
 
+/*
+ * The manager has made node host_id's process, so close the ends of
+ * links and of the manager pipes that only that node uses
+ */
+void net_close_node_ports(int host_id)
+{
+struct net_port *p;
+struct man_port_at_host *p_h;
+
+for (p = g_port_list; p != NULL; p = p->next) {
+	if (p->type == PIPE && p->pipe_host_id == host_id) {
+		close(p->pipe_send_fd);
+		close(p->pipe_recv_fd);
+		p->pipe_send_fd = -1;
+		p->pipe_recv_fd = -1;
+	}
+}
+p_h = net_get_host_port(host_id);
+if (p_h != NULL) {
+	close(p_h->send_fd);
+	close(p_h->recv_fd);
+	p_h->send_fd = -1;
+	p_h->recv_fd = -1;
+}
+}
+
+/*
+ * In node host_id's process, close the pipe ends of other nodes and
+ * of the manager, which it inherited
+ */
+void net_close_ports_except(int host_id)
+{
+struct net_port *p;
+
+for (p = g_port_list; p != NULL; p = p->next) {
+	if (p->type == PIPE && p->pipe_host_id != host_id) {
+		close(p->pipe_send_fd);
+		close(p->pipe_recv_fd);
+	}
+}
+net_close_man_ports_at_hosts_except(host_id);
+net_close_man_ports_at_man();
+}
+
 
 /* Initialize network ports and links */
 int net_init()
 {
+char fname[MAX_FILE_NAME];
+
+printf("Enter network data file: ");
+scanf("%s", fname);
+return(net_init_file(fname));
+}
+
+/* Initialize network ports and links from configuration file fname */
+int net_init_file(char fname[])
+{
 if (g_initialized == TRUE) { /* Check if the network is already initialized */
 	printf("Network already loaded\n");
 	return(0);
 }		
-else if (load_net_data_file()==0) { /* Load network configuration file */
+else if (load_net_data_file(fname)==0) { /* Load network configuration file */
 	return(0);
 }
 /* 
@@ -282,6 +368,52 @@ create_port_list();
  * as a linked list
  */
 create_man_ports(&g_man_man_port_list, &g_man_host_port_list);
+g_initialized = TRUE;
+return(1);
+}
+
+/* Create the pipes between the manager and one host */
+void create_man_pipes(struct man_port_at_man *p_m, struct man_port_at_host *p_h)
+{
+int fd0[2];
+int fd1[2];
+
+pipe(fd0); /* Create a pipe */
+	/* Make the pipe nonblocking at both ends */
+fcntl(fd0[PIPE_WRITE], F_SETFL, 
+		fcntl(fd0[PIPE_WRITE], F_GETFL) | O_NONBLOCK);
+fcntl(fd0[PIPE_READ], F_SETFL, 
+		fcntl(fd0[PIPE_READ], F_GETFL) | O_NONBLOCK);
+p_m->send_fd = fd0[PIPE_WRITE];
+p_h->recv_fd = fd0[PIPE_READ];
+
+pipe(fd1); /* Create a pipe */
+	/* Make the pipe nonblocking at both ends */
+fcntl(fd1[PIPE_WRITE], F_SETFL, 
+		fcntl(fd1[PIPE_WRITE], F_GETFL) | O_NONBLOCK);
+fcntl(fd1[PIPE_READ], F_SETFL, 
+		fcntl(fd1[PIPE_READ], F_GETFL) | O_NONBLOCK);
+p_h->send_fd = fd1[PIPE_WRITE];
+p_m->recv_fd = fd1[PIPE_READ];
+}
+
+/*
+ * Under the simulator a host's pipes to the manager are only
+ * made when the manager first talks to it, so that a large
+ * network does not need four files for every host
+ */
+void net_open_man_port(int host_id)
+{
+struct man_port_at_man *p_m;
+struct man_port_at_host *p_h;
+
+for (p_m = g_man_man_port_list;
+	p_m != NULL && p_m->host_id != host_id;
+	p_m = p_m->next);
+p_h = net_get_host_port(host_id);
+if (p_m != NULL && p_h != NULL && p_m->send_fd < 0) {
+	create_man_pipes(p_m, p_h);
+}
 }
 
 /*
@@ -296,8 +428,6 @@ void create_man_ports(
 		struct man_port_at_host **p_host)
 {
 struct net_node *p;
-int fd0[2];
-int fd1[2];
 struct man_port_at_man *p_m;
 struct man_port_at_host *p_h;
 int host;
@@ -306,30 +436,20 @@ int host;
 for (p=g_node_list; p!=NULL; p=p->next) {
 	if (p->type == HOST) {
 		p_m = (struct man_port_at_man *) 
-			malloc(sizeof(struct man_port_at_man));
+			calloc(1, sizeof(struct man_port_at_man));
 		p_m->host_id = p->id;
 
 		p_h = (struct man_port_at_host *) 
-			malloc(sizeof(struct man_port_at_host));
+			calloc(1, sizeof(struct man_port_at_host));
 		p_h->host_id = p->id;
 
-		pipe(fd0); /* Create a pipe */
-			/* Make the pipe nonblocking at both ends */
-		fcntl(fd0[PIPE_WRITE], F_SETFL, 
-				fcntl(fd0[PIPE_WRITE], F_GETFL) | O_NONBLOCK);
-		fcntl(fd0[PIPE_READ], F_SETFL, 
-				fcntl(fd0[PIPE_READ], F_GETFL) | O_NONBLOCK);
-		p_m->send_fd = fd0[PIPE_WRITE];
-		p_h->recv_fd = fd0[PIPE_READ];
-
-		pipe(fd1); /* Create a pipe */
-			/* Make the pipe nonblocking at both ends */
-		fcntl(fd1[PIPE_WRITE], F_SETFL, 
-				fcntl(fd1[PIPE_WRITE], F_GETFL) | O_NONBLOCK);
-		fcntl(fd1[PIPE_READ], F_SETFL, 
-				fcntl(fd1[PIPE_READ], F_GETFL) | O_NONBLOCK);
-		p_h->send_fd = fd1[PIPE_WRITE];
-		p_m->recv_fd = fd1[PIPE_READ];
+		if (g_sim_links == TRUE) {	/* Opened when first used */
+			p_m->send_fd = p_m->recv_fd = -1;
+			p_h->send_fd = p_h->recv_fd = -1;
+		}
+		else {
+			create_man_pipes(p_m, p_h);
+		}
 
 		p_m->next = *p_man;
 		*p_man = p_m;
@@ -358,6 +478,17 @@ for (i=0; i<g_net_node_num; i++) {
 
 }
 
+struct link_emu *net_port_emu(struct net_link *link, unsigned int seed)
+{
+struct link_emu *e;
+
+if (!emu_active(&link->emu)) return(NULL);
+e = (struct link_emu *) malloc(sizeof(struct link_emu));
+*e = link->emu;
+emu_seed(e, seed);
+return(e);
+}
+
 /*
  * Create links, each with either a pipe or socket.
  * It uses private global varaibles g_net_link[] and g_net_link_num
@@ -378,13 +509,51 @@ for (i=0; i<g_net_link_num; i++) {
 		node0 = g_net_link[i].pipe_node0;
 		node1 = g_net_link[i].pipe_node1;
 
-		p0 = (struct net_port *) malloc(sizeof(struct net_port));
+		p0 = (struct net_port *) calloc(1, sizeof(struct net_port));
 		p0->type = g_net_link[i].type;
 		p0->pipe_host_id = node0;
+		p0->pipe_peer_id = node1;
+		p0->crc = g_net_link[i].crc;
+		p0->mtu = g_net_link[i].mtu;
+		p0->emu = net_port_emu(&g_net_link[i], 2*i);
 
-		p1 = (struct net_port *) malloc(sizeof(struct net_port));
+		p1 = (struct net_port *) calloc(1, sizeof(struct net_port));
 		p1->type = g_net_link[i].type;
 		p1->pipe_host_id = node1;
+		p1->pipe_peer_id = node0;
+		p1->crc = g_net_link[i].crc;
+		p1->mtu = g_net_link[i].mtu;
+		p1->emu = net_port_emu(&g_net_link[i], 2*i+1);
+
+		if (g_sim_links == TRUE) {
+			p0->type = SIM;
+			p1->type = SIM;
+			p0->peer = p1;
+			p1->peer = p0;
+			p0->release_at = -1;
+			p1->release_at = -1;
+			p0->next = p1;
+			p1->next = g_port_list;
+			g_port_list = p0;
+			continue;
+		}
+
+		if (g_memq_links == TRUE) {
+			p0->type = MEMQ;
+			p1->type = MEMQ;
+			p0->tx_q = memq_create(MEMQ_BYTES);
+			p1->rx_q = p0->tx_q;
+			p1->tx_q = memq_create(MEMQ_BYTES);
+			p0->rx_q = p1->tx_q;
+			p0->pipe_send_fd = -1;
+			p0->pipe_recv_fd = -1;
+			p1->pipe_send_fd = -1;
+			p1->pipe_recv_fd = -1;
+			p0->next = p1;
+			p1->next = g_port_list;
+			g_port_list = p0;
+			continue;
+		}
 
 		pipe(fd01);  /* Create a pipe */
 			/* Make the pipe nonblocking at both ends */
@@ -417,128 +586,59 @@ for (i=0; i<g_net_link_num; i++) {
  * Loads network configuration file and creates data structures
  * for nodes and links. 
  */
-int load_net_data_file()
+int load_net_data_file(char fname[])
 {
-FILE *fp;
-char fname[MAX_FILE_NAME];
-
-	/* Open network configuration file */
-printf("Enter network data file: ");
-scanf("%s", fname);
-fp = fopen(fname, "r");
-if (fp == NULL) { 
-	printf("net.c: File did not open\n"); 
-	return(0);
-}
-
+struct net_config c;
+char emu_str[2*STRING_MAX];
 int i;
-int node_num;
-char node_type;
-int node_id;
-
-	/* 
-	 * Read node information from the file and
-	 * fill in data structure for nodes.
-	 * The data structure is an array g_net_node[ ]
-	 * and the size of the array is g_net_node_num.
-	 * Note that g_net_node[] and g_net_node_num are
-	 * private global variables.
-	 */
-fscanf(fp, "%d", &node_num);
-printf("Number of Nodes = %d: \n", node_num);
-g_net_node_num = node_num;
-
-if (node_num < 1) { 
-	printf("net.c: No nodes\n");
-	fclose(fp);
-	return(0);
-}
-else { 
-	g_net_node =(struct net_node*) malloc(sizeof(struct net_node)*node_num);
-	for (i=0; i<node_num; i++) { 
-		fscanf(fp, " %c ", &node_type);
 
-		if (node_type = 'H') {
-			fscanf(fp, " %d ", &node_id);
-			g_net_node[i].type = HOST;
-			g_net_node[i].id = node_id;
-		}
-		else {
-			printf(" net.c: Unidentified Node Type\n");
-		}
-
-		if (i != node_id) {
-			printf(" net.c: Incorrect node id\n");
-			fclose(fp);
-			return(0);
-		}
-	}
-}
-	/* 
-	 * Read link information from the file and
-	 * fill in data structure for links.
-	 * The data structure is an array g_net_link[ ]
-	 * and the size of the array is g_net_link_num.
-	 * Note that g_net_link[] and g_net_link_num are
-	 * private global variables.
+	/*
+	 * The nodes go in array g_net_node[] of size g_net_node_num,
+	 * and the links in array g_net_link[] of size g_net_link_num.
+	 * Note that these are private global variables.
 	 */
-
-int link_num;
-char link_type;
-int node0, node1;
-
-fscanf(fp, " %d ", &link_num);
-printf("Number of links = %d\n", link_num);
-g_net_link_num = link_num;
-
-if (link_num < 1) { 
-	printf("net.c: No links\n");
-	fclose(fp);
-	return(0);
-}
-else {
-	g_net_link =(struct net_link*) malloc(sizeof(struct net_link)*link_num);
-	for (i=0; i<link_num; i++) {
-		fscanf(fp, " %c ", &link_type);
-		if (link_type == 'P') {
-			fscanf(fp," %d %d ", &node0, &node1);
-			g_net_link[i].type = PIPE;
-			g_net_link[i].pipe_node0 = node0;
-			g_net_link[i].pipe_node1 = node1;
-		}
-		else {
-			printf("   net.c: Unidentified link type\n");
-		}
-	
-	}
-}
-
-/* Display the nodes and links of the network */
+if (config_load(fname, &c) == 0) return(0);
+g_net_node = c.node;
+g_net_node_num = c.node_num;
+g_net_link = c.link;
+g_net_link_num = c.link_num;
+printf("Number of Nodes = %d: \n", g_net_node_num);
+printf("Number of links = %d\n", g_net_link_num);
+
+/* Display the nodes and links of the network, the first few if big */
 printf("Nodes:\n");
-for (i=0; i<g_net_node_num; i++) {
+for (i=0; i<g_net_node_num && i<NET_LIST_MAX; i++) {
 	if (g_net_node[i].type == HOST) {
 	        printf("   Node %d HOST\n", g_net_node[i].id);
 	}
 	else if (g_net_node[i].type == SWITCH) {
-		printf(" SWITCH\n");
+		printf("   Node %d SWITCH\n", g_net_node[i].id);
 	}
 	else {
 		printf(" Unknown Type\n");
 	}
 }
+if (g_net_node_num > NET_LIST_MAX) {
+	printf("   ... and %d more\n", g_net_node_num - NET_LIST_MAX);
+}
 printf("Links:\n");
-for (i=0; i<g_net_link_num; i++) {
+for (i=0; i<g_net_link_num && i<NET_LIST_MAX; i++) {
 	if (g_net_link[i].type == PIPE) {
-		printf("   Link (%d, %d) PIPE\n", 
+		emu_describe(&g_net_link[i].emu, emu_str);
+		printf("   Link (%d, %d) PIPE mtu=%d%s%s\n", 
 				g_net_link[i].pipe_node0, 
-				g_net_link[i].pipe_node1);
+				g_net_link[i].pipe_node1,
+				g_net_link[i].mtu,
+				g_net_link[i].crc ? " crc" : "",
+				emu_active(&g_net_link[i].emu) ? emu_str : "");
 	}
 	else if (g_net_link[i].type == SOCKET) {
 		printf("   Socket: to be constructed (net.c)\n");
 	}
 }
-
-fclose(fp);
+if (g_net_link_num > NET_LIST_MAX) {
+	printf("   ... and %d more\n", g_net_link_num - NET_LIST_MAX);
+}
 return(1);
 }
 
@@ -2,10 +2,36 @@
 
 int net_init();
 
+/* Same, with the configuration file named rather than asked for */
+int net_init_file(char fname[]);
+
+/* Make links in memory for the simulator; call before net_init() */
+void net_use_sim_links();
+
+/* Make links in memory for nodes run as threads; call before net_init() */
+void net_use_memq_links();
+
+/* Under the simulator, make the pipes between the manager and a host */
+void net_open_man_port(int host_id);
+
 struct man_port_at_man *net_get_man_ports_at_man_list();
 struct man_port_at_host *net_get_host_port(int host_id);
 
 struct net_node *net_get_node_list();
+
+/* Number of nodes; their ids are 0 up to one less */
+int net_get_node_num();
+
+/*
+ * A process per node: the manager closes a node's pipe ends once it
+ * has made its process, and the node closes everyone else's
+ */
+void net_close_node_ports(int host_id);
+void net_close_ports_except(int host_id);
+
+/* The links of the configuration file, by the nodes they join */
+int net_get_link_num();
+void net_get_link_nodes(int i, int *node0, int *node1);
 struct net_port *net_get_port_list(int host_id);
 
 
@@ -1,6 +1,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
@@ -9,58 +11,479 @@
 #include "packet.h"
 #include "net.h"
 #include "host.h"
+#include "crc32c.h"
+#include "emu.h"
+#include "timer.h"
+#include "memq.h"
+#include "uring.h"
+#include "capture.h"
 
+/*
+ * Frame format on a pipe (version 2), integers most significant
+ * byte first:
+ *    byte 0      version, PKT_VERSION
+ *    byte 1      flags, PKT_FLAG_CRC if there is a trailer
+ *    bytes 2-3   packet type
+ *    bytes 4-7   source
+ *    bytes 8-11  destination
+ *    bytes 12-15 payload length, at most the link MTU
+ *    payload
+ *    trailer     optional CRC32C of the header and payload, 4 bytes
+ *
+ * Frames larger than PIPE_BUF are not written atomically, so each
+ * port buffers what it sends and receives.  packet_send() queues
+ * the frame in the port's tx buffer and writes what the pipe
+ * takes; packet_flush() writes the rest later.  packet_recv()
+ * reads whatever is in the pipe into the rx buffer and takes
+ * one whole frame from it.  packet_recv_view() takes the frame
+ * but leaves it where it is, to be read in place or passed on
+ * whole by packet_forward().
+ *
+ * A port with link emulation hands each encoded frame to the
+ * emulator instead, and packet_flush() moves frames into the tx
+ * buffer once the emulator releases them.
+ *
+ * A simulated link (SIM) has no pipe: frames are written straight
+ * into the rx buffer of the port at the other end.  A link between
+ * nodes run as threads (MEMQ) is a pair of in-memory queues, used
+ * just as the pipes would be.
+ *
+ * With capture on (capture.h), a port records each frame it hands
+ * to the link and each it receives whole and intact.
+ */
+#define PKT_VERSION 2
+#define PKT_FLAG_CRC 0x01
+
+#define PORT_TX_FRAMES 8	/* Frames of tx buffer per port */
+#define PORT_BUF_MIN 16384
+#define PORT_PIPE_BYTES 65536	/* What a pipe holds */
+
+static void put32(char *b, unsigned int v)
+{
+b[0] = (char) (v >> 24);
+b[1] = (char) (v >> 16);
+b[2] = (char) (v >> 8);
+b[3] = (char) v;
+}
+
+static unsigned int get32(char *b)
+{
+return ((unsigned int) (unsigned char) b[0] << 24)
+	| ((unsigned int) (unsigned char) b[1] << 16)
+	| ((unsigned int) (unsigned char) b[2] << 8)
+	| (unsigned int) (unsigned char) b[3];
+}
+
+/* The link is a byte stream: a pipe, or a queue in its place */
+static int port_stream(struct net_port *port)
+{
+return port->type == PIPE || port->type == MEMQ;
+}
+
+/* Write to the link what it takes of n bytes; returns how many */
+static int port_write(struct net_port *port, char *data, int n)
+{
+if (port->type == MEMQ) return memq_write(port->tx_q, data, n);
+if (port->utx != NULL) return uring_write(port->utx, data, n);
+return write(port->pipe_send_fd, data, n);
+}
+
+/* Read up to n bytes from the link; returns how many */
+static int port_read(struct net_port *port, char *data, int n)
+{
+if (port->type == MEMQ) return memq_read(port->rx_q, data, n);
+if (port->urx != NULL) return uring_read(port->urx, data, n);
+return read(port->pipe_recv_fd, data, n);
+}
+
+/* Size of the largest frame the port carries */
+static int port_frame_max(struct net_port *port)
+{
+return PKT_HDR_LEN + port->mtu + PKT_CRC_LEN;
+}
+
+/* Largest rx buffer of a simulated link: what a pipe and its tx buffer hold */
+static int port_sim_rx_max(struct net_port *port)
+{
+return 2 * port_frame_max(port) + PORT_PIPE_BYTES
+	+ PORT_TX_FRAMES * port_frame_max(port);
+}
+
+/* Allocate the port's buffers the first time they are needed */
+static void port_buf_alloc(struct net_port *port)
+{
+if (port->tx_buf == NULL && port_stream(port)) {
+	port->tx_cap = PORT_TX_FRAMES * port_frame_max(port);
+	if (port->tx_cap < PORT_BUF_MIN) port->tx_cap = PORT_BUF_MIN;
+	port->tx_buf = (char *) malloc(port->tx_cap);
+	port->tx_head = 0;
+	port->tx_len = 0;
+}
+if (port->rx_buf == NULL) {
+	port->rx_cap = 2 * port_frame_max(port);
+	if (port->rx_cap < PORT_BUF_MIN && port_stream(port)) {
+		port->rx_cap = PORT_BUF_MIN;
+	}
+	port->rx_buf = (char *) malloc(port->rx_cap);
+	port->rx_head = 0;
+	port->rx_len = 0;
+	port->cap = capture_open(port);
+}
+}
+
+/* Encode packet p as a frame in msg[], returning its length */
+static int packet_encode(struct net_port *port, struct packet *p, char *msg)
+{
+unsigned int crc;
+
+msg[0] = PKT_VERSION;
+msg[1] = port->crc ? PKT_FLAG_CRC : 0;
+msg[2] = (char) (p->type >> 8);
+msg[3] = (char) p->type;
+put32(msg+4, (unsigned int) p->src);
+put32(msg+8, (unsigned int) p->dst);
+put32(msg+12, (unsigned int) p->length);
+memcpy(msg+PKT_HDR_LEN, p->payload, p->length);
+if (port->crc) {
+	crc = crc32c(0, msg, PKT_HDR_LEN + p->length);
+	put32(msg + PKT_HDR_LEN + p->length, crc);
+	return PKT_HDR_LEN + p->length + PKT_CRC_LEN;
+}
+return PKT_HDR_LEN + p->length;
+}
+
+/*
+ * Make room for n more bytes at the end of a buffer, moving what
+ * it holds to the front if need be.  Returns 0 if it is too full.
+ */
+static int buf_room(char *buf, int *head, int len, int cap, int n)
+{
+if (len + n > cap) return 0;
+if (*head + len + n > cap) {
+	memmove(buf, buf + *head, len);
+	*head = 0;
+}
+return 1;
+}
+
+/*
+ * Where the port's next frame of n bytes goes: the end of its tx
+ * buffer, or for a simulated link, the end of the rx buffer at the
+ * other end.  Returns NULL if there is no room.  port_commit()
+ * adds the frame once it is written there.
+ */
+static char *port_slot(struct net_port *port, int n)
+{
+struct net_port *q;
+
+if (port->type == SIM) {
+	q = port->peer;
+	port_buf_alloc(q);
+	/* The rx buffer grows, up to what a pipe would hold */
+	while (!buf_room(q->rx_buf, &q->rx_head, q->rx_len, q->rx_cap, n)) {
+		if (q->rx_cap >= port_sim_rx_max(q)) return NULL;
+		q->rx_cap *= 2;
+		q->rx_buf = (char *) realloc(q->rx_buf, q->rx_cap);
+	}
+	return q->rx_buf + q->rx_head + q->rx_len;
+}
+if (!buf_room(port->tx_buf, &port->tx_head, port->tx_len, port->tx_cap, n)) {
+	return NULL;
+}
+return port->tx_buf + port->tx_head + port->tx_len;
+}
+
+static void port_commit(struct net_port *port, int n)
+{
+if (port->type == SIM) port->peer->rx_len += n;
+else port->tx_len += n;
+}
+
+/* Move frames the link emulator has released to the link */
+static void port_emu_release(struct net_port *port)
+{
+long long now;
+char *frame;
+char *slot;
+int n;
+
+now = timer_now_us();
+while ((slot = port_slot(port, port_frame_max(port))) != NULL) {
+	n = emu_dequeue(port->emu, now, &frame);
+	if (n < 0) break;
+	memcpy(slot, frame, n);
+	port_commit(port, n);
+	free(frame);
+}
+}
+
+int packet_deliver(struct net_port *port, char *frame, int n)
+{
+char *slot;
+
+slot = port_slot(port->peer, n);
+if (slot == NULL) {
+	port->rx_drops++;
+	return 0;
+}
+memcpy(slot, frame, n);
+port_commit(port->peer, n);
+return 1;
+}
+
+long long packet_next_release(struct net_port *port)
+{
+if (port->emu == NULL) return -1;
+return emu_next(port->emu);
+}
+
+long long packet_wait(struct net_port *port)
+{
+if (port->emu == NULL) return 0;
+return emu_wait(port->emu, timer_now_us());
+}
+
+void packet_flush(struct net_port *port)
+{
+int n;
+
+if (port->emu != NULL) {
+	port_emu_release(port);
+}
+if (port_stream(port)) {
+	while (port->tx_len > 0) {
+		n = port_write(port,
+			port->tx_buf + port->tx_head, port->tx_len);
+		if (n <= 0) break;	/* Pipe is full */
+		port->tx_head += n;
+		port->tx_len -= n;
+	}
+	if (port->tx_len == 0) port->tx_head = 0;
+}
+}
+
+/*
+ * Where to write a frame of n bytes to send on the port: a buffer
+ * for the link emulator to keep, or the port's next slot.  NULL if
+ * there is no room.
+ */
+static char *port_frame_start(struct net_port *port, int n)
+{
+if (port->emu != NULL) return (char *) malloc(n);
+return port_slot(port, n);
+}
+
+/*
+ * Send the frame of n bytes written where port_frame_start() said.
+ * It goes on to the link at the next packet_flush().
+ */
+static void port_frame_end(struct net_port *port, char *msg, int n)
+{
+if (port->cap != NULL) capture_frame(port->cap, msg, n, CAPTURE_OUT);
+port->tx_packets++;
+port->tx_bytes += n;
+if (port->emu != NULL) {
+	if (!emu_enqueue(port->emu, msg, n, timer_now_us())) {
+		port->tx_drops++;
+	}
+}
+else {
+	port_commit(port, n);
+}
+}
 
 void packet_send(struct net_port *port, struct packet *p)
 {
-char msg[PAYLOAD_MAX+4];
-int i;
+char *msg;
+int n;
+
+if (port_stream(port) || port->type == SIM) {
+	port_buf_alloc(port);
+	packet_flush(port);
 
-if (port->type == PIPE) {
-	msg[0] = (char) p->src; 
-	msg[1] = (char) p->dst;
-	msg[2] = (char) p->type;
-	msg[3] = (char) p->length;
-	for (i=0; i<p->length; i++) {
-		msg[i+4] = p->payload[i];
+	n = PKT_HDR_LEN + p->length + (port->crc ? PKT_CRC_LEN : 0);
+	if (p->length > port->mtu) {
+		port->tx_drops++;
+		return;
 	}
-	write(port->pipe_send_fd, msg, p->length+4);
-//printf("PACKET SEND, src=%d dst=%d p-src=%d p-dst=%d\n", 
-//		(int) msg[0], 
-//		(int) msg[1], 
-//		(int) p->src, 
-//		(int) p->dst);
+	msg = port_frame_start(port, n);
+	if (msg == NULL) {
+		port->tx_drops++;
+		return;
+	}
+	packet_encode(port, p, msg);
+	port_frame_end(port, msg, n);
+	packet_flush(port);
 }
+}
+
+/*
+ * The frame is copied once, into the port's tx buffer or for the
+ * emulator, as it is; only if the two links differ in whether
+ * frames carry a CRC is the trailer added or left off.  Frames
+ * forwarded are written to the pipe when the tx buffer fills or at
+ * the next packet_flush(), so a burst of them takes few writes.
+ */
+void packet_forward(struct net_port *port, struct packet_view *v)
+{
+char *msg;
+int n;
 
-return;
+if (port_stream(port) || port->type == SIM) {
+	port_buf_alloc(port);
+
+	n = PKT_HDR_LEN + v->length;
+	if (v->length > port->mtu) {
+		port->tx_drops++;
+		return;
+	}
+	msg = port_frame_start(port, n + (port->crc ? PKT_CRC_LEN : 0));
+	if (msg == NULL) {	/* Make room */
+		packet_flush(port);
+		msg = port_frame_start(port,
+			n + (port->crc ? PKT_CRC_LEN : 0));
+	}
+	if (msg == NULL) {
+		port->tx_drops++;
+		return;
+	}
+	if (port->crc && (v->frame[1] & PKT_FLAG_CRC)) {
+		memcpy(msg, v->frame, n + PKT_CRC_LEN);
+	}
+	else {
+		memcpy(msg, v->frame, n);
+		msg[1] = port->crc ? PKT_FLAG_CRC : 0;
+		if (port->crc) put32(msg + n, crc32c(0, msg, n));
+	}
+	if (port->crc) n += PKT_CRC_LEN;
+	port_frame_end(port, msg, n);
+}
 }
 
 int packet_recv(struct net_port *port, struct packet *p)
 {
-char msg[PAYLOAD_MAX+4];
+struct packet_view v;
 int n;
-int i;
-	
-if (port->type == PIPE) {
-	n = read(port->pipe_recv_fd, msg, PAYLOAD_MAX+4);
-	if (n>0) {
-		p->src = (char) msg[0];
-		p->dst = (char) msg[1];
-		p->type = (char) msg[2];
-		p->length = (int) msg[3];
-		for (i=0; i<p->length; i++) {
-			p->payload[i] = msg[i+4];
+
+n = packet_recv_view(port, &v);
+if (n > 0) {
+	p->type = v.type;
+	p->src = v.src;
+	p->dst = v.dst;
+	p->length = v.length;
+	memcpy(p->payload, v.payload, v.length);
+}
+return n;
+}
+
+struct packet *packet_alloc(int length)
+{
+return (struct packet *) malloc(offsetof(struct packet, payload) + length);
+}
+
+struct packet *packet_view_dup(struct packet_view *v)
+{
+struct packet *p;
+
+p = packet_alloc(v->length);
+p->type = v->type;
+p->src = v->src;
+p->dst = v->dst;
+p->length = v->length;
+memcpy(p->payload, v->payload, v->length);
+return p;
+}
+
+struct packet *packet_dup(struct packet *p)
+{
+struct packet *q;
+
+q = packet_alloc(p->length);
+memcpy(q, p, offsetof(struct packet, payload) + p->length);
+return q;
+}
+
+int packet_recv_view(struct net_port *port, struct packet_view *v)
+{
+char *msg;
+unsigned int crc;
+unsigned int length;
+int frame;
+int n = 0;
+
+if (port->type == SIM && port->rx_len == 0) return 0;
+if (port_stream(port) || port->type == SIM) {
+	port_buf_alloc(port);
+
+	/* Read more if there is not a whole frame in the buffer */
+	if (port_stream(port) && (port->rx_len < PKT_HDR_LEN || port->rx_len < PKT_HDR_LEN
+		+ (int) get32(port->rx_buf + port->rx_head + 12)
+		+ ((port->rx_buf[port->rx_head+1] & PKT_FLAG_CRC)
+			? PKT_CRC_LEN : 0))) {
+		if (port->rx_head > 0) {
+			memmove(port->rx_buf, port->rx_buf + port->rx_head,
+				port->rx_len);
+			port->rx_head = 0;
 		}
+		n = port_read(port, port->rx_buf + port->rx_len,
+			port->rx_cap - port->rx_len);
+		if (n > 0) port->rx_len += n;
+	}
+	if (port->rx_len < PKT_HDR_LEN) return 0;
 
-// printf("PACKET RECV, src=%d dst=%d p-src=%d p-dst=%d\n", 
-//		(int) msg[0], 
-//		(int) msg[1], 
-//		(int) p->src, 
-//		(int) p->dst);
+	msg = port->rx_buf + port->rx_head;
+	length = get32(msg+12);
+	if (msg[0] != PKT_VERSION || length > PAYLOAD_MAX
+		|| PKT_HDR_LEN + length + PKT_CRC_LEN > port->rx_cap) {
+		/*
+		 * Not a frame we could have sent.  We have lost
+		 * track of the frame boundaries, so drop it all.
+		 */
+		port->crc_errors++;
+		port->rx_head = 0;
+		port->rx_len = 0;
+		return 0;
 	}
+	frame = PKT_HDR_LEN + length;
+	if (msg[1] & PKT_FLAG_CRC) frame += PKT_CRC_LEN;
+	if (port->rx_len < frame) return 0;	/* Rest is on its way */
+
+	port->rx_head += frame;
+	port->rx_len -= frame;
+	if (port->rx_len == 0) port->rx_head = 0;
+
+	/*
+	 * Check the trailer.  A frame that fails is dropped
+	 * and counted, and the caller sees nothing.
+	 */
+	if (msg[1] & PKT_FLAG_CRC) {
+		crc = get32(msg + PKT_HDR_LEN + length);
+		if (crc != crc32c(0, msg, PKT_HDR_LEN + length)) {
+			port->crc_errors++;
+			return 0;
+		}
+	}
+
+	if (port->cap != NULL) {
+		capture_frame(port->cap, msg, frame, CAPTURE_IN);
+	}
+	port->rx_packets++;
+	port->rx_bytes += frame;
+	v->type = ((unsigned char) msg[2] << 8) | (unsigned char) msg[3];
+	v->src = (int) get32(msg+4);
+	v->dst = (int) get32(msg+8);
+	v->length = (int) length;
+	v->payload = msg + PKT_HDR_LEN;
+	v->frame = msg;
+	v->frame_len = frame;
+	n = frame;
+
+// printf("PACKET RECV, src=%d dst=%d p-src=%d p-dst=%d\n",
+//		(int) msg[0],
+//		(int) msg[1],
+//		(int) p->src,
+//		(int) p->dst);
 }
 
 return(n);
 }
-
-
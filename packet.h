@@ -1,11 +1,57 @@
 /* Definitions and prototypes for the link (link.c)
  */
 
+#define PKT_HDR_LEN 16	/* Frame header, see packet.c */
+#define PKT_CRC_LEN 4	/* Optional CRC32C trailer */
+
+/*
+ * A packet received on a port, parsed where it lies in the port's
+ * rx buffer rather than copied out.  It is good until the next
+ * receive on the port.
+ */
+struct packet_view {
+	int src;
+	int dst;
+	int type;
+	int length;
+	char *payload;
+	char *frame;		/* The frame as received */
+	int frame_len;
+};
 
 // receive packet on port
 int packet_recv(struct net_port *port, struct packet *p);
 
+// receive packet on port, leaving it in the port's rx buffer
+int packet_recv_view(struct net_port *port, struct packet_view *v);
+
+// send a received packet on port as it came, without encoding it again;
+// it is written at the latest by the next packet_flush() of the port
+void packet_forward(struct net_port *port, struct packet_view *v);
+
+// a packet with room for 'length' bytes of payload, from malloc()
+struct packet *packet_alloc(int length);
+
+// a packet_alloc() copy of a received packet, to keep
+struct packet *packet_view_dup(struct packet_view *v);
+
+// a packet_alloc() copy of packet p
+struct packet *packet_dup(struct packet *p);
+
 // send packet on port
 void packet_send(struct net_port *port, struct packet *p);
 
+// write frames still waiting in the port's tx buffer
+void packet_flush(struct net_port *port);
+
+
+// time the port's link emulation next releases a frame, or -1
+long long packet_next_release(struct net_port *port);
+
+// microseconds a frame sent now would queue for the port's link;
+// 0 without link emulation
+long long packet_wait(struct net_port *port);
 
+// simulator: put a frame that came over the port's link into its
+// rx buffer; returns 0, and counts a drop, if there is no room
+int packet_deliver(struct net_port *port, char *frame, int n);
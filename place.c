@@ -0,0 +1,231 @@
+/*
+ * place.c
+ *
+ * Topology-aware placement of nodes on CPUs.
+ *
+ * The CPUs are grouped by NUMA node and, within one, by the last
+ * level cache they share, as /sys describes them, and sorted so
+ * CPUs of a group are together.  The nodes are put in breadth-first
+ * order over the links, which keeps neighbours together, and the
+ * order is cut into one run of nodes per CPU.  So a run of linked
+ * nodes shares a CPU, and runs next to each other in the order,
+ * which are also mostly linked, share a cache and a NUMA node.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <dirent.h>
+
+#include "main.h"
+#include "net.h"
+#include "place.h"
+
+#define SYS_CPU "/sys/devices/system/cpu"
+#define PLACE_LIST_MAX 64	/* Nodes listed per CPU in the report */
+
+struct place_cpu {
+	int cpu;
+	int numa;	/* NUMA node */
+	int cache;	/* First CPU sharing its last-level cache */
+};
+
+/* The first CPU in a list like "0-3,8-11" in file 'path', or -1 */
+static int place_first_cpu(char path[])
+{
+FILE *fp;
+int cpu = -1;
+
+fp = fopen(path, "r");
+if (fp == NULL) return -1;
+if (fscanf(fp, "%d", &cpu) != 1) cpu = -1;
+fclose(fp);
+return cpu;
+}
+
+/* The NUMA node of a CPU: its directory links to "nodeN" */
+static int place_numa(int cpu)
+{
+char path[100];
+struct dirent *d;
+DIR *dir;
+int node = 0;
+
+sprintf(path, SYS_CPU "/cpu%d", cpu);
+dir = opendir(path);
+if (dir == NULL) return 0;
+while ((d = readdir(dir)) != NULL) {
+	if (sscanf(d->d_name, "node%d", &node) == 1) break;
+}
+closedir(dir);
+return node;
+}
+
+/* The CPUs sharing the CPU's largest cache, by the first of them */
+static int place_cache(int cpu)
+{
+char path[100];
+int i, first, c;
+
+first = -1;
+for (i=0; i<8; i++) {	/* The last index that exists is the largest */
+	sprintf(path, SYS_CPU "/cpu%d/cache/index%d/shared_cpu_list",
+		cpu, i);
+	c = place_first_cpu(path);
+	if (c >= 0) first = c;
+}
+if (first >= 0) return first;
+sprintf(path, SYS_CPU "/cpu%d/topology/package_cpus_list", cpu);
+first = place_first_cpu(path);
+return first >= 0 ? first : cpu;
+}
+
+static int place_cpu_cmp(const void *a, const void *b)
+{
+const struct place_cpu *x = a;
+const struct place_cpu *y = b;
+
+if (x->numa != y->numa) return x->numa - y->numa;
+if (x->cache != y->cache) return x->cache - y->cache;
+return x->cpu - y->cpu;
+}
+
+int *place_nodes(struct net_node *node_list, int *max_id)
+{
+struct place_cpu *cpus;
+struct net_node *p;
+cpu_set_t set;
+int *cpu_of, *order, *deg, *start, *adj, *queue;
+int *pos;
+char *seen;
+size_t num_nodes;
+int num_cpus, links;
+int cross_cache, cross_numa;
+int head, tail;
+int i, k, m, n0, n1, c, c0, c1;
+
+/* The CPUs we may run on, grouped */
+if (sched_getaffinity(0, sizeof(set), &set) != 0) return NULL;
+num_cpus = CPU_COUNT(&set);
+if (num_cpus == 0) return NULL;
+cpus = (struct place_cpu *) malloc(num_cpus * sizeof(struct place_cpu));
+for (i=0, k=0; i<CPU_SETSIZE && k<num_cpus; i++) {
+	if (!CPU_ISSET(i, &set)) continue;
+	cpus[k].cpu = i;
+	cpus[k].numa = place_numa(i);
+	cpus[k].cache = place_cache(i);
+	k++;
+}
+qsort(cpus, num_cpus, sizeof(struct place_cpu), place_cpu_cmp);
+
+/* The link graph, as adjacency lists by node id */
+*max_id = -1;
+num_nodes = 0;
+for (p=node_list; p!=NULL; p=p->next) {
+	if (p->id > *max_id) *max_id = p->id;
+	num_nodes++;
+}
+if (num_nodes == 0) {
+	free(cpus);
+	return NULL;
+}
+m = *max_id + 1;
+links = net_get_link_num();
+deg = (int *) calloc(m + 1, sizeof(int));
+start = (int *) calloc(m + 1, sizeof(int));
+adj = (int *) malloc((2 * links + 1) * sizeof(int));
+for (i=0; i<links; i++) {
+	net_get_link_nodes(i, &n0, &n1);
+	if (n0 < 0 || n1 < 0 || n0 >= m || n1 >= m) continue;
+	deg[n0]++;
+	deg[n1]++;
+}
+for (i=0; i<m; i++) start[i+1] = start[i] + deg[i];
+memset(deg, 0, (m + 1) * sizeof(int));
+for (i=0; i<links; i++) {
+	net_get_link_nodes(i, &n0, &n1);
+	if (n0 < 0 || n1 < 0 || n0 >= m || n1 >= m) continue;
+	adj[start[n0] + deg[n0]++] = n1;
+	adj[start[n1] + deg[n1]++] = n0;
+}
+
+/* Breadth-first order, from each node not yet reached in id order */
+seen = (char *) calloc(m, 1);
+pos = (int *) malloc(m * sizeof(int));
+order = (int *) malloc(num_nodes * sizeof(int));
+queue = order;
+for (i=0; i<m; i++) pos[i] = -1;
+for (p=node_list; p!=NULL; p=p->next) pos[p->id] = 0;	/* Exists */
+tail = 0;
+for (i=0; i<m; i++) {
+	if (pos[i] < 0 || seen[i]) continue;
+	head = tail;
+	queue[tail++] = i;
+	seen[i] = 1;
+	while (head < tail) {
+		n0 = queue[head++];
+		for (k=start[n0]; k<start[n0+1]; k++) {
+			n1 = adj[k];
+			if (pos[n1] < 0 || seen[n1]) continue;
+			seen[n1] = 1;
+			queue[tail++] = n1;
+		}
+	}
+}
+
+/* Cut the order into one run per CPU */
+cpu_of = (int *) malloc(m * sizeof(int));
+for (i=0; i<m; i++) cpu_of[i] = -1;
+for (i=0; i<tail; i++) {
+	pos[order[i]] = (int) ((long) i * num_cpus / tail);
+	cpu_of[order[i]] = cpus[pos[order[i]]].cpu;
+}
+
+/* Report */
+printf("Placement of %d nodes on %d CPUs:\n", tail, num_cpus);
+for (i=0; i<tail; i=k) {	/* Each CPU's nodes are a run of the order */
+	c = pos[order[i]];
+	printf("   CPU %d (NUMA node %d, cache of CPU %d): nodes",
+		cpus[c].cpu, cpus[c].numa, cpus[c].cache);
+	for (k=i; k<tail && pos[order[k]] == c; k++) {
+		if (k - i < PLACE_LIST_MAX) printf(" %d", order[k]);
+	}
+	if (k - i > PLACE_LIST_MAX) {
+		printf(" ... and %d more", k - i - PLACE_LIST_MAX);
+	}
+	printf("\n");
+}
+cross_cache = cross_numa = 0;
+for (i=0; i<links; i++) {
+	net_get_link_nodes(i, &n0, &n1);
+	if (n0 < 0 || n1 < 0 || n0 >= m || n1 >= m) continue;
+	if (pos[n0] < 0 || pos[n1] < 0) continue;
+	c0 = pos[n0];
+	c1 = pos[n1];
+	if (cpus[c0].cache != cpus[c1].cache) cross_cache++;
+	if (cpus[c0].numa != cpus[c1].numa) cross_numa++;
+}
+printf("   %d of %d links between caches, %d between NUMA nodes\n",
+	cross_cache, links, cross_numa);
+
+free(cpus);
+free(deg);
+free(start);
+free(adj);
+free(seen);
+free(pos);
+free(order);
+return cpu_of;
+}
+
+void place_pin(int cpu)
+{
+cpu_set_t set;
+
+if (cpu < 0) return;
+CPU_ZERO(&set);
+CPU_SET(cpu, &set);
+sched_setaffinity(0, sizeof(set), &set);
+}
@@ -0,0 +1,18 @@
+/*
+ * place.h
+ *
+ * Placement of nodes on CPUs (net367 -a).  Nodes joined by links
+ * are put on the same CPU or, failing that, on CPUs that share a
+ * last-level cache and a NUMA node, so the bytes in their pipes
+ * stay close.  The placement is printed when it is made.
+ */
+
+/*
+ * Place the nodes of the network on the CPUs this process may
+ * run on.  Returns cpu[id] for each node id up to *max_id, or
+ * NULL if the CPUs cannot be found or there are no nodes.
+ */
+int *place_nodes(struct net_node *node_list, int *max_id);
+
+/* Run the calling process on CPU 'cpu' only */
+void place_pin(int cpu);
@@ -0,0 +1,151 @@
+/*
+ * sched.c
+ *
+ * Deficit round-robin between a host's uploads; see sched.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "packet.h"
+#include "sched.h"
+
+/* Bytes a segment takes on the link */
+static int sched_cost(struct packet *p)
+{
+return PKT_HDR_LEN + p->length;
+}
+
+void sched_init(struct sched *s)
+{
+s->head = NULL;
+s->tail = NULL;
+s->num = 0;
+}
+
+void sched_flow_init(struct sched_flow *f, int weight)
+{
+if (weight < 1) weight = 1;
+if (weight > SCHED_WEIGHT_MAX) weight = SCHED_WEIGHT_MAX;
+f->weight = weight;
+f->deficit = 0;
+f->credited = 0;
+f->head = NULL;
+f->tail = NULL;
+f->num = 0;
+f->bytes = 0;
+f->next = NULL;
+}
+
+/* Put flow f at the end of the round, for its next turn */
+static void sched_round_add(struct sched *s, struct sched_flow *f)
+{
+f->next = NULL;
+f->credited = 0;
+if (s->tail == NULL) s->head = f;
+else s->tail->next = f;
+s->tail = f;
+}
+
+static struct sched_flow *sched_round_next(struct sched *s)
+{
+struct sched_flow *f;
+
+f = s->head;
+s->head = f->next;
+if (s->head == NULL) s->tail = NULL;
+f->next = NULL;
+return f;
+}
+
+void sched_add(struct sched *s, struct sched_flow *f, struct packet *p,
+		int port)
+{
+struct sched_item *it;
+
+it = (struct sched_item *) malloc(sizeof(struct sched_item));
+it->p = p;
+it->port = port;
+it->next = NULL;
+if (f->tail == NULL) f->head = it;
+else f->tail->next = it;
+f->tail = it;
+if (f->num++ == 0) {	/* It joins the round */
+	f->deficit = 0;
+	sched_round_add(s, f);
+}
+s->num++;
+}
+
+/*
+ * Move the round on until the flow whose turn it is can send its
+ * next segment.  A flow whose credit does not cover it keeps the
+ * credit and waits for its next turn; each round adds to it, so
+ * the loop ends however large the segment.
+ */
+struct sched_item *sched_peek(struct sched *s)
+{
+struct sched_flow *f;
+
+while ((f = s->head) != NULL) {
+	if (!f->credited) {
+		f->deficit += (long) SCHED_QUANTUM * f->weight;
+		f->credited = 1;
+	}
+	if (sched_cost(f->head->p) <= f->deficit) return f->head;
+	sched_round_add(s, sched_round_next(s));
+}
+return NULL;
+}
+
+struct packet *sched_remove(struct sched *s, int *port)
+{
+struct sched_flow *f;
+struct sched_item *it;
+struct packet *p;
+
+if (sched_peek(s) == NULL) return NULL;
+f = s->head;
+it = f->head;
+f->head = it->next;
+if (f->head == NULL) f->tail = NULL;
+f->num--;
+s->num--;
+
+p = it->p;
+*port = it->port;
+free(it);
+f->deficit -= sched_cost(p);
+f->bytes += sched_cost(p);
+if (f->num == 0) {	/* Leaves the round, and its credit */
+	sched_round_next(s);
+	f->deficit = 0;
+	f->credited = 0;
+}
+return p;
+}
+
+void sched_flow_drop(struct sched *s, struct sched_flow *f)
+{
+struct sched_flow *prev = NULL;
+struct sched_flow *g;
+struct sched_item *it;
+
+for (g = s->head; f->num > 0 && g != NULL; prev = g, g = g->next) {
+	if (g != f) continue;
+	if (prev == NULL) s->head = f->next;
+	else prev->next = f->next;
+	if (s->tail == f) s->tail = prev;
+	break;
+}
+while ((it = f->head) != NULL) {
+	f->head = it->next;
+	free(it->p);
+	free(it);
+	s->num--;
+}
+f->tail = NULL;
+f->num = 0;
+f->next = NULL;
+}
@@ -0,0 +1,64 @@
+/*
+ * sched.h
+ *
+ * Fair sharing of a host's ports between its uploads, by deficit
+ * round-robin.  Each upload is a flow with a queue of its own
+ * segments and a weight.  The flows with segments queued take
+ * turns.  At the start of its turn a flow is credited SCHED_QUANTUM
+ * bytes times its weight, and it sends segments while this credit,
+ * its deficit, covers the next one; what is left carries over to
+ * its next turn, unless its queue runs dry.  Over a round the flows
+ * so send bytes in proportion to their weights, whatever the size
+ * of their segments, and a short upload is never stuck behind the
+ * whole window of a long one.
+ *
+ * The host takes segments from the scheduler only while its links
+ * have little queued for them, so that the order in which segments
+ * go out is the scheduler's.
+ */
+
+#define SCHED_QUANTUM 1500	/* Bytes per turn, times the weight */
+#define SCHED_WEIGHT_MAX 100
+
+struct sched_item {
+	struct packet *p;
+	int port;		/* Port to send it on, or -1 for all */
+	struct sched_item *next;
+};
+
+struct sched_flow {
+	int weight;
+	long deficit;		/* Bytes it may still send on this turn */
+	int credited;		/* Its turn has started */
+	struct sched_item *head;	/* Segments queued */
+	struct sched_item *tail;
+	int num;
+	long long bytes;	/* Statistics: sent */
+	struct sched_flow *next;	/* In the round, while it has any */
+};
+
+struct sched {
+	struct sched_flow *head;	/* The round; it is head's turn */
+	struct sched_flow *tail;
+	int num;		/* Segments queued in all */
+};
+
+void sched_init(struct sched *s);
+
+void sched_flow_init(struct sched_flow *f, int weight);
+
+/* Queue packet p, from malloc(), of flow f, to go out on 'port' */
+void sched_add(struct sched *s, struct sched_flow *f, struct packet *p,
+		int port);
+
+/* The segment that goes out next, left queued, or NULL if none */
+struct sched_item *sched_peek(struct sched *s);
+
+/*
+ * Take the segment sched_peek() gave and set *port; the caller
+ * frees the packet
+ */
+struct packet *sched_remove(struct sched *s, int *port);
+
+/* Take flow f out of the round, freeing what it still has queued */
+void sched_flow_drop(struct sched *s, struct sched_flow *f);
@@ -0,0 +1,638 @@
+/*
+ * sim.c
+ *
+ * Discrete-event simulation of the network in one process.
+ *
+ * The scheduler is a binary min-heap of events on simulated time.
+ * There are three kinds of event: polling a host, which runs one
+ * pass of its main loop; releasing the frames link emulation holds
+ * on a port; and delivering a frame from another partition.  A
+ * host's events are not removed when it is rescheduled; an event
+ * that no longer matches the time the host or port is due is stale
+ * and is skipped when it comes up.
+ *
+ * Partitions.  With more than one thread the hosts are split into
+ * partitions, each with its own heap and clock, run by its own
+ * thread.  Links inside a partition work as with one thread.  A
+ * frame sent on a link between partitions is taken from the link
+ * emulator as soon as the host's poll is over and pushed onto the
+ * inbox of the other partition, a lock-free stack, to be delivered
+ * at its arrival time.
+ *
+ * Synchronisation is conservative.  Every link between partitions
+ * delays frames by at least the lookahead L, the smallest such
+ * delay less its jitter.  So in a window of simulated time
+ * [T, T+L) no partition can receive a frame sent by another in the
+ * same window: they all run the window at once, meet at a barrier,
+ * take in their inboxes, and go on to the next window, which starts
+ * at the earliest event of any partition.  Links with no delay, or
+ * with reordering (which skips the delay), give no lookahead, so
+ * the partitioner never cuts them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "main.h"
+#include "host.h"
+#include "switch.h"
+#include "packet.h"
+#include "emu.h"
+#include "timer.h"
+#include "crc32c.h"
+#include "sim.h"
+
+#define TENMILLISEC 10000	/* Poll period of a busy host */
+#define SIM_START 1000000	/* Simulated time starts at 1 s, since
+				   the transport takes 0 as "never" */
+#define SIM_NEVER LLONG_MAX
+
+enum sim_event_type {
+	SIM_POLL,	/* Poll node 'host_id', a host or switch */
+	SIM_RELEASE,	/* Release emulated frames on 'port' */
+	SIM_DELIVER	/* Frame 'data' arrives on 'port' */
+};
+
+struct sim_event {
+	long long time;
+	long seq;		/* Events at the same time go in order */
+	enum sim_event_type type;
+	int host_id;
+	struct net_port *port;
+	char *data;
+	int length;
+};
+
+struct sim_msg {  /* A frame on its way to another partition */
+	long long time;		/* When it arrives */
+	int src;		/* Sending host and the order it was */
+	long seq;		/*    sent in, to sort arrivals */
+	struct net_port *port;	/* Port it arrives on */
+	char *data;
+	int length;
+	struct sim_msg *next;
+};
+
+struct sim_part {  /* A partition of the network and its thread */
+	struct sim_event *heap;	/* Events, earliest first */
+	int heap_num;
+	int heap_cap;
+	long seq;
+	long long now;
+	_Atomic(struct sim_msg *) inbox;  /* Frames from other partitions */
+	long long next;		/* Earliest event, shared at a barrier */
+	long long end;		/* Run to this time */
+	int hosts;
+	long events;		/* Statistics */
+	long sent;		/* Frames sent to other partitions */
+	pthread_t thread;
+};
+
+struct sim_node {
+	struct host_state *h;	/* NULL if the node is not a host */
+	struct switch_state *sw;	/* NULL if it is not a switch */
+	struct net_port **port;
+	int port_num;
+	long long poll_at;	/* When the host is next polled, or -1 */
+	int part;		/* Partition */
+};
+
+static struct sim_node *g_sim_node = NULL;
+static int g_sim_node_num = 0;
+
+static struct sim_part *g_sim_part = NULL;
+static int g_sim_part_num = 0;
+static long long g_sim_lookahead = SIM_NEVER;
+static pthread_barrier_t g_sim_barrier;
+
+static long long g_sim_now;	/* Time the manager sees */
+
+/* Event a comes before event b */
+static int sim_before(struct sim_event *a, struct sim_event *b)
+{
+return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+static void sim_push(struct sim_part *sp, struct sim_event *ev)
+{
+struct sim_event t;
+int i, parent;
+
+if (sp->heap_num == sp->heap_cap) {
+	sp->heap_cap = sp->heap_cap == 0 ? 1024 : 2 * sp->heap_cap;
+	sp->heap = (struct sim_event *) realloc(sp->heap,
+		sp->heap_cap * sizeof(struct sim_event));
+}
+i = sp->heap_num++;
+sp->heap[i] = *ev;
+sp->heap[i].seq = sp->seq++;
+while (i > 0) {
+	parent = (i - 1) / 2;
+	if (!sim_before(&sp->heap[i], &sp->heap[parent])) break;
+	t = sp->heap[i];
+	sp->heap[i] = sp->heap[parent];
+	sp->heap[parent] = t;
+	i = parent;
+}
+}
+
+/* Remove the earliest event into *ev */
+static void sim_pop(struct sim_part *sp, struct sim_event *ev)
+{
+struct sim_event t;
+int i, c;
+
+*ev = sp->heap[0];
+sp->heap[0] = sp->heap[--sp->heap_num];
+i = 0;
+while (1) {
+	c = 2 * i + 1;
+	if (c >= sp->heap_num) break;
+	if (c + 1 < sp->heap_num
+		&& sim_before(&sp->heap[c+1], &sp->heap[c])) c++;
+	if (!sim_before(&sp->heap[c], &sp->heap[i])) break;
+	t = sp->heap[i];
+	sp->heap[i] = sp->heap[c];
+	sp->heap[c] = t;
+	i = c;
+}
+}
+
+static void sim_push_event(struct sim_part *sp, long long time,
+		enum sim_event_type type, int host_id, struct net_port *port)
+{
+struct sim_event ev;
+
+ev.time = time;
+ev.type = type;
+ev.host_id = host_id;
+ev.port = port;
+ev.data = NULL;
+ev.length = 0;
+sim_push(sp, &ev);
+}
+
+/* The node is a host or a switch, which the simulator runs */
+static int sim_runs(struct sim_node *n)
+{
+return n->h != NULL || n->sw != NULL;
+}
+
+/* Poll node 'host_id' at time t, unless it is due sooner */
+static void sim_wake_at(int host_id, long long t)
+{
+struct sim_node *n;
+
+if (host_id < 0 || host_id >= g_sim_node_num) return;
+n = &g_sim_node[host_id];
+if (!sim_runs(n)) return;
+if (n->poll_at >= 0 && n->poll_at <= t) return;
+n->poll_at = t;
+sim_push_event(&g_sim_part[n->part], t, SIM_POLL, host_id, NULL);
+}
+
+/*
+ * A frame has reached port q.  A host that is idle is polled now;
+ * a busy one reads it on its next poll, as it would as a process.
+ */
+static void sim_arrived(struct sim_part *sp, struct net_port *q)
+{
+if (q->rx_len > 0 && g_sim_node[q->pipe_host_id].poll_at < 0) {
+	sim_wake_at(q->pipe_host_id, sp->now);
+}
+}
+
+/* The port's link goes to another partition */
+static int sim_cut(struct net_port *port)
+{
+return g_sim_node[port->pipe_host_id].part
+	!= g_sim_node[port->peer->pipe_host_id].part;
+}
+
+/* Schedule the release of the next frame link emulation holds */
+static void sim_schedule_release(struct sim_part *sp, struct net_port *port)
+{
+long long t;
+
+t = packet_next_release(port);
+if (t < 0) return;
+if (t <= sp->now) {	/* The far end is full; try again later */
+	t = sp->now + TENMILLISEC;
+}
+if (port->release_at >= 0 && port->release_at <= t) return;
+port->release_at = t;
+sim_push_event(sp, t, SIM_RELEASE, port->pipe_host_id, port);
+}
+
+/*
+ * Send every frame the port's link emulator holds to the partition
+ * at the other end.  Each arrives at least the lookahead from now.
+ */
+static void sim_ship(struct sim_part *sp, struct net_port *port)
+{
+struct sim_part *dp;
+struct sim_msg *m;
+long long t;
+
+dp = &g_sim_part[g_sim_node[port->peer->pipe_host_id].part];
+while ((t = emu_next(port->emu)) >= 0) {
+	m = (struct sim_msg *) malloc(sizeof(struct sim_msg));
+	m->time = t;
+	m->src = port->pipe_host_id;
+	m->seq = sp->sent++;
+	m->port = port->peer;
+	m->length = emu_dequeue(port->emu, t, &m->data);
+	m->next = atomic_load(&dp->inbox);
+	while (!atomic_compare_exchange_weak(&dp->inbox, &m->next, m));
+}
+}
+
+/* Order of frames arriving from other partitions */
+static int sim_msg_cmp(const void *a, const void *b)
+{
+struct sim_msg *x = *(struct sim_msg **) a;
+struct sim_msg *y = *(struct sim_msg **) b;
+
+if (x->time != y->time) return x->time < y->time ? -1 : 1;
+if (x->src != y->src) return x->src < y->src ? -1 : 1;
+if (x->seq != y->seq) return x->seq < y->seq ? -1 : 1;
+return 0;
+}
+
+/*
+ * Take the frames in the inbox into the heap.  They are sorted
+ * first, so a run does not depend on how the threads interleaved.
+ */
+static void sim_drain(struct sim_part *sp)
+{
+struct sim_msg *list;
+struct sim_msg *m;
+struct sim_msg **arr;
+struct sim_event ev;
+int n, i;
+
+list = atomic_exchange(&sp->inbox, NULL);
+if (list == NULL) return;
+for (n = 0, m = list; m != NULL; m = m->next) n++;
+arr = (struct sim_msg **) malloc(n * sizeof(struct sim_msg *));
+for (i = 0, m = list; m != NULL; m = m->next) arr[i++] = m;
+qsort(arr, n, sizeof(struct sim_msg *), sim_msg_cmp);
+for (i=0; i<n; i++) {
+	ev.time = arr[i]->time;
+	ev.type = SIM_DELIVER;
+	ev.host_id = arr[i]->port->pipe_host_id;
+	ev.port = arr[i]->port;
+	ev.data = arr[i]->data;
+	ev.length = arr[i]->length;
+	sim_push(sp, &ev);
+	free(arr[i]);
+}
+free(arr);
+}
+
+/* After a host is polled: deliver what it sent, and poll it again */
+static void sim_after_poll(struct sim_part *sp, int host_id)
+{
+struct sim_node *n = &g_sim_node[host_id];
+int k;
+
+for (k=0; k<n->port_num; k++) {
+	if (sim_cut(n->port[k])) {
+		sim_ship(sp, n->port[k]);
+	}
+	else {
+		sim_schedule_release(sp, n->port[k]);
+		sim_arrived(sp, n->port[k]->peer);
+	}
+}
+if (n->h != NULL ? host_busy(n->h) : switch_busy(n->sw)) {
+	sim_wake_at(host_id, sp->now + TENMILLISEC);
+}
+}
+
+/* Run the partition's events before time 'wend' */
+static void sim_step(struct sim_part *sp, long long wend)
+{
+struct sim_event ev;
+struct sim_node *n;
+
+while (sp->heap_num > 0 && sp->heap[0].time < wend) {
+	sim_pop(sp, &ev);
+	sp->now = ev.time;
+	timer_set_virtual(sp->now);
+
+	switch (ev.type) {
+	case SIM_POLL:
+		n = &g_sim_node[ev.host_id];
+		if (n->poll_at != ev.time) break;	/* Stale */
+		n->poll_at = -1;
+		sp->events++;
+		if (n->h != NULL) host_poll(n->h);
+		else switch_poll(n->sw);
+		sim_after_poll(sp, ev.host_id);
+		break;
+
+	case SIM_RELEASE:
+		if (ev.port->release_at != ev.time) break;
+		ev.port->release_at = -1;
+		sp->events++;
+		packet_flush(ev.port);
+		sim_schedule_release(sp, ev.port);
+		sim_arrived(sp, ev.port->peer);
+		break;
+
+	case SIM_DELIVER:
+		sp->events++;
+		packet_deliver(ev.port, ev.data, ev.length);
+		free(ev.data);
+		sim_arrived(sp, ev.port);
+		break;
+	}
+}
+}
+
+/* Earliest event of any partition */
+static long long sim_next_all()
+{
+long long t = SIM_NEVER;
+int i;
+
+for (i=0; i<g_sim_part_num; i++) {
+	if (g_sim_part[i].next < t) t = g_sim_part[i].next;
+}
+return t;
+}
+
+/* Run a partition to sp->end, window by window */
+static void *sim_part_run(void *arg)
+{
+struct sim_part *sp = (struct sim_part *) arg;
+long long t, wend;
+
+t = sim_next_all();
+while (t <= sp->end) {
+	if (g_sim_lookahead == SIM_NEVER || t + g_sim_lookahead > sp->end) {
+		wend = sp->end + 1;
+	}
+	else {
+		wend = t + g_sim_lookahead;
+	}
+	sim_step(sp, wend);
+
+	if (g_sim_part_num > 1) pthread_barrier_wait(&g_sim_barrier);
+	sim_drain(sp);
+	sp->next = sp->heap_num > 0 ? sp->heap[0].time : SIM_NEVER;
+	if (g_sim_part_num > 1) pthread_barrier_wait(&g_sim_barrier);
+	t = sim_next_all();
+}
+sp->now = sp->end;
+timer_set_virtual(sp->now);
+return NULL;
+}
+
+/* Lookahead a link gives: the least time a frame spends on it */
+static long long sim_link_lookahead(struct net_port *port)
+{
+struct link_emu *e = port->emu;
+
+if (e == NULL || e->reorder > 0) return 0;
+if (e->delay_us <= e->jitter_us) return 0;
+return e->delay_us - e->jitter_us;
+}
+
+static int sim_find(int *parent, int i)
+{
+while (parent[i] != i) {
+	parent[i] = parent[parent[i]];
+	i = parent[i];
+}
+return i;
+}
+
+/*
+ * Split the hosts into partitions.  Hosts joined by links that
+ * give no lookahead are kept together as one unit.  Partitions
+ * are grown breadth first from the lowest numbered host, taking
+ * whole units until each has its share of hosts, so that they
+ * are compact regions of the network with few links between them.
+ */
+static void sim_partition(int parts)
+{
+int *parent;
+int *size;
+int *unit_part;
+int *queue;
+char *seen;
+int head, tail;
+int hosts, target, filled, cur;
+int i, k, u, v, r;
+struct net_port *port;
+
+parent = (int *) malloc(g_sim_node_num * sizeof(int));
+size = (int *) calloc(g_sim_node_num, sizeof(int));
+unit_part = (int *) malloc(g_sim_node_num * sizeof(int));
+queue = (int *) malloc(g_sim_node_num * sizeof(int));
+seen = (char *) calloc(g_sim_node_num, 1);
+
+for (i=0; i<g_sim_node_num; i++) {
+	parent[i] = i;
+	unit_part[i] = -1;
+}
+for (i=0; i<g_sim_node_num; i++) {
+	for (k=0; k<g_sim_node[i].port_num; k++) {
+		port = g_sim_node[i].port[k];
+		if (sim_link_lookahead(port) == 0) {
+			parent[sim_find(parent, i)]
+				= sim_find(parent, port->peer->pipe_host_id);
+		}
+	}
+}
+hosts = 0;
+for (i=0; i<g_sim_node_num; i++) {
+	if (sim_runs(&g_sim_node[i])) {
+		size[sim_find(parent, i)]++;
+		hosts++;
+	}
+}
+
+target = (hosts + parts - 1) / parts;
+filled = 0;
+cur = 0;
+for (i=0; i<g_sim_node_num; i++) {
+	if (!sim_runs(&g_sim_node[i]) || seen[i]) continue;
+	head = tail = 0;
+	queue[tail++] = i;
+	seen[i] = 1;
+	while (head < tail) {
+		u = queue[head++];
+		r = sim_find(parent, u);
+		if (unit_part[r] < 0) {
+			unit_part[r] = cur;
+			filled += size[r];
+			if (filled >= target && cur < parts - 1) {
+				cur++;
+				filled = 0;
+			}
+		}
+		for (k=0; k<g_sim_node[u].port_num; k++) {
+			v = g_sim_node[u].port[k]->peer->pipe_host_id;
+			if (!seen[v] && sim_runs(&g_sim_node[v])) {
+				seen[v] = 1;
+				queue[tail++] = v;
+			}
+		}
+	}
+}
+for (i=0; i<g_sim_node_num; i++) {
+	r = sim_find(parent, i);
+	g_sim_node[i].part = unit_part[r] >= 0 ? unit_part[r] : 0;
+	if (sim_runs(&g_sim_node[i])) g_sim_part[g_sim_node[i].part].hosts++;
+}
+
+free(parent);
+free(size);
+free(unit_part);
+free(queue);
+free(seen);
+}
+
+void sim_init(struct net_node *node_list, int threads)
+{
+struct net_node *p;
+struct net_port *port;
+int cut;
+int i, k;
+
+g_sim_node_num = 0;
+for (p = node_list; p != NULL; p = p->next) {
+	if (p->id >= g_sim_node_num) g_sim_node_num = p->id + 1;
+}
+g_sim_node = (struct sim_node *)
+	calloc(g_sim_node_num, sizeof(struct sim_node));
+for (k=0; k<g_sim_node_num; k++) {
+	g_sim_node[k].poll_at = -1;
+}
+
+if (threads < 1) threads = 1;
+g_sim_part_num = threads;
+g_sim_part = (struct sim_part *)
+	calloc(g_sim_part_num, sizeof(struct sim_part));
+
+g_sim_now = SIM_START;
+timer_set_virtual(g_sim_now);
+for (i=0; i<g_sim_part_num; i++) {
+	g_sim_part[i].now = g_sim_now;
+	atomic_init(&g_sim_part[i].inbox, NULL);
+}
+
+for (p = node_list; p != NULL; p = p->next) {
+	if (p->type == HOST) {
+		g_sim_node[p->id].h = host_create(p->id);
+		g_sim_node[p->id].port = host_ports(g_sim_node[p->id].h,
+			&g_sim_node[p->id].port_num);
+	}
+	else if (p->type == SWITCH) {
+		g_sim_node[p->id].sw = switch_create(p->id);
+		g_sim_node[p->id].port = switch_ports(g_sim_node[p->id].sw,
+			&g_sim_node[p->id].port_num);
+	}
+}
+
+if (g_sim_part_num == 1) return;
+
+/*
+ * Partition, and find the lookahead from the links cut.  The CRC
+ * tables are built now rather than raced for by the threads.
+ */
+sim_partition(g_sim_part_num);
+cut = 0;
+for (i=0; i<g_sim_node_num; i++) {
+	for (k=0; k<g_sim_node[i].port_num; k++) {
+		port = g_sim_node[i].port[k];
+		if (sim_cut(port)) {
+			cut++;
+			if (sim_link_lookahead(port) < g_sim_lookahead) {
+				g_sim_lookahead = sim_link_lookahead(port);
+			}
+		}
+	}
+}
+pthread_barrier_init(&g_sim_barrier, NULL, g_sim_part_num);
+crc32c_sw(0, "", 0);
+
+printf("Simulator: %d partitions of", g_sim_part_num);
+for (i=0; i<g_sim_part_num; i++) {
+	printf(" %d", g_sim_part[i].hosts);
+}
+printf(" nodes, %d links cut", cut / 2);
+if (g_sim_lookahead != SIM_NEVER) {
+	printf(", lookahead %lld us", g_sim_lookahead);
+}
+printf("\n");
+}
+
+int sim_active()
+{
+return g_sim_node != NULL;
+}
+
+void sim_wake(int host_id)
+{
+sim_wake_at(host_id, g_sim_now);
+}
+
+void sim_command(int host_id, char cmd, char msg[])
+{
+if (host_id < 0 || host_id >= g_sim_node_num) return;
+if (g_sim_node[host_id].h == NULL) return;
+host_command(g_sim_node[host_id].h, cmd, msg);
+sim_wake(host_id);
+}
+
+void sim_run(long long us)
+{
+struct sim_part *sp;
+int i;
+
+for (i=0; i<g_sim_part_num; i++) {
+	sp = &g_sim_part[i];
+	sp->end = g_sim_now + us;
+	sp->next = sp->heap_num > 0 ? sp->heap[0].time : SIM_NEVER;
+}
+if (g_sim_part_num == 1) {
+	sim_part_run(&g_sim_part[0]);
+}
+else {
+	for (i=0; i<g_sim_part_num; i++) {
+		pthread_create(&g_sim_part[i].thread, NULL,
+			sim_part_run, &g_sim_part[i]);
+	}
+	for (i=0; i<g_sim_part_num; i++) {
+		pthread_join(g_sim_part[i].thread, NULL);
+	}
+}
+g_sim_now += us;
+timer_set_virtual(g_sim_now);
+}
+
+void sim_report()
+{
+long events = 0;
+long sent = 0;
+int i;
+
+for (i=0; i<g_sim_part_num; i++) {
+	events += g_sim_part[i].events;
+	sent += g_sim_part[i].sent;
+}
+printf("Simulated time %.3f s, %ld events",
+	(g_sim_now - SIM_START) / 1e6, events);
+if (g_sim_part_num > 1) {
+	printf(", %ld frames between partitions", sent);
+}
+printf("\n");
+}
@@ -0,0 +1,36 @@
+/*
+ * sim.h
+ *
+ * Discrete-event simulation of the network in one process.
+ *
+ * Started with "net367 -s".  The hosts are the same state machines
+ * that run as processes otherwise, but they are polled by an event
+ * scheduler in simulated time, and links are in memory.  Time only
+ * passes when the manager lets it: while it waits for a reply, or
+ * with its (t) command.  A host is polled every 10 ms of simulated
+ * time while it has work, and otherwise only when a frame arrives
+ * or the manager sends it a command, so idle parts of a large
+ * network cost nothing and busy ones run as fast as the CPU goes.
+ */
+
+/*
+ * Set up the hosts of the network loaded by net_init(), to be
+ * run by 'threads' threads (net367 -s -j threads).  See sim.c
+ * for how the network is partitioned between them.
+ */
+void sim_init(struct net_node *node_list, int threads);
+
+/* The simulator is running the hosts */
+int sim_active();
+
+/* Poll host 'host_id' at the current simulated time */
+void sim_wake(int host_id);
+
+/* Give host 'host_id' a manager command directly, without a pipe */
+void sim_command(int host_id, char cmd, char msg[]);
+
+/* Run all events in the next 'us' microseconds of simulated time */
+void sim_run(long long us);
+
+/* Print the simulated time and the number of events run */
+void sim_report();
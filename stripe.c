@@ -0,0 +1,107 @@
+/*
+ * stripe.c
+ *
+ * Multipath striping of an upload; see stripe.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "transport.h"
+#include "stripe.h"
+
+/* Sequence number comparison that survives wrap around */
+static int seq_lt(unsigned int a, unsigned int b)
+{
+return (int) (a - b) < 0;
+}
+
+void stripe_init(struct stripe *st, int port_num)
+{
+int i;
+
+memset(st, 0, sizeof(struct stripe));
+st->port_num = port_num < STRIPE_PORTS_MAX ? port_num : STRIPE_PORTS_MAX;
+for (i=0; i<STRIPE_PORTS_MAX; i++) st->cwnd[i] = STRIPE_CWND_INIT;
+for (i=0; i<TP_WINDOW_MAX; i++) st->path_of[i] = -1;
+}
+
+static int stripe_usable(struct stripe *st, int k, long long now)
+{
+return st->heard_us[k] > 0 && now - st->heard_us[k] < STRIPE_PATH_TIMEOUT;
+}
+
+int stripe_pick(struct stripe *st, struct tp_sender *s, struct packet *p,
+		long long now)
+{
+unsigned int seq;
+double score, best_score = 0;
+int slot;
+int old = -1;
+int best = -1;
+int k;
+
+seq = tp_seq(p);
+slot = seq % TP_WINDOW_MAX;
+
+/* Sent before on a path: lost there, so that path slows down */
+if (st->path_of[slot] >= 0 && st->seq_of[slot] == seq) {
+	old = st->path_of[slot];
+	st->inflight[old]--;
+	st->lost[old]++;
+	st->cwnd[old] /= 2;
+	if (st->cwnd[old] < 1) st->cwnd[old] = 1;
+}
+st->path_of[slot] = -1;
+
+for (k=0; k<st->port_num; k++) {
+	if (!stripe_usable(st, k, now)) continue;
+	score = (st->inflight[k] + 1) / st->cwnd[k];
+	if (k == old) score += s->window;	/* Another, if any */
+	if (best < 0 || score < best_score) {
+		best = k;
+		best_score = score;
+	}
+}
+if (best < 0) return -1;
+st->path_of[slot] = best;
+st->seq_of[slot] = seq;
+st->inflight[best]++;
+st->sent[best]++;
+return best;
+}
+
+void stripe_ack(struct stripe *st, struct tp_sender *s, int k, long long now)
+{
+unsigned int seq;
+int slot;
+int path;
+
+if (k < st->port_num) st->heard_us[k] = now;
+for (slot=0; slot<TP_WINDOW_MAX; slot++) {
+	path = st->path_of[slot];
+	if (path < 0) continue;
+	seq = st->seq_of[slot];
+	if (seq_lt(seq, s->snd_una) || s->seg[slot].sacked) {
+		st->path_of[slot] = -1;
+		st->inflight[path]--;
+		if (st->lost[path] == 0) st->cwnd[path] += 1;	/* Slow start */
+		else st->cwnd[path] += 1 / st->cwnd[path];
+		if (st->cwnd[path] > s->window) st->cwnd[path] = s->window;
+	}
+}
+}
+
+int stripe_report(struct stripe *st, char buf[])
+{
+int n = 0;
+int k;
+
+for (k=0; k<st->port_num; k++) {
+	n += sprintf(buf+n, "%s%ld/%ld", k > 0 ? " " : "",
+		st->sent[k], st->lost[k]);
+}
+return n;
+}
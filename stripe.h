@@ -0,0 +1,48 @@
+/*
+ * stripe.h
+ *
+ * Multipath striping of an upload.  A host with several ports
+ * normally sends every segment on all of them.  A striped upload
+ * sends each segment on one port only, so that paths that lead to
+ * the receiver separately add up.
+ *
+ * A port is a path to the receiver while its acks arrive on it;
+ * the receiver acks on all its ports.  Each path has a window of
+ * its own, which grows as segments sent on it are acked (by one
+ * segment per ack until the path first loses one) and is halved
+ * when one is lost, and a new segment goes to the path with the
+ * most room for it.  A slow or lossy path so ends up carrying
+ * less, and one that stops carrying acks for STRIPE_PATH_TIMEOUT
+ * is dropped.  A retransmission goes to another path if there is
+ * one.  Until a path is known, segments go out on every port.
+ */
+
+#define STRIPE_PORTS_MAX 16
+#define STRIPE_PATH_TIMEOUT 2000000	/* Microseconds without an ack */
+#define STRIPE_CWND_INIT 4		/* Segments in flight on a new path */
+
+struct stripe {
+	int port_num;
+	long long heard_us[STRIPE_PORTS_MAX];	/* Last ack on the port, or 0 */
+	double cwnd[STRIPE_PORTS_MAX];	/* Segments it may have in flight */
+	int inflight[STRIPE_PORTS_MAX];
+	int path_of[TP_WINDOW_MAX];	/* Port of each segment in flight, */
+	unsigned int seq_of[TP_WINDOW_MAX];	/*    or -1 if sent on all */
+	long sent[STRIPE_PORTS_MAX];	/* Statistics */
+	long lost[STRIPE_PORTS_MAX];
+};
+
+void stripe_init(struct stripe *st, int port_num);
+
+/* The port to send segment p of s on, or -1 for every port */
+int stripe_pick(struct stripe *st, struct tp_sender *s, struct packet *p,
+		long long now);
+
+/*
+ * An ack from the receiver arrived on port k and was given to
+ * tp_sender_ack(); credit the paths of the segments it acked
+ */
+void stripe_ack(struct stripe *st, struct tp_sender *s, int k, long long now);
+
+/* Segments sent and lost on each port, e.g. "410/2 388/0" */
+int stripe_report(struct stripe *st, char buf[]);
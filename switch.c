@@ -0,0 +1,242 @@
+/*
+ * switch.c
+ *
+ * A learning switch with multicast groups; see switch.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "net.h"
+#include "packet.h"
+#include "timer.h"
+#include "switch.h"
+
+#define SWITCH_POLL_US 1000	/* Poll period, shorter than a host's
+				   since each hop adds up to one */
+#define SWITCH_BURST 64		/* Frames taken from a port per poll */
+#define SWITCH_RETRY_US 100	/* Wait for room in a full pipe */
+#define WORD_BITS (8 * sizeof(unsigned long))
+
+struct switch_group {
+	int group;
+	int *members;		/* Per port, members joined through it */
+	unsigned long *ports;	/* Bitmap of the ports with members */
+	struct switch_group *next;
+};
+
+struct switch_state {
+	int switch_id;
+	struct net_port **port;
+	int port_num;
+	int words;		/* Of a port bitmap */
+
+	int *fwd;		/* Port of each host id, or -1 */
+	int fwd_cap;
+	int node_num;		/* Ids learned are below this */
+	struct switch_group *groups;
+
+};
+
+struct switch_state *switch_create(int switch_id)
+{
+struct switch_state *s;
+struct net_port *list;
+struct net_port *p;
+int k;
+
+s = (struct switch_state *) calloc(1, sizeof(struct switch_state));
+s->switch_id = switch_id;
+s->node_num = net_get_node_num();
+
+list = net_get_port_list(switch_id);
+for (p=list; p!=NULL; p=p->next) s->port_num++;
+s->port = (struct net_port **)
+	malloc((s->port_num + 1) * sizeof(struct net_port *));
+for (k=0, p=list; p!=NULL; p=p->next) s->port[k++] = p;
+s->words = (s->port_num + WORD_BITS - 1) / WORD_BITS;
+return(s);
+}
+
+struct net_port **switch_ports(struct switch_state *s, int *num)
+{
+*num = s->port_num;
+return(s->port);
+}
+
+int switch_busy(struct switch_state *s)
+{
+int k;
+
+for (k=0; k<s->port_num; k++) {
+	if (s->port[k]->rx_len > 0) return(1);
+}
+return(0);
+}
+
+/* Host 'host' is reached through port k */
+static void switch_learn(struct switch_state *s, int host, int k)
+{
+int cap;
+
+if (host < 0 || host >= s->node_num) return;
+if (host >= s->fwd_cap) {
+	cap = s->fwd_cap == 0 ? 64 : s->fwd_cap;
+	while (cap <= host) cap *= 2;
+	if (cap > s->node_num) cap = s->node_num;
+	s->fwd = (int *) realloc(s->fwd, cap * sizeof(int));
+	memset(s->fwd + s->fwd_cap, -1, (cap - s->fwd_cap) * sizeof(int));
+	s->fwd_cap = cap;
+}
+s->fwd[host] = k;
+}
+
+static struct switch_group *switch_find_group(struct switch_state *s,
+		int group)
+{
+struct switch_group *g;
+
+for (g=s->groups; g!=NULL && g->group != group; g=g->next);
+return(g);
+}
+
+/* A member of the group has joined (+1) or left (-1) through port k */
+static void switch_member(struct switch_state *s, int group, int k, int n)
+{
+struct switch_group *g;
+
+g = switch_find_group(s, group);
+if (g == NULL) {
+	if (n < 0) return;
+	g = (struct switch_group *) malloc(sizeof(struct switch_group));
+	g->group = group;
+	g->members = (int *) calloc(s->port_num, sizeof(int));
+	g->ports = (unsigned long *) calloc(s->words, sizeof(unsigned long));
+	g->next = s->groups;
+	s->groups = g;
+}
+g->members[k] += n;
+if (g->members[k] < 0) g->members[k] = 0;
+if (g->members[k] > 0) g->ports[k / WORD_BITS] |= 1UL << (k % WORD_BITS);
+else g->ports[k / WORD_BITS] &= ~(1UL << (k % WORD_BITS));
+}
+
+/* Send on every port but 'in' */
+static void switch_flood(struct switch_state *s, int in,
+		struct packet_view *p)
+{
+int k;
+
+for (k=0; k<s->port_num; k++) {
+	if (k != in) packet_forward(s->port[k], p);
+}
+}
+
+/* Send on the ports of the group's bitmap but 'in' */
+static void switch_replicate(struct switch_state *s, int in,
+		struct packet_view *p)
+{
+struct switch_group *g;
+unsigned long w;
+int i, k;
+
+g = switch_find_group(s, p->dst - MCAST_BASE);
+if (g == NULL) return;		/* No members anywhere */
+for (i=0; i<s->words; i++) {
+	for (w = g->ports[i]; w != 0; w &= w - 1) {
+		k = i * WORD_BITS + __builtin_ctzl(w);
+		if (k != in) packet_forward(s->port[k], p);
+	}
+}
+}
+
+/*
+ * Forward packet p, which came in on port 'in'.  Its frame goes
+ * out as it came, straight from the rx buffer of 'in'.
+ */
+static void switch_forward(struct switch_state *s, int in,
+		struct packet_view *p)
+{
+int out;
+
+if (p->src >= 0 && p->src < MCAST_BASE) switch_learn(s, p->src, in);
+
+if (IS_MCAST(p->dst)) {
+	if (p->type == PKT_MCAST_JOIN || p->type == PKT_MCAST_LEAVE) {
+		switch_member(s, p->dst - MCAST_BASE, in,
+			p->type == PKT_MCAST_JOIN ? 1 : -1);
+		switch_flood(s, in, p);
+	}
+	else {
+		switch_replicate(s, in, p);
+	}
+	return;
+}
+out = -1;
+if (p->dst >= 0 && p->dst < s->fwd_cap) out = s->fwd[p->dst];
+if (out < 0) switch_flood(s, in, p);	/* Unknown, or broadcast */
+else if (out != in) packet_forward(s->port[out], p);
+}
+
+void switch_poll(struct switch_state *s)
+{
+struct packet_view v;
+int k, i;
+
+for (k=0; k<s->port_num; k++) {
+	packet_flush(s->port[k]);
+	for (i=0; i<SWITCH_BURST; i++) {
+		if (packet_recv_view(s->port[k], &v) <= 0) break;
+		switch_forward(s, k, &v);
+	}
+}
+for (k=0; k<s->port_num; k++) {	/* What was forwarded, in bulk */
+	packet_flush(s->port[k]);
+}
+}
+
+void switch_main(int switch_id)
+{
+switch_run(switch_create(switch_id));
+}
+
+void switch_run(struct switch_state *s)
+{
+long long loop_start;
+long long wake;
+long long now;
+long long t;
+int k;
+
+while (1) {
+	loop_start = timer_now_us();
+	switch_poll(s);
+
+	/*
+	 * Sleep, waking to write frames link emulation releases,
+	 * and a little later for those whose pipe is full
+	 */
+	while (1) {
+		wake = loop_start + SWITCH_POLL_US;
+		now = timer_now_us();
+		for (k=0; k<s->port_num; k++) {
+			t = packet_next_release(s->port[k]);
+			if (t >= 0 && t <= now) {
+				packet_flush(s->port[k]);
+				t = packet_next_release(s->port[k]);
+				if (t >= 0 && t <= now) {	/* Pipe full */
+					t = now + SWITCH_RETRY_US;
+				}
+			}
+			if (t >= 0 && t < wake) wake = t;
+		}
+		timer_sleep_until(wake);
+		if (wake >= loop_start + SWITCH_POLL_US) break;
+		for (k=0; k<s->port_num; k++) {
+			packet_flush(s->port[k]);
+		}
+	}
+}
+}
@@ -0,0 +1,32 @@
+/*
+ * switch.h
+ *
+ * A switch forwards packets between its ports.  It learns the port
+ * of each host from the source of the packets it receives, sends a
+ * packet for a known host on that port alone, and floods the others
+ * on every port but the one it came in on, so the switches and the
+ * links between them must form a tree.
+ *
+ * Multicast.  For each group a switch keeps a bitmap of the ports
+ * that lead to members, and sends a packet for the group only on
+ * those.  Joins and leaves (PKT_MCAST_JOIN, PKT_MCAST_LEAVE) are
+ * flooded, so every switch learns which way the members are.
+ */
+
+struct switch_state;
+
+struct switch_state *switch_create(int switch_id);
+
+/* Forward what has arrived on the ports */
+void switch_poll(struct switch_state *s);
+
+/* Frames are waiting and the switch should be polled again soon */
+int switch_busy(struct switch_state *s);
+
+/* The switch's network ports */
+struct net_port **switch_ports(struct switch_state *s, int *num);
+
+/* Run the switch in real time, forever */
+void switch_run(struct switch_state *s);
+
+void switch_main(int switch_id);
@@ -0,0 +1,41 @@
+/*
+ * timer.c
+ *
+ * Time for the nodes.  Everything that needs the time of day for
+ * timeouts or scheduling gets it here.
+ */
+
+#include <time.h>
+#include <errno.h>
+
+#include "timer.h"
+
+/* Simulated time, or -1.  Each simulator thread has its own. */
+static __thread long long timer_virtual = -1;
+
+void timer_set_virtual(long long t)
+{
+timer_virtual = t;
+}
+
+long long timer_now_us()
+{
+struct timespec t;
+
+if (timer_virtual >= 0) return timer_virtual;
+clock_gettime(CLOCK_MONOTONIC, &t);
+return (long long) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+/* 
+ * Sleep to an absolute time, so time spent working before the
+ * call does not add to the sleep
+ */
+void timer_sleep_until(long long t)
+{
+struct timespec ts;
+
+ts.tv_sec = t / 1000000;
+ts.tv_nsec = (t % 1000000) * 1000;
+while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
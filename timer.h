@@ -0,0 +1,15 @@
+/*
+ * timer.h
+ *
+ * Time for the nodes, in microseconds since an arbitrary start.
+ * Under the simulator (sim.c) it is the simulated time instead.
+ */
+
+/* Current time */
+long long timer_now_us();
+
+/* Sleep until time t */
+void timer_sleep_until(long long t);
+
+/* Use simulated time t from now on */
+void timer_set_virtual(long long t);
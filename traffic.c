@@ -0,0 +1,207 @@
+/*
+ * traffic.c
+ *
+ * Traffic generators and sinks for load tests; see traffic.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "main.h"
+#include "traffic.h"
+
+static void put32(char *b, unsigned int v)
+{
+b[0] = (char) (v >> 24);
+b[1] = (char) (v >> 16);
+b[2] = (char) (v >> 8);
+b[3] = (char) v;
+}
+
+static unsigned int get32(char *b)
+{
+return ((unsigned int) (unsigned char) b[0] << 24)
+	| ((unsigned int) (unsigned char) b[1] << 16)
+	| ((unsigned int) (unsigned char) b[2] << 8)
+	| (unsigned int) (unsigned char) b[3];
+}
+
+/* Sequence number comparison that survives wrap around */
+static int seq_lt(unsigned int a, unsigned int b)
+{
+return (int) (a - b) < 0;
+}
+
+/* Uniform in (0, 1], from a xorshift generator */
+static double traffic_uniform(struct traffic_gen *g)
+{
+g->rand ^= g->rand << 13;
+g->rand ^= g->rand >> 17;
+g->rand ^= g->rand << 5;
+return (g->rand + 1.0) / 4294967296.0;
+}
+
+/* Microseconds from one packet to the next */
+static long long traffic_gap(struct traffic_gen *g)
+{
+double mean = 1e6 / g->rate;
+
+if (g->pattern == TRAFFIC_POISSON) {
+	return (long long) (-log(traffic_uniform(g)) * mean);
+}
+return (long long) mean;
+}
+
+int traffic_gen_init(struct traffic_gen *g, int src, int flow,
+		char dsts[], double rate, int size, char pattern,
+		long long on_us, long long off_us, long long us,
+		long long now)
+{
+char str[NAME_LENGTH];
+char *s;
+int lo, hi, id, k;
+
+memset(g, 0, sizeof(struct traffic_gen));
+g->src = src;
+g->flow = flow;
+g->rate = rate;
+g->size = size < TRAFFIC_HDR_LEN ? TRAFFIC_HDR_LEN : size;
+g->pattern = pattern;
+g->on_us = on_us > 0 ? on_us : TRAFFIC_ON_US;
+g->off_us = off_us > 0 ? off_us : TRAFFIC_OFF_US;
+g->start_us = now;
+g->end_us = now + us;
+g->next_us = now;
+g->on_end_us = now + g->on_us;
+g->rand = (unsigned int) src * 2654435761u
+	^ (unsigned int) flow * 40503u ^ 0x9e3779b9u;
+if (g->rand == 0) g->rand = 1;
+
+/* Host ids and ranges separated by commas, as the manager takes */
+strncpy(str, dsts, NAME_LENGTH-1);
+str[NAME_LENGTH-1] = '\0';
+for (s = strtok(str, ","); s != NULL; s = strtok(NULL, ",")) {
+	k = sscanf(s, "%d-%d", &lo, &hi);
+	if (k < 1) continue;
+	if (k == 1) hi = lo;
+	for (id=lo; id<=hi && g->dst_num < TRAFFIC_DST_MAX; id++) {
+		if (id != src) g->dst[g->dst_num++] = id;
+	}
+}
+return g->dst_num > 0 && rate > 0;
+}
+
+int traffic_gen_next(struct traffic_gen *g, long long now, struct packet *p)
+{
+if (g->next_us > now || g->next_us >= g->end_us) return 0;
+
+p->src = g->src;
+p->dst = g->dst[g->dst_next];
+p->type = PKT_TRAFFIC;
+p->length = g->size;
+put32(p->payload, (unsigned int) g->flow);
+put32(p->payload+4, g->seq[g->dst_next]++);
+put32(p->payload+8, (unsigned int) (now >> 32));
+put32(p->payload+12, (unsigned int) now);
+memset(p->payload + TRAFFIC_HDR_LEN, 0, g->size - TRAFFIC_HDR_LEN);
+g->dst_next = (g->dst_next + 1) % g->dst_num;
+g->sent++;
+g->bytes += g->size;
+
+/* Schedule from when it was due, so a late poll does not slow it */
+g->next_us += traffic_gap(g);
+if (g->pattern == TRAFFIC_ONOFF && g->next_us >= g->on_end_us) {
+	g->next_us = g->on_end_us + g->off_us;
+	g->on_end_us = g->next_us + g->on_us;
+}
+return 1;
+}
+
+int traffic_gen_done(struct traffic_gen *g, long long now)
+{
+return now >= g->end_us || g->next_us >= g->end_us;
+}
+
+void traffic_sink_input(struct traffic_sink **list, struct packet *p,
+		long long now)
+{
+struct traffic_sink *s;
+unsigned int seq;
+long long delay;
+int flow;
+
+if (p->length < TRAFFIC_HDR_LEN) return;
+flow = (int) get32(p->payload);
+seq = get32(p->payload+4);
+delay = now - (((long long) get32(p->payload+8) << 32)
+	| get32(p->payload+12));
+
+for (s = *list; s != NULL; s = s->next) {
+	if (s->src == p->src && s->flow == flow) break;
+}
+if (s == NULL) {
+	s = (struct traffic_sink *) calloc(1, sizeof(struct traffic_sink));
+	s->src = p->src;
+	s->flow = flow;
+	s->seq_next = seq;
+	s->first_us = now;
+	s->delay_min = delay;
+	s->next = *list;
+	*list = s;
+}
+
+if (seq == s->seq_next) {
+	s->seq_next++;
+}
+else if (seq_lt(s->seq_next, seq)) {
+	s->lost += seq - s->seq_next;
+	s->seq_next = seq + 1;
+}
+else {			/* Counted lost when a later one came */
+	s->reordered++;
+	if (s->lost > 0) s->lost--;
+}
+s->packets++;
+s->bytes += p->length;
+s->last_us = now;
+s->delay_sum += delay;
+if (delay < s->delay_min) s->delay_min = delay;
+if (delay > s->delay_max) s->delay_max = delay;
+}
+
+int traffic_sink_report(struct traffic_sink *list, char buf[])
+{
+struct traffic_sink *s;
+long long first = 0, last = 0;
+long long dsum = 0, dmin = 0, dmax = 0;
+long packets = 0, bytes = 0, lost = 0, reordered = 0;
+int flows = 0;
+
+for (s = list; s != NULL; s = s->next) {
+	if (flows == 0 || s->first_us < first) first = s->first_us;
+	if (flows == 0 || s->last_us > last) last = s->last_us;
+	if (flows == 0 || s->delay_min < dmin) dmin = s->delay_min;
+	if (flows == 0 || s->delay_max > dmax) dmax = s->delay_max;
+	dsum += s->delay_sum;
+	packets += s->packets;
+	bytes += s->bytes;
+	lost += s->lost;
+	reordered += s->reordered;
+	flows++;
+}
+return sprintf(buf, "%d %ld %ld %ld %ld %.6f %lld %lld %lld",
+	flows, packets, bytes, lost, reordered, (last - first) / 1e6,
+	packets > 0 ? dsum / packets : 0, dmin, dmax);
+}
+
+void traffic_sink_clear(struct traffic_sink **list)
+{
+struct traffic_sink *s;
+
+while ((s = *list) != NULL) {
+	*list = s->next;
+	free(s);
+}
+}
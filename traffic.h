@@ -0,0 +1,103 @@
+/*
+ * traffic.h
+ *
+ * Synthetic traffic for load tests.  A generator sends PKT_TRAFFIC
+ * packets to one or more destinations in turn, at a given rate and
+ * size, for a given time.  The gaps between packets follow one of
+ * the patterns:
+ *
+ *    TRAFFIC_CONSTANT  evenly spaced
+ *    TRAFFIC_POISSON   exponential gaps, with the same mean
+ *    TRAFFIC_ONOFF     evenly spaced during "on" periods, none
+ *                      during the "off" periods between them
+ *
+ * Each packet's payload starts with the flow id, a sequence number
+ * counting the packets of the flow to its destination, and the
+ * time it was sent, integers most significant byte first.
+ * A sink counts what arrives from each flow: packets and bytes,
+ * those lost or out of order by sequence number, and the delay
+ * from the time sent, which holds since nodes share a clock.
+ */
+
+#define TRAFFIC_CONSTANT 'c'
+#define TRAFFIC_POISSON 'p'
+#define TRAFFIC_ONOFF 'b'
+
+#define TRAFFIC_HDR_LEN 16	/* Flow id, sequence number, time sent */
+#define TRAFFIC_DST_MAX 256	/* Destinations of a generator */
+#define TRAFFIC_ON_US 100000	/* Default on and off periods */
+#define TRAFFIC_OFF_US 100000
+
+struct traffic_gen {
+	int src;
+	int flow;
+	int dst[TRAFFIC_DST_MAX];
+	int dst_num;
+	int dst_next;
+	double rate;		/* Packets per second, while on */
+	int size;		/* Payload bytes */
+	char pattern;
+	long long on_us;	/* TRAFFIC_ONOFF periods */
+	long long off_us;
+
+	long long start_us;
+	long long end_us;
+	long long next_us;	/* When the next packet is due */
+	long long on_end_us;	/* TRAFFIC_ONOFF: end of this on period */
+	unsigned int seq[TRAFFIC_DST_MAX];	/* Next to each destination */
+	unsigned int rand;	/* State of the random gaps */
+
+	long sent;		/* Statistics */
+	long bytes;
+};
+
+struct traffic_sink {
+	int src;
+	int flow;
+	unsigned int seq_next;	/* Sequence number expected next */
+	long packets;
+	long bytes;
+	long lost;		/* Sequence numbers skipped */
+	long reordered;		/* Arrived after a later one */
+	long long first_us;	/* Arrival of the first and last */
+	long long last_us;
+	long long delay_sum;	/* One-way delays, microseconds */
+	long long delay_min;
+	long long delay_max;
+	struct traffic_sink *next;
+};
+
+/*
+ * Set up a generator from 'src' to the hosts in dsts[], e.g.
+ * "3" or "1-4,7", for 'us' microseconds from 'now'.  Returns 0 if
+ * there is no destination or the rate is not positive.
+ */
+int traffic_gen_init(struct traffic_gen *g, int src, int flow,
+		char dsts[], double rate, int size, char pattern,
+		long long on_us, long long off_us, long long us,
+		long long now);
+
+/*
+ * If a packet is due by 'now', make it in p and return 1; else
+ * return 0.  Called until it returns 0, it catches up on the
+ * packets that fell due since it was last called.
+ */
+int traffic_gen_next(struct traffic_gen *g, long long now, struct packet *p);
+
+/* The generator has sent everything it is to send */
+int traffic_gen_done(struct traffic_gen *g, long long now);
+
+/* Count a PKT_TRAFFIC packet that arrived at time 'now' */
+void traffic_sink_input(struct traffic_sink **list, struct packet *p,
+		long long now);
+
+/*
+ * Totals of the sinks in list as text, as the manager gets them:
+ * flows, packets, bytes, lost, reordered, the seconds from first
+ * to last arrival, and the delay average, minimum and maximum in
+ * microseconds.  Returns the length.
+ */
+int traffic_sink_report(struct traffic_sink *list, char buf[]);
+
+/* Forget the sinks in *list */
+void traffic_sink_clear(struct traffic_sink **list);
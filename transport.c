@@ -0,0 +1,481 @@
+/*
+ * transport.c
+ *
+ * Reliable sliding-window transport for file transfers.
+ * See transport.h for the segment and ack formats.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "packet.h"
+#include "transport.h"
+
+/* Put and get integers in the payload, most significant byte first */
+static void put16(char *b, unsigned int v)
+{
+b[0] = (char) (v >> 8);
+b[1] = (char) v;
+}
+
+static unsigned int get16(char *b)
+{
+return ((unsigned int) (unsigned char) b[0] << 8)
+	| (unsigned int) (unsigned char) b[1];
+}
+
+static void put32(char *b, unsigned int v)
+{
+b[0] = (char) (v >> 24);
+b[1] = (char) (v >> 16);
+b[2] = (char) (v >> 8);
+b[3] = (char) v;
+}
+
+static unsigned int get32(char *b)
+{
+return ((unsigned int) (unsigned char) b[0] << 24)
+	| ((unsigned int) (unsigned char) b[1] << 16)
+	| ((unsigned int) (unsigned char) b[2] << 8)
+	| (unsigned int) (unsigned char) b[3];
+}
+
+/* Sequence number comparison that survives wrap around */
+static int seq_lt(unsigned int a, unsigned int b)
+{
+return (int) (a - b) < 0;
+}
+
+int tp_conn_id(struct packet *p)
+{
+return (int) get16(p->payload);
+}
+
+unsigned int tp_seq(struct packet *p)
+{
+return get32(p->payload+2);
+}
+
+
+/*
+ * Sender side
+ */
+
+void tp_sender_init(struct tp_sender *s, int src, int dst, int conn,
+		int window, int seg_max)
+{
+int i;
+
+s->src = src;
+s->dst = dst;
+s->conn = conn;
+if (window < 1) window = 1;
+if (window > TP_WINDOW_MAX) window = TP_WINDOW_MAX;
+s->window = window;
+s->seg_max = seg_max;
+s->snd_una = 0;
+s->snd_nxt = 0;
+s->snd_end = 0;
+s->end_queued = 0;
+for (i=0; i<TP_WINDOW_MAX; i++) {
+	s->seg[i].sent_us = 0;
+	s->seg[i].retx = 0;
+	s->seg[i].sacked = 0;
+	s->seg[i].present = 0;
+	s->seg[i].data = NULL;
+}
+s->srtt = 0;
+s->rttvar = 0;
+s->rto = TP_RTO_INIT;
+s->dupacks = 0;
+s->timeouts = 0;
+s->fast_retx = 0;
+s->dupack_thresh = TP_DUPACK_THRESH;
+s->peer_opts = 0;
+s->peers = 0;
+s->peer_num = 0;
+s->segs_sent = 0;
+s->segs_retx = 0;
+s->fast_retx_num = 0;
+s->stripe = NULL;
+s->next = NULL;
+}
+
+void tp_sender_multicast(struct tp_sender *s, int peers)
+{
+if (peers < 1) peers = 1;
+if (peers > TP_PEERS_MAX) peers = TP_PEERS_MAX;
+s->peers = peers;
+}
+
+void tp_sender_reorder(struct tp_sender *s, int dupacks)
+{
+s->dupack_thresh = dupacks > 1 ? dupacks : 1;
+}
+
+void tp_sender_free(struct tp_sender *s)
+{
+int i;
+
+for (i=0; i<TP_WINDOW_MAX; i++) {
+	free(s->seg[i].data);
+	s->seg[i].data = NULL;
+}
+}
+
+int tp_sender_space(struct tp_sender *s)
+{
+if (s->end_queued) return 0;
+return s->window - (int) (s->snd_end - s->snd_una);
+}
+
+int tp_sender_queue(struct tp_sender *s, int type, char data[], int length)
+{
+struct tp_seg *g;
+
+if (tp_sender_space(s) <= 0 || length > s->seg_max) return 0;
+
+g = &s->seg[s->snd_end % TP_WINDOW_MAX];
+g->type = type;
+g->length = length;
+g->data = (char *) malloc(length > 0 ? length : 1);
+memcpy(g->data, data, length);
+g->sent_us = 0;
+g->retx = 0;
+g->sacked = 0;
+g->present = 1;
+s->snd_end++;
+if (type == PKT_FILE_UPLOAD_END) {
+	s->end_queued = 1;
+}
+return 1;
+}
+
+/* Build the packet that carries segment 'seq' */
+static struct packet *tp_make_packet(struct tp_sender *s, unsigned int seq)
+{
+struct packet *p;
+struct tp_seg *g;
+
+g = &s->seg[seq % TP_WINDOW_MAX];
+p = packet_alloc(g->length + TP_HDR_LEN);
+p->src = s->src;
+p->dst = s->dst;
+p->type = g->type;
+put16(p->payload, s->conn);
+put32(p->payload+2, seq);
+memcpy(p->payload+TP_HDR_LEN, g->data, g->length);
+p->length = g->length + TP_HDR_LEN;
+return p;
+}
+
+/* Queue segment 'seq' for retransmission */
+static int tp_retransmit(struct tp_sender *s, unsigned int seq, long long now,
+		struct packet *out[], int n, int max)
+{
+struct tp_seg *g;
+
+if (n >= max) return n;
+g = &s->seg[seq % TP_WINDOW_MAX];
+out[n++] = tp_make_packet(s, seq);
+g->sent_us = now;
+g->retx++;
+s->segs_retx++;
+return n;
+}
+
+int tp_sender_poll(struct tp_sender *s, long long now,
+		struct packet *out[], int max)
+{
+unsigned int seq;
+unsigned int high;
+struct tp_seg *g;
+int expired;
+int n = 0;
+
+/*
+ * Fast retransmit: resend the oldest segment and every hole
+ * below the highest selectively acked segment
+ */
+if (s->fast_retx && seq_lt(s->snd_una, s->snd_nxt)) {
+	high = s->snd_una;
+	for (seq = s->snd_una; seq_lt(seq, s->snd_nxt); seq++) {
+		if (s->seg[seq % TP_WINDOW_MAX].sacked) high = seq;
+	}
+	for (seq = s->snd_una; seq == s->snd_una || seq_lt(seq, high); seq++) {
+		if (!s->seg[seq % TP_WINDOW_MAX].sacked) {
+			n = tp_retransmit(s, seq, now, out, n, max);
+		}
+	}
+}
+s->fast_retx = 0;
+
+/* Retransmit timeout, with exponential backoff */
+expired = 0;
+for (seq = s->snd_una; seq_lt(seq, s->snd_nxt); seq++) {
+	g = &s->seg[seq % TP_WINDOW_MAX];
+	if (!g->sacked && now - g->sent_us >= s->rto) {
+		n = tp_retransmit(s, seq, now, out, n, max);
+		expired = 1;
+	}
+}
+if (expired) {
+	s->timeouts++;
+	s->rto = s->rto * 2;
+	if (s->rto > TP_RTO_MAX) s->rto = TP_RTO_MAX;
+}
+
+/* New segments that fit in the window */
+while (n < max && seq_lt(s->snd_nxt, s->snd_end)
+		&& (int) (s->snd_nxt - s->snd_una) < s->window) {
+	g = &s->seg[s->snd_nxt % TP_WINDOW_MAX];
+	out[n++] = tp_make_packet(s, s->snd_nxt);
+	g->sent_us = now;
+	s->segs_sent++;
+	s->snd_nxt++;
+}
+
+return n;
+}
+
+/* Update the RTT estimate and retransmit timeout (RFC 6298) */
+static void tp_rtt_sample(struct tp_sender *s, long long r)
+{
+long long d;
+
+if (s->srtt == 0) {
+	s->srtt = r;
+	s->rttvar = r / 2;
+}
+else {
+	d = s->srtt - r;
+	if (d < 0) d = -d;
+	s->rttvar = (3 * s->rttvar + d) / 4;
+	s->srtt = (7 * s->srtt + r) / 8;
+}
+s->rto = s->srtt + 4 * s->rttvar;
+if (s->rto < TP_RTO_MIN) s->rto = TP_RTO_MIN;
+if (s->rto > TP_RTO_MAX) s->rto = TP_RTO_MAX;
+}
+
+/*
+ * Multicast: record an ack from receiver 'src', and turn *cum and
+ * *sack into what every receiver has.  *dup is whether the ack is
+ * a duplicate from a receiver holding back the others.  Returns 0
+ * if the ack is from a receiver too many.
+ */
+static int tp_peer_ack(struct tp_sender *s, int src, unsigned int *cum,
+		unsigned int *sack, int *dup)
+{
+unsigned int all;
+unsigned int seq;
+int i, j, k;
+
+for (i=0; i<s->peer_num && s->peer_id[i] != src; i++);
+if (i == s->peer_num) {
+	if (i == s->peers) return 0;
+	s->peer_id[i] = src;
+	s->peer_cum[i] = 0;
+	s->peer_sack[i] = 0;
+	s->peer_num++;
+}
+*dup = *cum == s->peer_cum[i];
+if (!seq_lt(*cum, s->peer_cum[i])) {
+	s->peer_cum[i] = *cum;
+	s->peer_sack[i] = *sack;
+}
+
+/* Until all have been heard from, nothing is acked by all */
+if (s->peer_num < s->peers) {
+	*cum = s->snd_una;
+	*sack = 0;
+	return 1;
+}
+all = s->peer_cum[0];
+for (j=1; j<s->peer_num; j++) {
+	if (seq_lt(s->peer_cum[j], all)) all = s->peer_cum[j];
+}
+*dup = *dup && s->peer_cum[i] == all;
+*cum = all;
+*sack = 0;
+for (i=0; i<32; i++) {
+	seq = all + 1 + i;
+	for (j=0; j<s->peer_num; j++) {
+		if (seq_lt(seq, s->peer_cum[j])) continue;
+		k = (int) (seq - s->peer_cum[j]) - 1;
+		if (k < 0 || k >= 32 || !(s->peer_sack[j] & (1u << k))) break;
+	}
+	if (j == s->peer_num) *sack |= 1u << i;
+}
+return 1;
+}
+
+void tp_sender_ack(struct tp_sender *s, struct packet *p, long long now)
+{
+unsigned int cum;
+unsigned int sack;
+unsigned int seq;
+struct tp_seg *g;
+int dup;
+int i;
+
+if (p->length < TP_ACK_LEN) return;
+cum = get32(p->payload+2);
+sack = get32(p->payload+6);
+s->peer_opts = (int) (unsigned char) p->payload[10];
+dup = 1;
+if (s->peers > 0 && !tp_peer_ack(s, p->src, &cum, &sack, &dup)) return;
+
+if (seq_lt(s->snd_una, cum) && !seq_lt(s->snd_nxt, cum)) {
+	/* New data acknowledged.  Karn: only time fresh segments */
+	g = &s->seg[(cum-1) % TP_WINDOW_MAX];
+	if (g->retx == 0 && g->sent_us > 0) {
+		tp_rtt_sample(s, now - g->sent_us);
+	}
+	for (seq = s->snd_una; seq_lt(seq, cum); seq++) {
+		g = &s->seg[seq % TP_WINDOW_MAX];
+		g->present = 0;
+		free(g->data);
+		g->data = NULL;
+	}
+	s->snd_una = cum;
+	s->dupacks = 0;
+	s->timeouts = 0;
+}
+else if (dup && cum == s->snd_una && seq_lt(s->snd_una, s->snd_nxt)) {
+	s->dupacks++;
+	if (s->dupacks == s->dupack_thresh) {
+		s->fast_retx = 1;
+		s->fast_retx_num++;
+	}
+}
+
+for (i=0; i<32; i++) {
+	if (sack & (1u << i)) {
+		seq = cum + 1 + i;
+		if (!seq_lt(seq, s->snd_una) && seq_lt(seq, s->snd_nxt)) {
+			s->seg[seq % TP_WINDOW_MAX].sacked = 1;
+		}
+	}
+}
+}
+
+int tp_sender_done(struct tp_sender *s)
+{
+return s->end_queued && s->snd_una == s->snd_end;
+}
+
+int tp_sender_failed(struct tp_sender *s)
+{
+return s->timeouts > TP_MAX_TIMEOUTS;
+}
+
+
+/*
+ * Receiver side
+ */
+
+void tp_receiver_init(struct tp_receiver *r, int host_id, int peer, int conn)
+{
+int i;
+
+r->host_id = host_id;
+r->peer = peer;
+r->conn = conn;
+r->rcv_nxt = 0;
+r->done = 0;
+r->last_us = 0;
+r->opts = 0;
+for (i=0; i<TP_WINDOW_MAX; i++) {
+	r->seg[i].present = 0;
+	r->seg[i].data = NULL;
+}
+r->fp = NULL;
+r->fname = NULL;
+r->zs = NULL;
+r->dd = NULL;
+r->sigs = NULL;
+r->next = NULL;
+}
+
+void tp_receiver_free(struct tp_receiver *r)
+{
+int i;
+
+for (i=0; i<TP_WINDOW_MAX; i++) {
+	free(r->seg[i].data);
+	r->seg[i].data = NULL;
+}
+}
+
+int tp_receiver_input(struct tp_receiver *r, struct packet *p, long long now)
+{
+unsigned int seq;
+struct tp_seg *g;
+int length;
+
+r->last_us = now;
+if (p->length < TP_HDR_LEN) return 0;
+seq = get32(p->payload+2);
+
+/* Old duplicate, or beyond what we can buffer */
+if (seq_lt(seq, r->rcv_nxt) || !seq_lt(seq, r->rcv_nxt + TP_WINDOW_MAX)) {
+	return 0;
+}
+
+g = &r->seg[seq % TP_WINDOW_MAX];
+if (g->present) return 0;
+
+length = p->length - TP_HDR_LEN;
+g->type = (int) p->type;
+g->length = length;
+g->data = (char *) malloc(length > 0 ? length : 1);
+memcpy(g->data, p->payload+TP_HDR_LEN, length);
+g->present = 1;
+return 1;
+}
+
+int tp_receiver_deliver(struct tp_receiver *r, int *type, char data[])
+{
+struct tp_seg *g;
+
+g = &r->seg[r->rcv_nxt % TP_WINDOW_MAX];
+if (r->done || !g->present) return -1;
+
+*type = g->type;
+memcpy(data, g->data, g->length);
+free(g->data);
+g->data = NULL;
+g->present = 0;
+r->rcv_nxt++;
+if (g->type == PKT_FILE_UPLOAD_END) {
+	r->done = 1;
+}
+return g->length;
+}
+
+struct packet *tp_receiver_ack(struct tp_receiver *r)
+{
+struct packet *p;
+unsigned int sack = 0;
+int i;
+
+for (i=0; i<32 && i+1<TP_WINDOW_MAX; i++) {
+	if (r->seg[(r->rcv_nxt + 1 + i) % TP_WINDOW_MAX].present) {
+		sack |= 1u << i;
+	}
+}
+
+p = packet_alloc(TP_ACK_LEN);
+p->src = r->host_id;
+p->dst = r->peer;
+p->type = PKT_FILE_ACK;
+put16(p->payload, r->conn);
+put32(p->payload+2, r->rcv_nxt);
+put32(p->payload+6, sack);
+p->payload[10] = (char) r->opts;
+p->length = TP_ACK_LEN;
+return p;
+}
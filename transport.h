@@ -0,0 +1,163 @@
+/*
+ * transport.h
+ *
+ * Reliable sliding-window transport used by the file transfer jobs.
+ *
+ * Every segment carries a connection id and a sequence number at
+ * the front of the packet payload.  The receiver answers each
+ * segment with a PKT_FILE_ACK that has a cumulative ack (the next
+ * sequence number it expects) and a selective ack bitmap of the
+ * segments it holds beyond that, and a byte of options the
+ * receiver accepted from the start segment.  The sender keeps at
+ * most 'window' segments in flight, retransmits on an RTT-based
+ * timeout, and fast-retransmits after three duplicate acks.
+ */
+
+#define TP_WINDOW_MAX 32	/* Largest window, in segments */
+#define TP_WINDOW_DEFAULT 8
+#define TP_HDR_LEN 6		/* Connection id (2) + sequence number (4) */
+#define TP_ACK_LEN 11		/* Connection id + cum ack + sack bitmap
+				   + accepted options */
+#define TP_CONN_MAX 65535	/* Connection ids run 1 to this, so one is
+				   not reused while a receiver of the
+				   last connection with it is kept */
+
+#define TP_RTO_INIT 1000000	/* Retransmit timeouts in microseconds */
+#define TP_RTO_MIN 200000
+#define TP_RTO_MAX 4000000
+#define TP_DUPACK_THRESH 3
+#define TP_MAX_TIMEOUTS 10	/* Give up after this many backoffs */
+#define TP_IDLE_TIMEOUT 10000000 /* Receiver state is dropped after this */
+#define TP_PEERS_MAX 64		/* Receivers of a multicast transfer */
+
+struct tp_seg {  /* A segment held by the sender or receiver */
+	int type;
+	int length;
+	char *data;		/* Allocated while the segment is held */
+	long long sent_us;	/* 0 if not transmitted yet */
+	int retx;		/* Number of retransmissions */
+	int sacked;
+	int present;		/* Receiver: segment is buffered */
+};
+
+struct tp_sender {
+	int src;
+	int dst;
+	int conn;
+	int window;
+	int seg_max;		/* Largest segment data, from the MTU */
+	unsigned int snd_una;	/* Oldest unacknowledged segment */
+	unsigned int snd_nxt;	/* Next segment to transmit */
+	unsigned int snd_end;	/* Next segment to be queued */
+	int end_queued;		/* The last segment has been queued */
+	struct tp_seg seg[TP_WINDOW_MAX];
+
+	long long srtt;		/* RTT estimate, microseconds */
+	long long rttvar;
+	long long rto;
+	int dupacks;
+	int timeouts;		/* Consecutive timeouts */
+	int fast_retx;		/* Retransmit snd_una on the next poll */
+	int dupack_thresh;	/* Duplicate acks that mean a loss */
+	int peer_opts;		/* Options the receiver accepted */
+
+	int peers;		/* Multicast: receivers there must be, */
+	int peer_num;		/*    those heard from, and what each */
+	int peer_id[TP_PEERS_MAX];	/*    has acked.  0 if unicast */
+	unsigned int peer_cum[TP_PEERS_MAX];
+	unsigned int peer_sack[TP_PEERS_MAX];
+
+	long segs_sent;		/* Statistics */
+	long segs_retx;
+	long fast_retx_num;
+	struct stripe *stripe;	/* Paths it is striped over, owned by the host */
+	struct tp_sender *next;
+};
+
+struct tp_receiver {
+	int host_id;
+	int peer;
+	int conn;
+	unsigned int rcv_nxt;	/* Next in-order segment expected */
+	int done;		/* The END segment has been delivered */
+	long long last_us;	/* Last time a segment arrived */
+	int opts;		/* Accepted options, echoed in acks */
+	struct tp_seg seg[TP_WINDOW_MAX];
+
+	FILE *fp;		/* File being written, owned by the host */
+	char *fname;		/* Its name, from malloc(), likewise */
+	struct lz_stream *zs;	/* Incoming chunk stream, owned by the host */
+	struct delta_dec *dd;	/* Delta being applied, likewise */
+	struct delta_sigs *sigs;	/* Signatures being received, likewise */
+	struct tp_receiver *next;
+};
+
+/* Connection id of a transport packet (data or ack) */
+int tp_conn_id(struct packet *p);
+
+/* Sequence number of a data segment */
+unsigned int tp_seq(struct packet *p);
+
+/*
+ * Sender side
+ */
+void tp_sender_init(struct tp_sender *s, int src, int dst, int conn,
+		int window, int seg_max);
+
+/*
+ * Send to a multicast group with 'peers' receivers.  A segment is
+ * acknowledged once every receiver has acked it.
+ */
+void tp_sender_multicast(struct tp_sender *s, int peers);
+
+/*
+ * Take 'dupacks' duplicate acks, rather than TP_DUPACK_THRESH, as
+ * a sign of loss, for segments that may arrive out of order
+ */
+void tp_sender_reorder(struct tp_sender *s, int dupacks);
+
+/* Free the segments the sender still holds */
+void tp_sender_free(struct tp_sender *s);
+
+/* Number of segments that can be queued right now */
+int tp_sender_space(struct tp_sender *s);
+
+/* Queue a segment of 'type' with 'length' bytes from data[] */
+int tp_sender_queue(struct tp_sender *s, int type, char data[], int length);
+
+/*
+ * Collect the packets to transmit now, new segments and
+ * retransmissions, into out[].  Returns the number of packets,
+ * which the caller sends and frees.
+ */
+int tp_sender_poll(struct tp_sender *s, long long now,
+		struct packet *out[], int max);
+
+/* Process an ack packet for this connection */
+void tp_sender_ack(struct tp_sender *s, struct packet *p, long long now);
+
+/* Every segment including the END segment has been acknowledged */
+int tp_sender_done(struct tp_sender *s);
+
+/* The peer stopped answering */
+int tp_sender_failed(struct tp_sender *s);
+
+/*
+ * Receiver side
+ */
+void tp_receiver_init(struct tp_receiver *r, int host_id, int peer, int conn);
+
+/* Free the segments the receiver still holds */
+void tp_receiver_free(struct tp_receiver *r);
+
+/* Accept a data segment.  Returns 1 if the segment was new */
+int tp_receiver_input(struct tp_receiver *r, struct packet *p, long long now);
+
+/*
+ * Remove the next in-order segment, copying its data into data[].
+ * Returns the length of the data, or -1 if there is none yet.
+ */
+int tp_receiver_deliver(struct tp_receiver *r, int *type, char data[]);
+
+/* Build an ack packet describing what the receiver holds */
+struct packet *tp_receiver_ack(struct tp_receiver *r);
@@ -0,0 +1,423 @@
+/*
+ * uring.c
+ *
+ * io_uring through its system calls, without liburing.
+ *
+ * The rings are shared with the kernel.  We add submissions at the
+ * tail of the submission ring and the kernel takes them from its
+ * head when io_uring_enter() is called; the kernel adds completions
+ * at the tail of the completion ring and we take them from its head,
+ * which needs no system call.
+ *
+ * Reads use a ring of provided buffers.  A multishot read on a pipe
+ * stays posted and takes a free buffer each time data comes, until
+ * the buffers run out.  A channel keeps the buffers it got in order
+ * and gives each back once the host has taken all its bytes, so a
+ * host that falls behind stops the reads, as a full pipe would.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) \
+	&& defined(__NR_io_uring_register)
+#include <linux/io_uring.h>
+#define URING_AVAILABLE 1
+#endif
+
+#ifdef URING_AVAILABLE
+
+#ifndef IORING_OP_READ_MULTISHOT
+#define IORING_OP_READ_MULTISHOT 49	/* Linux 6.7 */
+#endif
+
+#define URING_ENTRIES 256	/* Submission ring; completions twice that */
+#define URING_BUFS 64		/* Provided read buffers, a power of 2 */
+#define URING_BUF_SIZE 16384
+#define URING_WRITE_MAX 65536	/* Largest write taken at once */
+#define URING_GROUP 0		/* Buffer group id */
+
+struct uring {
+	int fd;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned int queued;	/* Submissions not yet given to the kernel */
+
+	struct io_uring_buf_ring *br;	/* Provided buffers */
+	char *bufs;
+	unsigned short br_tail;
+	int br_free;		/* Buffers the kernel may fill */
+
+	struct uring_chan **chan;
+	int chan_num;
+	int chan_cap;
+};
+
+static int sys_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_uring_enter(int fd, unsigned int to_submit,
+		unsigned int min_complete, unsigned int flags)
+{
+return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		flags, NULL, 0);
+}
+
+static int sys_uring_register(int fd, unsigned int op, void *arg,
+		unsigned int nr)
+{
+return (int) syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+/* Give buffer 'bid' to the kernel to fill */
+static void uring_buf_give(struct uring *r, unsigned short bid)
+{
+struct io_uring_buf *b;
+
+b = &r->br->bufs[r->br_tail & (URING_BUFS - 1)];
+b->addr = (unsigned long) (r->bufs + (long) bid * URING_BUF_SIZE);
+b->len = URING_BUF_SIZE;
+b->bid = bid;
+r->br_tail++;
+atomic_store_explicit((_Atomic unsigned short *) &r->br->tail,
+	r->br_tail, memory_order_release);
+r->br_free++;
+}
+
+int uring_available()
+{
+struct io_uring_params p;
+int fd;
+
+memset(&p, 0, sizeof(p));
+fd = sys_uring_setup(1, &p);
+if (fd < 0) return 0;
+close(fd);
+return 1;
+}
+
+struct uring *uring_create()
+{
+struct io_uring_params p;
+struct io_uring_buf_reg reg;
+struct uring *r;
+char *sq, *cq;
+size_t sq_size, cq_size;
+int fd, i;
+
+memset(&p, 0, sizeof(p));
+fd = sys_uring_setup(URING_ENTRIES, &p);
+if (fd < 0) return NULL;
+if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {	/* Linux 5.4 */
+	close(fd);
+	return NULL;
+}
+
+sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+if (cq_size > sq_size) sq_size = cq_size;
+sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+	MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+if (sq == MAP_FAILED) {
+	close(fd);
+	return NULL;
+}
+cq = sq;
+
+r = (struct uring *) calloc(1, sizeof(struct uring));
+r->fd = fd;
+r->sq_head = (unsigned int *) (sq + p.sq_off.head);
+r->sq_tail = (unsigned int *) (sq + p.sq_off.tail);
+r->sq_mask = *(unsigned int *) (sq + p.sq_off.ring_mask);
+r->sq_array = (unsigned int *) (sq + p.sq_off.array);
+r->cq_head = (unsigned int *) (cq + p.cq_off.head);
+r->cq_tail = (unsigned int *) (cq + p.cq_off.tail);
+r->cq_mask = *(unsigned int *) (cq + p.cq_off.ring_mask);
+r->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+	PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+	IORING_OFF_SQES);
+if (r->sqes == MAP_FAILED) {
+	munmap(sq, sq_size);
+	close(fd);
+	free(r);
+	return NULL;
+}
+
+/* The ring of provided buffers, and the buffers (Linux 5.19) */
+r->br = mmap(NULL, URING_BUFS * sizeof(struct io_uring_buf),
+	PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+r->bufs = mmap(NULL, (size_t) URING_BUFS * URING_BUF_SIZE,
+	PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+memset(&reg, 0, sizeof(reg));
+reg.ring_addr = (unsigned long) r->br;
+reg.ring_entries = URING_BUFS;
+reg.bgid = URING_GROUP;
+if (r->br == MAP_FAILED || r->bufs == MAP_FAILED
+	|| sys_uring_register(fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+	if (r->br != MAP_FAILED) {
+		munmap(r->br, URING_BUFS * sizeof(struct io_uring_buf));
+	}
+	if (r->bufs != MAP_FAILED) {
+		munmap(r->bufs, (size_t) URING_BUFS * URING_BUF_SIZE);
+	}
+	munmap(r->sqes, p.sq_entries * sizeof(struct io_uring_sqe));
+	munmap(sq, sq_size);
+	close(fd);
+	free(r);
+	return NULL;
+}
+for (i=0; i<URING_BUFS; i++) uring_buf_give(r, (unsigned short) i);
+return r;
+}
+
+struct uring_chan *uring_chan_create(struct uring *r, int fd, int write)
+{
+struct uring_chan *c;
+
+c = (struct uring_chan *) calloc(1, sizeof(struct uring_chan));
+c->ring = r;
+c->fd = fd;
+c->write = write;
+if (write) {
+	c->wbuf = (char *) malloc(URING_WRITE_MAX);
+}
+else {
+	c->bid = (unsigned short *) malloc(URING_BUFS * sizeof(short));
+	c->blen = (int *) malloc(URING_BUFS * sizeof(int));
+}
+if (r->chan_num == r->chan_cap) {
+	r->chan_cap = r->chan_cap == 0 ? 8 : 2 * r->chan_cap;
+	r->chan = (struct uring_chan **) realloc(r->chan,
+		r->chan_cap * sizeof(struct uring_chan *));
+}
+r->chan[r->chan_num++] = c;
+return c;
+}
+
+/* A submission to fill in, or NULL if the ring is full */
+static struct io_uring_sqe *uring_sqe(struct uring *r)
+{
+struct io_uring_sqe *sqe;
+unsigned int tail, head;
+
+tail = *r->sq_tail;
+head = atomic_load_explicit((_Atomic unsigned int *) r->sq_head,
+	memory_order_acquire);
+if (tail - head > r->sq_mask) return NULL;
+sqe = &r->sqes[tail & r->sq_mask];
+memset(sqe, 0, sizeof(struct io_uring_sqe));
+r->sq_array[tail & r->sq_mask] = tail & r->sq_mask;
+atomic_store_explicit((_Atomic unsigned int *) r->sq_tail, tail + 1,
+	memory_order_release);
+r->queued++;
+return sqe;
+}
+
+/* Post a multishot read, if there are buffers for it */
+static void uring_arm(struct uring_chan *c)
+{
+struct io_uring_sqe *sqe;
+
+if (c->armed || c->failed || c->ring->br_free == 0) return;
+sqe = uring_sqe(c->ring);
+if (sqe == NULL) return;
+sqe->opcode = IORING_OP_READ_MULTISHOT;
+sqe->fd = c->fd;
+sqe->flags = IOSQE_BUFFER_SELECT;
+sqe->buf_group = URING_GROUP;
+sqe->user_data = (unsigned long) c;
+c->armed = 1;
+}
+
+/* Queue the rest of the channel's write */
+static void uring_queue_write(struct uring_chan *c)
+{
+struct io_uring_sqe *sqe;
+
+sqe = uring_sqe(c->ring);
+if (sqe == NULL) return;	/* Tried again at the next submit */
+sqe->opcode = IORING_OP_WRITE;
+sqe->fd = c->fd;
+sqe->addr = (unsigned long) (c->wbuf + c->woff);
+sqe->len = c->wlen - c->woff;
+sqe->off = (unsigned long long) -1;	/* The file position, as write() */
+sqe->user_data = (unsigned long) c;
+c->busy = 2;			/* In flight */
+}
+
+static void uring_complete(struct uring *r, struct io_uring_cqe *cqe)
+{
+struct uring_chan *c = (struct uring_chan *) (unsigned long) cqe->user_data;
+int k;
+
+if (c->write) {
+	if (cqe->res > 0) c->woff += cqe->res;
+	else if (cqe->res != -EAGAIN && cqe->res != -EINTR) {
+		c->failed = 1;		/* Fall back to write(), from woff */
+	}
+	if (c->woff >= c->wlen || c->failed) c->busy = 0;
+	else c->busy = 1;		/* Queued again at the next submit */
+	return;
+}
+if (cqe->flags & IORING_CQE_F_BUFFER) {
+	r->br_free--;
+	k = (c->bhead + c->bnum) % URING_BUFS;
+	c->bid[k] = (unsigned short) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+	c->blen[k] = cqe->res > 0 ? cqe->res : 0;
+	c->bnum++;
+}
+if (!(cqe->flags & IORING_CQE_F_MORE)) c->armed = 0;
+if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS
+	&& cqe->res != -EAGAIN && cqe->res != -EINTR)) {
+	c->failed = 1;		/* End of file, or not supported */
+}
+}
+
+/* Take the completions the kernel has posted */
+static void uring_reap(struct uring *r)
+{
+unsigned int head, tail;
+
+head = *r->cq_head;
+tail = atomic_load_explicit((_Atomic unsigned int *) r->cq_tail,
+	memory_order_acquire);
+while (head != tail) {
+	uring_complete(r, &r->cqes[head & r->cq_mask]);
+	head++;
+}
+atomic_store_explicit((_Atomic unsigned int *) r->cq_head, head,
+	memory_order_release);
+}
+
+int uring_read(struct uring_chan *c, char *data, int n)
+{
+struct uring *r = c->ring;
+int got = 0;
+int k;
+
+uring_reap(r);
+while (got < n && c->bnum > 0) {
+	k = c->blen[c->bhead] - c->boff;
+	if (k > n - got) k = n - got;
+	memcpy(data + got, r->bufs + (long) c->bid[c->bhead] * URING_BUF_SIZE
+		+ c->boff, k);
+	got += k;
+	c->boff += k;
+	if (c->boff == c->blen[c->bhead]) {	/* All taken */
+		uring_buf_give(r, c->bid[c->bhead]);
+		c->bhead = (c->bhead + 1) % URING_BUFS;
+		c->bnum--;
+		c->boff = 0;
+	}
+}
+if (got == 0 && c->failed && c->bnum == 0) {
+	got = read(c->fd, data, n);
+	if (got < 0) got = 0;
+}
+return got;
+}
+
+/*
+ * Write with write() what a failed write left of the channel's
+ * buffer, so the stream goes on where it stopped.  Returns 1 once
+ * it is all written.
+ */
+static int uring_write_rest(struct uring_chan *c)
+{
+int k;
+
+if (c->woff < c->wlen) {
+	k = write(c->fd, c->wbuf + c->woff, c->wlen - c->woff);
+	if (k > 0) c->woff += k;
+}
+return c->woff >= c->wlen;
+}
+
+int uring_write(struct uring_chan *c, char *data, int n)
+{
+uring_reap(c->ring);
+if (c->failed && !c->busy) {
+	if (!uring_write_rest(c)) return 0;
+	n = write(c->fd, data, n);
+	return n < 0 ? 0 : n;
+}
+if (c->busy) return 0;
+if (n > URING_WRITE_MAX) n = URING_WRITE_MAX;
+memcpy(c->wbuf, data, n);
+c->wlen = n;
+c->woff = 0;
+uring_queue_write(c);
+if (c->busy == 0) c->busy = 1;	/* Ring full; queued at the submit */
+return n;
+}
+
+void uring_submit(struct uring *r)
+{
+struct uring_chan *c;
+int i, n;
+
+uring_reap(r);
+for (i=0; i<r->chan_num; i++) {
+	c = r->chan[i];
+	if (c->write) {
+		if (c->busy == 1) uring_queue_write(c);
+		else if (c->failed && !c->busy) uring_write_rest(c);
+	}
+	else uring_arm(c);
+}
+if (r->queued > 0) {
+	n = sys_uring_enter(r->fd, r->queued, 0, 0);
+	if (n > 0) r->queued -= n;
+}
+}
+
+#else	/* No io_uring in the headers: always use read() and write() */
+
+int uring_available()
+{
+return 0;
+}
+
+struct uring *uring_create()
+{
+return NULL;
+}
+
+struct uring_chan *uring_chan_create(struct uring *r, int fd, int write)
+{
+return NULL;
+}
+
+int uring_read(struct uring_chan *c, char *data, int n)
+{
+return 0;
+}
+
+int uring_write(struct uring_chan *c, char *data, int n)
+{
+return 0;
+}
+
+void uring_submit(struct uring *r)
+{
+}
+
+#endif
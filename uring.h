@@ -0,0 +1,56 @@
+/*
+ * uring.h
+ *
+ * io_uring I/O for a host's pipes (net367 -u).  Each host has a
+ * ring.  A pipe it reads has a multishot read posted on it, so the
+ * kernel fills buffers as data comes and the host takes the bytes
+ * from memory.  Writes are queued and all submitted together once
+ * per pass of the host loop.  A host then makes at most one system
+ * call per pass for its ports and manager channel, however many
+ * packets move.  Without io_uring the ports use read() and write().
+ */
+
+struct uring;
+
+struct uring_chan {	/* A file descriptor used through the ring */
+	struct uring *ring;
+	int fd;
+	int write;		/* Written rather than read */
+	int failed;		/* The ring cannot do it; use read()/write() */
+
+	int armed;		/* Read: a multishot read is posted */
+	unsigned short *bid;	/* Read: buffers the kernel filled, */
+	int *blen;		/*    oldest first, with their lengths */
+	int bhead;
+	int bnum;
+	int boff;		/* Bytes taken from the oldest */
+
+	char *wbuf;		/* Write: bytes being written */
+	int wlen;
+	int woff;		/* How many are written */
+	int busy;		/* A write is queued or in flight */
+};
+
+/* The kernel has io_uring and lets us use it */
+int uring_available();
+
+/* A ring, or NULL if io_uring is not available */
+struct uring *uring_create();
+
+/* Use fd through ring r, for reading or (write = 1) writing */
+struct uring_chan *uring_chan_create(struct uring *r, int fd, int write);
+
+/*
+ * Take up to n bytes the kernel has read.  Like read() on a
+ * nonblocking pipe, returns how many there were, or 0 if none.
+ */
+int uring_read(struct uring_chan *c, char *data, int n);
+
+/*
+ * Queue up to n bytes to write.  Returns how many are taken, or 0
+ * if the last write is not done; the bytes are copied.
+ */
+int uring_write(struct uring_chan *c, char *data, int n);
+
+/* Take completions and submit what is queued, in one system call */
+void uring_submit(struct uring *r);